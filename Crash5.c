@@ -2,326 +2,3795 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <limits.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// Кольцо коэффициентов: int64 с контролем переполнения, вычеты по простому модулю
+// (умножение в форме Монтгомери) или целые произвольной точности
+typedef enum { RING_INT64, RING_MOD, RING_BIG } RingKind;
+
+typedef struct CoefRing {
+    RingKind kind;
+    uint64_t modulus;  // RING_MOD: простое p < 2^62
+    uint64_t mont_inv; // -p^(-1) mod 2^64
+    uint64_t mont_r2;  // 2^128 mod p
+} CoefRing;
+
+#define DEFAULT_MODULUS 998244353ULL
+
+// Состояние сеанса калькулятора свое у каждого потока: в пакетном режиме
+// скрипты выполняются параллельно и не видят кольцо, сумматор и регистры друг друга
+_Thread_local CoefRing ring = { RING_INT64, 0, 0, 0 };
+_Thread_local int coef_overflow = 0;        // выставляется при переполнении в кольце int64
+_Thread_local const char* poly_error = NULL; // операция не определена для своих аргументов
+_Thread_local FILE* poly_out = NULL;         // вывод результатов сеанса
+_Thread_local long command_count = 0;        // выполнено команд в сеансе
+
+typedef long long Coef;
+
+// Арифметика Монтгомери, R = 2^64
+static inline uint64_t mont_reduce(unsigned __int128 t) {
+    uint64_t m = (uint64_t)t * ring.mont_inv;
+    uint64_t u = (uint64_t)((t + (unsigned __int128)m * ring.modulus) >> 64);
+    return u >= ring.modulus ? u - ring.modulus : u;
+}
+
+static inline uint64_t mont_mul(uint64_t a, uint64_t b) {
+    return mont_reduce((unsigned __int128)a * b);
+}
+
+static inline uint64_t to_mont(uint64_t a) {
+    return mont_mul(a, ring.mont_r2);
+}
+
+static inline uint64_t from_mont(uint64_t a) {
+    return mont_reduce(a);
+}
+
+static inline uint64_t add_mod(uint64_t a, uint64_t b) {
+    uint64_t s = a + b;
+    return s >= ring.modulus ? s - ring.modulus : s;
+}
+
+static inline uint64_t sub_mod(uint64_t a, uint64_t b) {
+    return a >= b ? a - b : a + ring.modulus - b;
+}
+
+static uint64_t mul_mod_u64(uint64_t a, uint64_t b, uint64_t mod) {
+    return (uint64_t)((unsigned __int128)a * b % mod);
+}
+
+static uint64_t pow_mod_u64(uint64_t base, uint64_t exp, uint64_t mod) {
+    uint64_t result = 1 % mod;
+    base %= mod;
+    while (exp) {
+        if (exp & 1) result = mul_mod_u64(result, base, mod);
+        base = mul_mod_u64(base, base, mod);
+        exp >>= 1;
+    }
+    return result;
+}
+
+// Детерминированный тест Миллера-Рабина для 64-битных чисел
+static int is_prime_u64(uint64_t n) {
+    static const uint64_t bases[] = { 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37 };
+    if (n < 2) return 0;
+    for (int i = 0; i < 12; i++) {
+        if (n % bases[i] == 0) return n == bases[i];
+    }
+
+    uint64_t d = n - 1;
+    int r = 0;
+    while (d % 2 == 0) { d /= 2; r++; }
+
+    for (int i = 0; i < 12; i++) {
+        uint64_t x = pow_mod_u64(bases[i], d, n);
+        if (x == 1 || x == n - 1) continue;
+        int composite = 1;
+        for (int j = 1; j < r && composite; j++) {
+            x = mul_mod_u64(x, x, n);
+            if (x == n - 1) composite = 0;
+        }
+        if (composite) return 0;
+    }
+    return 1;
+}
+
+int set_ring(RingKind kind, uint64_t modulus) {
+    if (kind == RING_MOD) {
+        if (modulus >= (1ULL << 62) || modulus < 3 || !is_prime_u64(modulus)) return 0;
+
+        uint64_t inv = modulus; // Ньютон: точность удваивается на каждом шаге
+        for (int i = 0; i < 6; i++) inv *= 2 - modulus * inv;
+
+        uint64_t r = (0 - modulus) % modulus;
+        ring.modulus = modulus;
+        ring.mont_inv = 0 - inv;
+        ring.mont_r2 = mul_mod_u64(r, r, modulus);
+    }
+    ring.kind = kind;
+    return 1;
+}
+
+// Скалярные операции в текущем кольце (RING_INT64 / RING_MOD)
+static inline Coef coef_add(Coef a, Coef b) {
+    if (ring.kind == RING_MOD) return (Coef)add_mod((uint64_t)a, (uint64_t)b);
+    Coef r;
+    if (__builtin_add_overflow(a, b, &r)) coef_overflow = 1;
+    return r;
+}
+
+static inline Coef coef_mul(Coef a, Coef b) {
+    if (ring.kind == RING_MOD) return (Coef)mul_mod_u64((uint64_t)a, (uint64_t)b, ring.modulus);
+    Coef r;
+    if (__builtin_mul_overflow(a, b, &r)) coef_overflow = 1;
+    return r;
+}
+
+static inline Coef coef_neg(Coef a) {
+    if (ring.kind == RING_MOD) return a ? (Coef)(ring.modulus - (uint64_t)a) : 0;
+    if (a == LLONG_MIN) coef_overflow = 1;
+    return -a;
+}
+
+static inline Coef coef_from_ll(long long v) {
+    if (ring.kind != RING_MOD) return v;
+    long long r = v % (long long)ring.modulus;
+    return r < 0 ? r + (long long)ring.modulus : r;
+}
+
+// Целые произвольной точности: знак и модуль по основанию 2^32 (младшие разряды первыми)
+typedef struct BigInt {
+    int sign; // -1, 0, 1
+    int len;
+    uint32_t* limbs;
+} BigInt;
+
+static BigInt big_alloc(int len) {
+    BigInt r;
+    r.sign = 0;
+    r.len = len;
+    r.limbs = calloc(len ? len : 1, sizeof(uint32_t));
+    return r;
+}
+
+void big_free(BigInt* a) {
+    free(a->limbs);
+    a->limbs = NULL;
+    a->len = 0;
+    a->sign = 0;
+}
+
+static void big_trim(BigInt* a) {
+    while (a->len > 0 && a->limbs[a->len - 1] == 0) a->len--;
+    if (a->len == 0) a->sign = 0;
+}
+
+BigInt big_from_ll(long long v) {
+    BigInt r = big_alloc(2);
+    unsigned long long mag = v < 0 ? 0ULL - (unsigned long long)v : (unsigned long long)v;
+    r.limbs[0] = (uint32_t)mag;
+    r.limbs[1] = (uint32_t)(mag >> 32);
+    r.sign = v < 0 ? -1 : 1;
+    big_trim(&r);
+    return r;
+}
+
+BigInt big_copy(const BigInt* a) {
+    BigInt r = big_alloc(a->len);
+    memcpy(r.limbs, a->limbs, sizeof(uint32_t) * a->len);
+    r.sign = a->sign;
+    return r;
+}
+
+static int big_cmp_abs(const BigInt* a, const BigInt* b) {
+    if (a->len != b->len) return a->len < b->len ? -1 : 1;
+    for (int i = a->len - 1; i >= 0; i--) {
+        if (a->limbs[i] != b->limbs[i]) return a->limbs[i] < b->limbs[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+BigInt big_add(const BigInt* a, const BigInt* b) {
+    if (a->sign == 0) return big_copy(b);
+    if (b->sign == 0) return big_copy(a);
+
+    if (a->sign == b->sign) {
+        int len = (a->len > b->len ? a->len : b->len) + 1;
+        BigInt r = big_alloc(len);
+        uint64_t carry = 0;
+        for (int i = 0; i < len; i++) {
+            uint64_t s = carry;
+            if (i < a->len) s += a->limbs[i];
+            if (i < b->len) s += b->limbs[i];
+            r.limbs[i] = (uint32_t)s;
+            carry = s >> 32;
+        }
+        r.sign = a->sign;
+        big_trim(&r);
+        return r;
+    }
+
+    // Разные знаки: из большего по модулю вычитаем меньший
+    int cmp = big_cmp_abs(a, b);
+    if (cmp == 0) return big_alloc(0);
+    const BigInt* big = cmp > 0 ? a : b;
+    const BigInt* small = cmp > 0 ? b : a;
+
+    BigInt r = big_alloc(big->len);
+    int64_t borrow = 0;
+    for (int i = 0; i < big->len; i++) {
+        int64_t d = (int64_t)big->limbs[i] - borrow - (i < small->len ? small->limbs[i] : 0);
+        borrow = d < 0;
+        r.limbs[i] = (uint32_t)(d + (borrow << 32));
+    }
+    r.sign = big->sign;
+    big_trim(&r);
+    return r;
+}
+
+BigInt big_mul(const BigInt* a, const BigInt* b) {
+    if (a->sign == 0 || b->sign == 0) return big_alloc(0);
+
+    BigInt r = big_alloc(a->len + b->len);
+    for (int i = 0; i < a->len; i++) {
+        uint64_t carry = 0;
+        for (int j = 0; j < b->len; j++) {
+            uint64_t t = (uint64_t)a->limbs[i] * b->limbs[j] + r.limbs[i + j] + carry;
+            r.limbs[i + j] = (uint32_t)t;
+            carry = t >> 32;
+        }
+        r.limbs[i + b->len] = (uint32_t)carry;
+    }
+    r.sign = a->sign * b->sign;
+    big_trim(&r);
+    return r;
+}
+
+// a = a * mul + add (mul, add < 2^32), только для неотрицательных
+static void big_mul_add_small(BigInt* a, uint32_t mul, uint32_t add) {
+    uint64_t carry = add;
+    for (int i = 0; i < a->len; i++) {
+        uint64_t t = (uint64_t)a->limbs[i] * mul + carry;
+        a->limbs[i] = (uint32_t)t;
+        carry = t >> 32;
+    }
+    if (carry) {
+        a->limbs = realloc(a->limbs, sizeof(uint32_t) * (a->len + 1));
+        a->limbs[a->len++] = (uint32_t)carry;
+    }
+    if (a->len > 0 && a->sign == 0) a->sign = 1;
+    big_trim(a);
+}
+
+BigInt big_from_digits(const char* digits, int count) {
+    BigInt r = big_alloc(0);
+    int i = 0;
+    while (i < count) {
+        // Порции по 9 десятичных цифр
+        int chunk = count - i < 9 ? count - i : 9;
+        uint32_t value = 0, scale = 1;
+        for (int j = 0; j < chunk; j++) {
+            value = value * 10 + (uint32_t)(digits[i + j] - '0');
+            scale *= 10;
+        }
+        big_mul_add_small(&r, scale, value);
+        i += chunk;
+    }
+    return r;
+}
+
+static int big_is_one(const BigInt* a) {
+    return a->len == 1 && a->limbs[0] == 1;
+}
+
+// Модуль числа в десятичной записи
+void print_big_abs(const BigInt* a) {
+    if (a->len == 0) {
+        fprintf(poly_out, "0");
+        return;
+    }
+
+    BigInt t = big_copy(a);
+    uint32_t* chunks = malloc(sizeof(uint32_t) * (a->len * 10 / 9 + 2));
+    int count = 0;
+    do {
+        uint64_t rem = 0;
+        for (int i = t.len - 1; i >= 0; i--) {
+            uint64_t cur = (rem << 32) | t.limbs[i];
+            t.limbs[i] = (uint32_t)(cur / 1000000000u);
+            rem = cur % 1000000000u;
+        }
+        chunks[count++] = (uint32_t)rem;
+        big_trim(&t);
+    } while (t.len > 0);
+
+    fprintf(poly_out, "%u", chunks[count - 1]);
+    for (int i = count - 2; i >= 0; i--) fprintf(poly_out, "%09u", chunks[i]);
+
+    free(chunks);
+    big_free(&t);
+}
+
+// Перевод в кольцо int64 или по модулю; 0 при переполнении int64
+static int big_to_coef(const BigInt* a, Coef* out) {
+    if (ring.kind == RING_MOD) {
+        uint64_t rem = 0;
+        for (int i = a->len - 1; i >= 0; i--) {
+            rem = (uint64_t)((((unsigned __int128)rem << 32) | a->limbs[i]) % ring.modulus);
+        }
+        *out = a->sign < 0 && rem ? (Coef)(ring.modulus - rem) : (Coef)rem;
+        return 1;
+    }
+
+    if (a->len > 2) return 0;
+    uint64_t mag = 0;
+    for (int i = a->len - 1; i >= 0; i--) mag = (mag << 32) | a->limbs[i];
+    if (a->sign >= 0 && mag > (uint64_t)LLONG_MAX) return 0;
+    if (a->sign < 0 && mag > (uint64_t)LLONG_MAX + 1) return 0;
+    *out = a->sign < 0 ? (Coef)(0 - mag) : (Coef)mag;
+    return 1;
+}
+
+// Одночлен для разреженного представления
+typedef struct Term {
+    Coef coef;
+    int exp;
+} Term;
+
+typedef struct BigTerm {
+    BigInt coef;
+    int exp;
+} BigTerm;
+
+// Одночлен от x, y, z: показатели упакованы в 64-битный ключ по 21 бит (x - старшие).
+// Старший бит каждого поля - защитный, поэтому произведение одночленов - сложение ключей,
+// а сравнение ключей - лексикографический порядок x > y > z
+typedef struct MTerm {
+    Coef coef;
+    uint64_t mono;
+} MTerm;
+
+#define MONO_BITS 21
+#define MONO_MAX_EXP ((1 << (MONO_BITS - 1)) - 1)
+#define MONO_FIELD_MASK ((1ULL << MONO_BITS) - 1)
+#define MONO_YZ_MASK ((1ULL << (2 * MONO_BITS)) - 1)
+
+static const char* const MONO_RANGE_ERROR = "exponent too large for a polynomial in x, y, z";
+
+static inline int mono_shift(int var) {
+    return (2 - var) * MONO_BITS;
+}
+
+static inline uint64_t mono_pack(int ex, int ey, int ez) {
+    return ((uint64_t)ex << mono_shift(0)) | ((uint64_t)ey << mono_shift(1)) | (uint64_t)ez;
+}
+
+static inline int mono_exp(uint64_t mono, int var) {
+    return (int)((mono >> mono_shift(var)) & MONO_FIELD_MASK);
+}
+
+static inline int mono_degree(uint64_t mono) {
+    return mono_exp(mono, 0) + mono_exp(mono, 1) + mono_exp(mono, 2);
+}
+
+// Плотный многочлен - массив коэффициентов coefs[0..degree],
+// разреженный - массив одночленов по убыванию степени.
+// Представление выбирается по доле ненулевых коэффициентов.
+// В кольце RING_BIG многочлен всегда разреженный с длинными коэффициентами (POLY_BIG).
+// Многочлен, в котором есть y или z, - массив MTerm по убыванию ключа (POLY_MULTI);
+// без y и z он снова становится одномерным.
+typedef enum { POLY_SPARSE, POLY_DENSE, POLY_BIG, POLY_MULTI } PolyLayout;
+
+#define DENSE_MIN_FILL 0.5
+
+typedef struct Polynomial {
+    PolyLayout layout;
+    int degree;   // -1 для нулевого многочлена; у POLY_MULTI - полная степень
+    int count;    // число ненулевых членов
+    int capacity; // выделено элементов в coefs, terms, big_terms или mterms
+    Coef* coefs;
+    Term* terms;
+    BigTerm* big_terms;
+    MTerm* mterms;
+} Polynomial;
+
+// Базовые функции
+Polynomial* poly_new(PolyLayout layout) {
+    Polynomial* poly = calloc(1, sizeof(Polynomial));
+    poly->layout = layout;
+    poly->degree = -1;
+    return poly;
+}
+
+// Пустой многочлен в представлении по умолчанию для текущего кольца
+Polynomial* poly_zero() {
+    return poly_new(ring.kind == RING_BIG ? POLY_BIG : POLY_SPARSE);
+}
+
+// Освобождает только содержимое (для не-кучевых объектов)
+void poly_clear(Polynomial* poly) {
+    for (int i = 0; poly->big_terms && i < poly->count; i++) {
+        big_free(&poly->big_terms[i].coef);
+    }
+    free(poly->coefs);
+    free(poly->terms);
+    free(poly->big_terms);
+    free(poly->mterms);
+    poly->coefs = NULL;
+    poly->terms = NULL;
+    poly->big_terms = NULL;
+    poly->mterms = NULL;
+    poly->degree = -1;
+    poly->count = 0;
+    poly->capacity = 0;
+}
+
+void free_poly(Polynomial* poly) {
+    if (!poly) return;
+    poly_clear(poly);
+    free(poly);
+}
+
+static void reserve_coefs(Polynomial* poly, int degree) {
+    if (degree < poly->capacity) return;
+    int capacity = poly->capacity ? poly->capacity : 8;
+    while (capacity <= degree) capacity *= 2;
+    poly->coefs = realloc(poly->coefs, sizeof(Coef) * capacity);
+    memset(poly->coefs + poly->capacity, 0, sizeof(Coef) * (capacity - poly->capacity));
+    poly->capacity = capacity;
+}
+
+static void reserve_terms(Polynomial* poly, int count) {
+    if (count <= poly->capacity) return;
+    int capacity = poly->capacity ? poly->capacity : 8;
+    while (capacity < count) capacity *= 2;
+    if (poly->layout == POLY_BIG) poly->big_terms = realloc(poly->big_terms, sizeof(BigTerm) * capacity);
+    else if (poly->layout == POLY_MULTI) poly->mterms = realloc(poly->mterms, sizeof(MTerm) * capacity);
+    else poly->terms = realloc(poly->terms, sizeof(Term) * capacity);
+    poly->capacity = capacity;
+}
+
+// Добавляет одночлен в конец без упорядочивания; порядок восстанавливает poly_normalize
+static void push_term(Polynomial* poly, Coef coef, int exp) {
+    if (coef == 0) return;
+    if (poly->layout == POLY_DENSE) {
+        reserve_coefs(poly, exp);
+        poly->coefs[exp] = coef_add(poly->coefs[exp], coef);
+        if (exp > poly->degree) poly->degree = exp;
+        return;
+    }
+    reserve_terms(poly, poly->count + 1);
+    poly->terms[poly->count].coef = coef;
+    poly->terms[poly->count].exp = exp;
+    poly->count++;
+    if (exp > poly->degree) poly->degree = exp;
+}
+
+// Коэффициент переходит во владение многочлена
+static void push_big_term(Polynomial* poly, BigInt coef, int exp) {
+    if (coef.sign == 0) {
+        big_free(&coef);
+        return;
+    }
+    reserve_terms(poly, poly->count + 1);
+    poly->big_terms[poly->count].coef = coef;
+    poly->big_terms[poly->count].exp = exp;
+    poly->count++;
+    if (exp > poly->degree) poly->degree = exp;
+}
+
+static void push_mterm(Polynomial* poly, Coef coef, uint64_t mono) {
+    if (coef == 0) return;
+    reserve_terms(poly, poly->count + 1);
+    poly->mterms[poly->count].coef = coef;
+    poly->mterms[poly->count].mono = mono;
+    poly->count++;
+    if (mono_degree(mono) > poly->degree) poly->degree = mono_degree(mono);
+}
+
+static int compare_terms_desc(const void* a, const void* b) {
+    int ea = ((const Term*)a)->exp, eb = ((const Term*)b)->exp;
+    return (ea < eb) - (ea > eb);
+}
+
+static int compare_big_terms_desc(const void* a, const void* b) {
+    int ea = ((const BigTerm*)a)->exp, eb = ((const BigTerm*)b)->exp;
+    return (ea < eb) - (ea > eb);
+}
+
+static int compare_mterms_desc(const void* a, const void* b) {
+    uint64_t ma = ((const MTerm*)a)->mono, mb = ((const MTerm*)b)->mono;
+    return (ma < mb) - (ma > mb);
+}
+
+static void to_sparse(Polynomial* poly) {
+    Term* terms = malloc(sizeof(Term) * (poly->count ? poly->count : 1));
+    int count = 0;
+    for (int e = poly->degree; e >= 0; e--) {
+        if (poly->coefs[e] != 0) {
+            terms[count].coef = poly->coefs[e];
+            terms[count].exp = e;
+            count++;
+        }
+    }
+    free(poly->coefs);
+    poly->coefs = NULL;
+    poly->terms = terms;
+    poly->count = count;
+    poly->capacity = count ? count : 1;
+    poly->layout = POLY_SPARSE;
+}
+
+static void to_dense(Polynomial* poly) {
+    int capacity = poly->degree + 1;
+    Coef* coefs = calloc(capacity ? capacity : 1, sizeof(Coef));
+    for (int i = 0; i < poly->count; i++) {
+        coefs[poly->terms[i].exp] = poly->terms[i].coef;
+    }
+    free(poly->terms);
+    poly->terms = NULL;
+    poly->coefs = coefs;
+    poly->capacity = capacity;
+    poly->layout = POLY_DENSE;
+}
+
+static void normalize_big(Polynomial* poly) {
+    if (poly->count > 1) qsort(poly->big_terms, poly->count, sizeof(BigTerm), compare_big_terms_desc);
+
+    int out = 0;
+    for (int i = 0; i < poly->count; ) {
+        int exp = poly->big_terms[i].exp;
+        BigInt coef = poly->big_terms[i++].coef;
+        while (i < poly->count && poly->big_terms[i].exp == exp) {
+            BigInt sum = big_add(&coef, &poly->big_terms[i].coef);
+            big_free(&coef);
+            big_free(&poly->big_terms[i].coef);
+            coef = sum;
+            i++;
+        }
+        if (coef.sign != 0) {
+            poly->big_terms[out].coef = coef;
+            poly->big_terms[out].exp = exp;
+            out++;
+        }
+        else big_free(&coef);
+    }
+    poly->count = out;
+    poly->degree = out ? poly->big_terms[0].exp : -1;
+}
+
+// Сортировка и слияние одночленов от x, y, z; без y и z - переход к POLY_SPARSE
+static void normalize_multi(Polynomial* poly) {
+    int sorted = 1;
+    for (int i = 1; i < poly->count && sorted; i++) {
+        if (poly->mterms[i - 1].mono <= poly->mterms[i].mono) sorted = 0;
+    }
+    if (!sorted) qsort(poly->mterms, poly->count, sizeof(MTerm), compare_mterms_desc);
+
+    int out = 0, univariate = 1;
+    poly->degree = -1;
+    for (int i = 0; i < poly->count; ) {
+        uint64_t mono = poly->mterms[i].mono;
+        Coef coef = 0;
+        while (i < poly->count && poly->mterms[i].mono == mono) coef = coef_add(coef, poly->mterms[i++].coef);
+        if (coef == 0) continue;
+        poly->mterms[out].coef = coef;
+        poly->mterms[out].mono = mono;
+        out++;
+        if (mono_degree(mono) > poly->degree) poly->degree = mono_degree(mono);
+        if (mono & MONO_YZ_MASK) univariate = 0;
+    }
+    poly->count = out;
+    if (!univariate) return;
+
+    Term* terms = malloc(sizeof(Term) * (out ? out : 1));
+    for (int i = 0; i < out; i++) {
+        terms[i].coef = poly->mterms[i].coef;
+        terms[i].exp = mono_exp(poly->mterms[i].mono, 0);
+    }
+    free(poly->mterms);
+    poly->mterms = NULL;
+    poly->terms = terms;
+    poly->capacity = out ? out : 1;
+    poly->layout = POLY_SPARSE;
+}
+
+// Приводит многочлен к каноническому виду и выбирает представление по заполненности
+void poly_normalize(Polynomial* poly) {
+    if (poly->layout == POLY_BIG) {
+        normalize_big(poly);
+        return;
+    }
+    if (poly->layout == POLY_MULTI) {
+        normalize_multi(poly);
+        if (poly->layout == POLY_MULTI) return;
+    }
+
+    if (poly->layout == POLY_DENSE) {
+        while (poly->degree >= 0 && poly->coefs[poly->degree] == 0) poly->degree--;
+        poly->count = 0;
+        for (int e = 0; e <= poly->degree; e++) {
+            if (poly->coefs[e] != 0) poly->count++;
+        }
+    }
+    else {
+        int sorted = 1;
+        for (int i = 1; i < poly->count && sorted; i++) {
+            if (poly->terms[i - 1].exp <= poly->terms[i].exp) sorted = 0;
+        }
+        if (!sorted) qsort(poly->terms, poly->count, sizeof(Term), compare_terms_desc);
+
+        // Слияние одинаковых степеней и удаление нулей
+        int out = 0;
+        for (int i = 0; i < poly->count; ) {
+            int exp = poly->terms[i].exp;
+            Coef coef = 0;
+            while (i < poly->count && poly->terms[i].exp == exp) coef = coef_add(coef, poly->terms[i++].coef);
+            if (coef != 0) {
+                poly->terms[out].coef = coef;
+                poly->terms[out].exp = exp;
+                out++;
+            }
+        }
+        poly->count = out;
+        poly->degree = out ? poly->terms[0].exp : -1;
+    }
+
+    if (poly->degree < 0) return;
+    double fill = (double)poly->count / (poly->degree + 1);
+    if (poly->layout == POLY_SPARSE && fill >= DENSE_MIN_FILL) to_dense(poly);
+    else if (poly->layout == POLY_DENSE && fill < DENSE_MIN_FILL) to_sparse(poly);
+}
+
+// Добавляет одночлен без нормализации, за амортизированное O(1): многочлен собирается
+// серией add_term, после последнего члена нужен один вызов poly_normalize
+void add_term(Polynomial* poly, Coef coef, int exp) {
+    if (poly->layout == POLY_BIG) push_big_term(poly, big_from_ll(coef), exp);
+    else push_term(poly, coef_from_ll(coef), exp);
+}
+
+// Одночлены в порядке убывания степени независимо от представления (кроме POLY_BIG)
+static Term* poly_terms(const Polynomial* poly, int* count) {
+    if (poly->layout == POLY_SPARSE) {
+        *count = poly->count;
+        return poly->terms;
+    }
+    Term* terms = malloc(sizeof(Term) * (poly->count ? poly->count : 1));
+    int n = 0;
+    for (int e = poly->degree; e >= 0; e--) {
+        if (poly->coefs[e] != 0) {
+            terms[n].coef = poly->coefs[e];
+            terms[n].exp = e;
+            n++;
+        }
+    }
+    *count = n;
+    return terms;
+}
+
+static void release_terms(const Polynomial* poly, Term* terms) {
+    if (terms != poly->terms) free(terms);
+}
+
+// Одночлены многочлена (кроме POLY_BIG) как одночлены от x, y, z;
+// NULL, если степень не помещается в поле ключа
+static MTerm* multi_terms(const Polynomial* poly, int* count) {
+    if (poly->layout == POLY_MULTI) {
+        *count = poly->count;
+        return poly->mterms;
+    }
+    if (poly->degree > MONO_MAX_EXP) return NULL;
+
+    int n;
+    Term* terms = poly_terms(poly, &n);
+    MTerm* mterms = malloc(sizeof(MTerm) * (n ? n : 1));
+    for (int i = 0; i < n; i++) {
+        mterms[i].coef = terms[i].coef;
+        mterms[i].mono = mono_pack(terms[i].exp, 0, 0);
+    }
+    release_terms(poly, terms);
+    *count = n;
+    return mterms;
+}
+
+static void release_multi_terms(const Polynomial* poly, MTerm* terms) {
+    if (terms != poly->mterms) free(terms);
+}
+
+static int to_multi(Polynomial* poly) {
+    int count;
+    MTerm* mterms = multi_terms(poly, &count);
+    if (!mterms) return 0;
+    free(poly->coefs);
+    free(poly->terms);
+    poly->coefs = NULL;
+    poly->terms = NULL;
+    poly->mterms = mterms;
+    poly->count = count;
+    poly->capacity = count ? count : 1;
+    poly->layout = POLY_MULTI;
+    return 1;
+}
+
+Polynomial* poly_copy(const Polynomial* poly) {
+    Polynomial* copy = poly_new(poly->layout);
+    copy->degree = poly->degree;
+    copy->count = poly->count;
+    if (poly->layout == POLY_DENSE) {
+        copy->capacity = poly->degree + 1;
+        copy->coefs = malloc(sizeof(Coef) * (copy->capacity ? copy->capacity : 1));
+        if (copy->capacity) memcpy(copy->coefs, poly->coefs, sizeof(Coef) * copy->capacity);
+    }
+    else if (poly->layout == POLY_MULTI) {
+        copy->capacity = poly->count;
+        copy->mterms = malloc(sizeof(MTerm) * (copy->capacity ? copy->capacity : 1));
+        if (poly->count) memcpy(copy->mterms, poly->mterms, sizeof(MTerm) * poly->count);
+    }
+    else if (poly->layout == POLY_BIG) {
+        copy->capacity = poly->count;
+        copy->big_terms = malloc(sizeof(BigTerm) * (copy->capacity ? copy->capacity : 1));
+        for (int i = 0; i < poly->count; i++) {
+            copy->big_terms[i].coef = big_copy(&poly->big_terms[i].coef);
+            copy->big_terms[i].exp = poly->big_terms[i].exp;
+        }
+    }
+    else {
+        copy->capacity = poly->count;
+        copy->terms = malloc(sizeof(Term) * (copy->capacity ? copy->capacity : 1));
+        if (poly->count) memcpy(copy->terms, poly->terms, sizeof(Term) * poly->count);
+    }
+    return copy;
+}
+
+// Перевод многочлена в текущее кольцо (после смены кольца); 0 при переполнении.
+// Многочлены от x, y, z в Ring(big) не переводятся
+int poly_convert(const Polynomial* poly, Polynomial** out) {
+    Polynomial* result = poly_zero();
+    int ok = 1;
+
+    if (poly->layout == POLY_MULTI) {
+        if (ring.kind == RING_BIG) ok = 0;
+        else result->layout = POLY_MULTI;
+        for (int i = 0; i < poly->count && ok; i++) {
+            BigInt coef = big_from_ll(poly->mterms[i].coef);
+            Coef value;
+            if (big_to_coef(&coef, &value)) push_mterm(result, value, poly->mterms[i].mono);
+            else ok = 0;
+            big_free(&coef);
+        }
+        poly_normalize(result);
+        *out = result;
+        return ok;
+    }
+
+    int count;
+    Term* terms = poly->layout == POLY_BIG ? NULL : poly_terms(poly, &count);
+    if (poly->layout == POLY_BIG) count = poly->count;
+
+    for (int i = 0; i < count && ok; i++) {
+        BigInt coef;
+        int exp;
+        if (poly->layout == POLY_BIG) {
+            coef = big_copy(&poly->big_terms[i].coef);
+            exp = poly->big_terms[i].exp;
+        }
+        else {
+            // Вычеты по модулю переводятся как неотрицательные представители
+            coef = big_from_ll(terms[i].coef);
+            exp = terms[i].exp;
+        }
+
+        if (result->layout == POLY_BIG) {
+            push_big_term(result, coef, exp);
+            continue;
+        }
+
+        Coef value;
+        if (big_to_coef(&coef, &value)) push_term(result, value, exp);
+        else ok = 0;
+        big_free(&coef);
+    }
+
+    if (terms) release_terms(poly, terms);
+    poly_normalize(result);
+    *out = result;
+    return ok;
+}
+
+// Разбор за один проход прямо из буфера скрипта: текст не копируется,
+// длина литерала ничем не ограничена. Одночлен - коэффициент и множители x, y, z
+// со степенями (3x^2yz, 3x^2*y*z); при первом y или z многочлен становится POLY_MULTI.
+// NULL и poly_error, если такой многочлен не представим
+Polynomial* parse_poly_span(const char* p, const char* end) {
+    Polynomial* poly = poly_zero();
+
+    while (p < end) {
+        while (p < end && isspace((unsigned char)*p)) p++;
+        if (p == end) break;
+
+        int sign = 1;
+        int exps[3] = { 0, 0, 0 };
+        const char* digits = p;
+        int digit_count = 0;
+
+        if (*p == '+') { sign = 1; p++; }
+        else if (*p == '-') { sign = -1; p++; }
+
+        if (p < end && isdigit((unsigned char)*p)) {
+            digits = p;
+            while (p < end && isdigit((unsigned char)*p)) p++;
+            digit_count = (int)(p - digits);
+        }
+
+        while (p < end && (*p == '*' || (*p >= 'x' && *p <= 'z'))) {
+            if (*p++ == '*') continue;
+            int var = p[-1] - 'x', exp = 1;
+            if (p < end && *p == '^') {
+                p++;
+                exp = 0;
+                while (p < end && isdigit((unsigned char)*p)) {
+                    exp = exp * 10 + (*p - '0');
+                    p++;
+                }
+            }
+            exps[var] += exp;
+        }
+        int exp = exps[0];
+
+        if ((exps[1] || exps[2]) && poly->layout != POLY_MULTI) {
+            if (ring.kind == RING_BIG) poly_error = "polynomials in y and z are not supported in Ring(big)";
+            else if (!to_multi(poly)) poly_error = MONO_RANGE_ERROR;
+            if (poly->layout != POLY_MULTI) {
+                free_poly(poly);
+                return NULL;
+            }
+        }
+        if (poly->layout == POLY_MULTI &&
+            (exps[0] > MONO_MAX_EXP || exps[1] > MONO_MAX_EXP || exps[2] > MONO_MAX_EXP)) {
+            poly_error = MONO_RANGE_ERROR;
+            free_poly(poly);
+            return NULL;
+        }
+
+        if (poly->layout == POLY_BIG) {
+            BigInt coef = digit_count ? big_from_digits(digits, digit_count) : big_from_ll(1);
+            if (sign < 0) coef.sign = -coef.sign;
+            push_big_term(poly, coef, exp);
+        }
+        else {
+            Coef coef = digit_count ? 0 : 1;
+            for (int i = 0; i < digit_count; i++) {
+                coef = coef_add(coef_mul(coef, 10), digits[i] - '0');
+            }
+            coef = sign < 0 ? coef_neg(coef) : coef;
+            if (poly->layout == POLY_MULTI) push_mterm(poly, coef, mono_pack(exps[0], exps[1], exps[2]));
+            else push_term(poly, coef, exp);
+        }
+
+        while (p < end && *p != '+' && *p != '-') p++;
+    }
+
+    poly_normalize(poly);
+    return poly;
+}
+
+Polynomial* parse_poly(const char* str) {
+    return parse_poly_span(str, str + strlen(str));
+}
+
+static void print_sign(int negative, int first) {
+    if (!first) fprintf(poly_out, " %c ", negative ? '-' : '+');
+    else if (negative) fprintf(poly_out, "-");
+}
+
+static void print_power(int exp) {
+    if (exp == 1) fprintf(poly_out, "x");
+    else if (exp > 1) fprintf(poly_out, "x^%d", exp);
+}
+
+static void print_term(Coef coef, int exp, int first) {
+    print_sign(coef < 0, first);
+
+    unsigned long long mag = coef < 0 ? 0ULL - (unsigned long long)coef : (unsigned long long)coef;
+    if (exp == 0 || mag != 1) fprintf(poly_out, "%llu", mag);
+    print_power(exp);
+}
+
+static void print_mterm(const MTerm* t, int first) {
+    print_sign(t->coef < 0, first);
+
+    unsigned long long mag = t->coef < 0 ? 0ULL - (unsigned long long)t->coef : (unsigned long long)t->coef;
+    if (t->mono == 0 || mag != 1) fprintf(poly_out, "%llu", mag);
+    for (int var = 0; var < 3; var++) {
+        int exp = mono_exp(t->mono, var);
+        if (exp == 1) fprintf(poly_out, "%c", 'x' + var);
+        else if (exp > 1) fprintf(poly_out, "%c^%d", 'x' + var, exp);
+    }
+}
+
+void print_poly(const Polynomial* poly) {
+    if (!poly || poly->degree < 0) {
+        fprintf(poly_out, "0");
+        return;
+    }
+
+    int first = 1;
+    if (poly->layout == POLY_MULTI) {
+        for (int i = 0; i < poly->count; i++) {
+            print_mterm(&poly->mterms[i], first);
+            first = 0;
+        }
+    }
+    else if (poly->layout == POLY_DENSE) {
+        for (int e = poly->degree; e >= 0; e--) {
+            if (poly->coefs[e] == 0) continue;
+            print_term(poly->coefs[e], e, first);
+            first = 0;
+        }
+    }
+    else if (poly->layout == POLY_BIG) {
+        for (int i = 0; i < poly->count; i++) {
+            const BigTerm* t = &poly->big_terms[i];
+            print_sign(t->coef.sign < 0, first);
+            if (t->exp == 0 || !big_is_one(&t->coef)) print_big_abs(&t->coef);
+            print_power(t->exp);
+            first = 0;
+        }
+    }
+    else {
+        for (int i = 0; i < poly->count; i++) {
+            print_term(poly->terms[i].coef, poly->terms[i].exp, first);
+            first = 0;
+        }
+    }
+}
+
+// Операции над многочленами от x, y, z: одномерный операнд поднимается до POLY_MULTI
+static Polynomial* multi_add(const Polynomial* a, const Polynomial* b) {
+    int na, nb;
+    MTerm* ta = multi_terms(a, &na);
+    MTerm* tb = multi_terms(b, &nb);
+    if (!ta || !tb) {
+        if (ta) release_multi_terms(a, ta);
+        if (tb) release_multi_terms(b, tb);
+        poly_error = MONO_RANGE_ERROR;
+        return NULL;
+    }
+
+    Polynomial* result = poly_new(POLY_MULTI);
+    reserve_terms(result, na + nb);
+    int i = 0, j = 0;
+    while (i < na || j < nb) {
+        if (j >= nb || (i < na && ta[i].mono > tb[j].mono)) {
+            push_mterm(result, ta[i].coef, ta[i].mono);
+            i++;
+        }
+        else if (i >= na || tb[j].mono > ta[i].mono) {
+            push_mterm(result, tb[j].coef, tb[j].mono);
+            j++;
+        }
+        else {
+            push_mterm(result, coef_add(ta[i].coef, tb[j].coef), ta[i].mono);
+            i++;
+            j++;
+        }
+    }
+
+    release_multi_terms(a, ta);
+    release_multi_terms(b, tb);
+    poly_normalize(result);
+    return result;
+}
+
+typedef struct MonoHeapItem {
+    uint64_t mono;
+    int i, j;
+} MonoHeapItem;
+
+static void mono_heap_sift_down(MonoHeapItem* heap, int size, int pos) {
+    for (;;) {
+        int largest = pos, l = 2 * pos + 1, r = l + 1;
+        if (l < size && heap[l].mono > heap[largest].mono) largest = l;
+        if (r < size && heap[r].mono > heap[largest].mono) largest = r;
+        if (largest == pos) return;
+        MonoHeapItem t = heap[pos]; heap[pos] = heap[largest]; heap[largest] = t;
+        pos = largest;
+    }
+}
+
+// Умножение слиянием через кучу, как в одномерном случае: ключ произведения -
+// сумма ключей, так как порядок одночленов согласован с умножением
+static Polynomial* multi_mult(const Polynomial* a, const Polynomial* b) {
+    int na, nb;
+    MTerm* ta = multi_terms(a, &na);
+    MTerm* tb = multi_terms(b, &nb);
+
+    // Показатели произведения не должны переполнить поле ключа
+    int fits = ta && tb;
+    for (int var = 0; var < 3 && fits; var++) {
+        int max_a = 0, max_b = 0;
+        for (int i = 0; i < na; i++) if (mono_exp(ta[i].mono, var) > max_a) max_a = mono_exp(ta[i].mono, var);
+        for (int j = 0; j < nb; j++) if (mono_exp(tb[j].mono, var) > max_b) max_b = mono_exp(tb[j].mono, var);
+        fits = max_a + max_b <= MONO_MAX_EXP;
+    }
+    if (!fits) {
+        if (ta) release_multi_terms(a, ta);
+        if (tb) release_multi_terms(b, tb);
+        poly_error = MONO_RANGE_ERROR;
+        return NULL;
+    }
+
+    const Polynomial* pa = a;
+    const Polynomial* pb = b;
+    if (na > nb) {
+        // Куча строится по меньшему множителю
+        MTerm* t = ta; ta = tb; tb = t;
+        int n = na; na = nb; nb = n;
+        pa = b;
+        pb = a;
+    }
+
+    MonoHeapItem* heap = malloc(sizeof(MonoHeapItem) * na);
+    int size = 0;
+    for (int i = 0; i < na; i++) {
+        heap[size].mono = ta[i].mono + tb[0].mono;
+        heap[size].i = i;
+        heap[size].j = 0;
+        size++;
+    }
+    for (int i = size / 2 - 1; i >= 0; i--) mono_heap_sift_down(heap, size, i);
+
+    Polynomial* result = poly_new(POLY_MULTI);
+    while (size > 0) {
+        uint64_t mono = heap[0].mono;
+        __int128 acc = 0;
+        Coef coef = 0;
+        while (size > 0 && heap[0].mono == mono) {
+            MonoHeapItem* top = &heap[0];
+            if (ring.kind == RING_MOD) {
+                coef = coef_add(coef, coef_mul(ta[top->i].coef, tb[top->j].coef));
+            }
+            else if (__builtin_add_overflow(acc, (__int128)ta[top->i].coef * tb[top->j].coef, &acc)) {
+                coef_overflow = 1;
+            }
+            if (++top->j < nb) {
+                top->mono = ta[top->i].mono + tb[top->j].mono;
+            }
+            else {
+                heap[0] = heap[--size];
+            }
+            mono_heap_sift_down(heap, size, 0);
+        }
+        if (ring.kind != RING_MOD) {
+            if (acc > LLONG_MAX || acc < LLONG_MIN) coef_overflow = 1;
+            coef = (Coef)acc;
+        }
+        push_mterm(result, coef, mono);
+    }
+
+    free(heap);
+    release_multi_terms(pa, ta);
+    release_multi_terms(pb, tb);
+    poly_normalize(result);
+    return result;
+}
+
+static Polynomial* multi_diff(const Polynomial* poly, int var) {
+    Polynomial* result = poly_new(POLY_MULTI);
+    reserve_terms(result, poly->count);
+    for (int i = 0; i < poly->count; i++) {
+        const MTerm* t = &poly->mterms[i];
+        int exp = mono_exp(t->mono, var);
+        if (exp > 0) push_mterm(result, coef_mul(t->coef, coef_from_ll(exp)), t->mono - (1ULL << mono_shift(var)));
+    }
+    poly_normalize(result);
+    return result;
+}
+
+// Операции
+static Polynomial* big_poly_add(const Polynomial* a, const Polynomial* b) {
+    Polynomial* result = poly_new(POLY_BIG);
+    reserve_terms(result, a->count + b->count);
+
+    int i = 0, j = 0;
+    while (i < a->count || j < b->count) {
+        const BigTerm* ta = i < a->count ? &a->big_terms[i] : NULL;
+        const BigTerm* tb = j < b->count ? &b->big_terms[j] : NULL;
+        if (!tb || (ta && ta->exp > tb->exp)) {
+            push_big_term(result, big_copy(&ta->coef), ta->exp);
+            i++;
+        }
+        else if (!ta || tb->exp > ta->exp) {
+            push_big_term(result, big_copy(&tb->coef), tb->exp);
+            j++;
+        }
+        else {
+            push_big_term(result, big_add(&ta->coef, &tb->coef), ta->exp);
+            i++;
+            j++;
+        }
+    }
+
+    poly_normalize(result);
+    return result;
+}
+
+Polynomial* poly_add(const Polynomial* a, const Polynomial* b) {
+    if (a->layout == POLY_BIG) return big_poly_add(a, b);
+    if (a->layout == POLY_MULTI || b->layout == POLY_MULTI) return multi_add(a, b);
+
+    if (a->layout == POLY_DENSE && b->layout == POLY_DENSE) {
+        Polynomial* result = poly_new(POLY_DENSE);
+        int degree = a->degree > b->degree ? a->degree : b->degree;
+        reserve_coefs(result, degree);
+        for (int e = 0; e <= a->degree; e++) result->coefs[e] = a->coefs[e];
+        for (int e = 0; e <= b->degree; e++) result->coefs[e] = coef_add(result->coefs[e], b->coefs[e]);
+        result->degree = degree;
+        poly_normalize(result);
+        return result;
+    }
+
+    // Слияние двух упорядоченных последовательностей
+    int na, nb;
+    Term* ta = poly_terms(a, &na);
+    Term* tb = poly_terms(b, &nb);
+
+    Polynomial* result = poly_new(POLY_SPARSE);
+    reserve_terms(result, na + nb);
+    int i = 0, j = 0;
+    while (i < na || j < nb) {
+        if (j >= nb || (i < na && ta[i].exp > tb[j].exp)) {
+            push_term(result, ta[i].coef, ta[i].exp);
+            i++;
+        }
+        else if (i >= na || tb[j].exp > ta[i].exp) {
+            push_term(result, tb[j].coef, tb[j].exp);
+            j++;
+        }
+        else {
+            push_term(result, coef_add(ta[i].coef, tb[j].coef), ta[i].exp);
+            i++;
+            j++;
+        }
+    }
+
+    release_terms(a, ta);
+    release_terms(b, tb);
+    poly_normalize(result);
+    return result;
+}
+// Умножение. Выбор алгоритма - по оценке времени (mult_costs), ядра специализированы по кольцу:
+// Умножение. Выбор алгоритма - по размеру входа, ядра специализированы по кольцу:
+// int64 без риска переполнения считается в кольце по модулю 2^64 (результат точен),
+// при риске - школьным умножением со 128-битным накоплением и проверкой;
+// вычеты по модулю - в форме Монтгомери.
+typedef enum { MULT_AUTO, MULT_SCHOOLBOOK, MULT_KARATSUBA, MULT_NTT, MULT_HEAP } MultAlgorithm;
+
+#define MULT_SCHOOLBOOK_MAX 32  // ниже - школьное умножение (и база рекурсии Карацубы)
+#define NTT_MAX_LOG 23          // 2^23 - наибольшая длина для всех трех модулей
+
+// Оценки времени умножения в наносекундах, по кольцам; сняты на x86-64 и сверяются с --bench.
+// Школьное - на умножение-сложение (нулевые строки пропускаются), Карацуба - на n^log2(3)
+// блока, NTT - на size*log2(size) (в int64 три простых и Гарнер, по модулю - одно простое),
+// куча - на пару членов и уровень кучи. Плотные алгоритмы платят еще за перевод входов
+// в плотный вид и за массив результата. MULT_AUTO берет алгоритм с наименьшей оценкой
+typedef struct MultCosts {
+    double school;
+    double karatsuba;
+    double ntt;
+    double heap;
+    double dense_setup; // на коэффициент результата
+    double dense_fixed; // на вызов, сверх накладных расходов кучи
+} MultCosts;
+
+static const MultCosts mult_costs_int64 = { 0.37, 2.15, 12.0, 4.3, 1.5, 100 };
+static const MultCosts mult_costs_mod = { 1.15, 5.8, 4.3, 4.3, 1.5, 100 };
+
+static void school_wrap(const uint64_t* a, int na, const uint64_t* b, int nb, uint64_t* out) {
+    memset(out, 0, sizeof(uint64_t) * (na + nb - 1));
+    for (int i = 0; i < na; i++) {
+        if (a[i] == 0) continue;
+        for (int j = 0; j < nb; j++) {
+            out[i + j] += a[i] * b[j];
+        }
+    }
+}
+
+// Коэффициенты в форме Монтгомери
+static void school_mont(const uint64_t* a, int na, const uint64_t* b, int nb, uint64_t* out) {
+    memset(out, 0, sizeof(uint64_t) * (na + nb - 1));
+    for (int i = 0; i < na; i++) {
+        if (a[i] == 0) continue;
+        for (int j = 0; j < nb; j++) {
+            out[i + j] = add_mod(out[i + j], mont_mul(a[i], b[j]));
+        }
+    }
+}
+
+static inline uint64_t ring_add(uint64_t a, uint64_t b, int modular) {
+    return modular ? add_mod(a, b) : a + b;
+}
+
+static inline uint64_t ring_sub(uint64_t a, uint64_t b, int modular) {
+    return modular ? sub_mod(a, b) : a - b;
+}
+
+// out - 2n-1 элементов, tmp - рабочая память не меньше 4n + 4 log n
+static void mult_karatsuba(const uint64_t* a, const uint64_t* b, int n, uint64_t* out, uint64_t* tmp, int modular) {
+    if (n <= MULT_SCHOOLBOOK_MAX) {
+        if (modular) school_mont(a, n, b, n, out);
+        else school_wrap(a, n, b, n, out);
+        return;
+    }
+
+    int lo = n / 2, hi = n - lo;
+    const uint64_t* a0 = a, * a1 = a + lo;
+    const uint64_t* b0 = b, * b1 = b + lo;
+
+    uint64_t* sa = tmp;           // a0 + a1, hi элементов
+    uint64_t* sb = tmp + hi;      // b0 + b1, hi элементов
+    uint64_t* mid = tmp + 2 * hi; // (a0+a1)(b0+b1), 2hi-1 элементов
+    uint64_t* rest = tmp + 4 * hi;
+
+    for (int i = 0; i < hi; i++) {
+        sa[i] = i < lo ? ring_add(a1[i], a0[i], modular) : a1[i];
+        sb[i] = i < lo ? ring_add(b1[i], b0[i], modular) : b1[i];
+    }
+
+    memset(out, 0, sizeof(uint64_t) * (2 * n - 1));
+    mult_karatsuba(a0, b0, lo, out, rest, modular);          // z0 -> out[0 .. 2lo-2]
+    mult_karatsuba(a1, b1, hi, out + 2 * lo, rest, modular); // z2 -> out[2lo .. 2n-2]
+    mult_karatsuba(sa, sb, hi, mid, rest, modular);
+
+    // mid -= z0 + z2
+    for (int i = 0; i < 2 * lo - 1; i++) mid[i] = ring_sub(mid[i], out[i], modular);
+    for (int i = 0; i < 2 * hi - 1; i++) mid[i] = ring_sub(mid[i], out[2 * lo + i], modular);
+    for (int i = 0; i < 2 * hi - 1; i++) out[lo + i] = ring_add(out[lo + i], mid[i], modular);
+}
+
+// Несбалансированные входы режутся на блоки длины меньшего множителя
+static void mult_karatsuba_blocked(const uint64_t* a, int na, const uint64_t* b, int nb, uint64_t* out, int modular) {
+    const uint64_t* big = na >= nb ? a : b;
+    const uint64_t* small = na >= nb ? b : a;
+    int nbig = na >= nb ? na : nb;
+    int nsmall = na >= nb ? nb : na;
+
+    uint64_t* chunk = calloc(nsmall, sizeof(uint64_t));
+    uint64_t* prod = malloc(sizeof(uint64_t) * (2 * nsmall - 1));
+    uint64_t* tmp = malloc(sizeof(uint64_t) * 8 * (nsmall + 32));
+
+    memset(out, 0, sizeof(uint64_t) * (na + nb - 1));
+    for (int offset = 0; offset < nbig; offset += nsmall) {
+        int count = nbig - offset < nsmall ? nbig - offset : nsmall;
+        memcpy(chunk, big + offset, sizeof(uint64_t) * count);
+        memset(chunk + count, 0, sizeof(uint64_t) * (nsmall - count));
+        mult_karatsuba(chunk, small, nsmall, prod, tmp, modular);
+        for (int i = 0; i < count + nsmall - 1; i++) {
+            out[offset + i] = ring_add(out[offset + i], prod[i], modular);
+        }
+    }
+
+    free(chunk);
+    free(prod);
+    free(tmp);
+}
+
+static const unsigned ntt_primes[3] = { 998244353u, 167772161u, 469762049u };
+
+// NTT по простому p < 2^30 с умножением Монтгомери (R = 2^32). Корни считаются один раз
+// на свертку и хранятся в форме Монтгомери, поэтому произведение вычета на корень
+// сразу дает обычный вычет, а бабочка обходится без деления
+typedef struct NttPlan {
+    unsigned mod;
+    unsigned mod_inv; // -p^-1 по модулю 2^32
+    int size;
+    unsigned* roots;  // roots[h + j] = w^j, w - корень степени 2h; h - степень двойки < size
+} NttPlan;
+
+static inline unsigned ntt_mul(unsigned a, unsigned b, const NttPlan* plan) {
+    uint64_t t = (uint64_t)a * b;
+    unsigned m = (unsigned)t * plan->mod_inv;
+    unsigned u = (unsigned)((t + (uint64_t)m * plan->mod) >> 32);
+    return u >= plan->mod ? u - plan->mod : u;
+}
+
+static void ntt_plan_init(NttPlan* plan, unsigned mod, int size) {
+    unsigned inv = mod;
+    for (int i = 0; i < 5; i++) inv *= 2 - mod * inv;
+    plan->mod = mod;
+    plan->mod_inv = 0u - inv;
+    plan->size = size;
+    plan->roots = malloc(sizeof(unsigned) * (size > 1 ? size : 2));
+
+    for (int h = 1; h < size; h <<= 1) {
+        uint64_t w = pow_mod_u64(3, (mod - 1) / (2 * h), mod), cur = 1;
+        for (int j = 0; j < h; j++) {
+            plan->roots[h + j] = (unsigned)((cur << 32) % mod);
+            cur = cur * w % mod;
+        }
+    }
+}
+
+// Обратное преобразование - прямое с разворотом a[1..n-1]; деление на n делает вызывающий
+static void ntt(unsigned* a, const NttPlan* plan, int invert) {
+    int n = plan->size;
+    unsigned mod = plan->mod;
+    for (int i = 1, j = 0; i < n; i++) {
+        int bit = n >> 1;
+        for (; j & bit; bit >>= 1) j ^= bit;
+        j ^= bit;
+        if (i < j) { unsigned t = a[i]; a[i] = a[j]; a[j] = t; }
+    }
+
+    for (int h = 1; h < n; h <<= 1) {
+        const unsigned* w = plan->roots + h;
+        for (int i = 0; i < n; i += 2 * h) {
+            unsigned* lo = a + i, * hi = a + i + h;
+            for (int j = 0; j < h; j++) {
+                unsigned u = lo[j];
+                unsigned v = ntt_mul(hi[j], w[j], plan);
+                lo[j] = u + v >= mod ? u + v - mod : u + v;
+                hi[j] = u >= v ? u - v : u + mod - v;
+            }
+        }
+    }
+
+    if (invert) {
+        for (int i = 1, j = n - 1; i < j; i++, j--) { unsigned t = a[i]; a[i] = a[j]; a[j] = t; }
+    }
+}
+
+// Свертка по модулю одного NTT-простого; результат в residue (size элементов)
+static unsigned* ntt_convolve(const Coef* a, int na, const Coef* b, int nb, int size, unsigned mod) {
+    NttPlan plan;
+    ntt_plan_init(&plan, mod, size);
+    unsigned* fa = calloc(size, sizeof(unsigned));
+    unsigned* fb = calloc(size, sizeof(unsigned));
+    for (int i = 0; i < na; i++) fa[i] = (unsigned)((a[i] % (Coef)mod + mod) % mod);
+    for (int i = 0; i < nb; i++) fb[i] = (unsigned)((b[i] % (Coef)mod + mod) % mod);
+    ntt(fa, &plan, 0);
+    ntt(fb, &plan, 0);
+    // Поточечное произведение дает fa*fb/R; множитель n^-1 * R^2 возвращает R и делит на n
+    for (int i = 0; i < size; i++) fa[i] = ntt_mul(fa[i], fb[i], &plan);
+    ntt(fa, &plan, 1);
+    uint64_t r_mod = (1ULL << 32) % mod;
+    unsigned scale = (unsigned)(pow_mod_u64(size, mod - 2, mod) * (r_mod * r_mod % mod) % mod);
+    for (int i = 0; i < size; i++) fa[i] = ntt_mul(fa[i], scale, &plan);
+    free(fb);
+    free(plan.roots);
+    return fa;
+}
+
+// Точная целочисленная свертка по трем NTT-модулям с восстановлением по КТО (Гарнер).
+// Вызывается, только если |результат| < 2^63.
+static void mult_ntt_exact(const Coef* a, int na, const Coef* b, int nb, Coef* out) {
+    int len = na + nb - 1, size = 1;
+    while (size < len) size <<= 1;
+
+    unsigned* residues[3];
+    for (int k = 0; k < 3; k++) residues[k] = ntt_convolve(a, na, b, nb, size, ntt_primes[k]);
+
+    uint64_t m0 = ntt_primes[0], m1 = ntt_primes[1], m2 = ntt_primes[2];
+    uint64_t inv_m0_m1 = pow_mod_u64(m0, m1 - 2, m1);
+    uint64_t inv_m0m1_m2 = pow_mod_u64(m0 * m1 % m2, m2 - 2, m2);
+    unsigned __int128 modulus = (unsigned __int128)m0 * m1 * m2;
+
+    for (int i = 0; i < len; i++) {
+        uint64_t r0 = residues[0][i], r1 = residues[1][i], r2 = residues[2][i];
+        uint64_t t1 = (r1 + m1 - r0 % m1) % m1 * inv_m0_m1 % m1;
+        uint64_t x01 = r0 + m0 * t1; // < m0*m1 < 2^60
+        uint64_t t2 = (r2 + m2 - x01 % m2) % m2 * inv_m0m1_m2 % m2;
+        unsigned __int128 x = (unsigned __int128)x01 + (unsigned __int128)(m0 * m1) * t2;
+        // Значения из верхней половины - отрицательные
+        out[i] = x > modulus / 2 ? (Coef)(x - modulus) : (Coef)x;
+    }
+
+    for (int k = 0; k < 3; k++) free(residues[k]);
+}
+
+static int is_ntt_prime(uint64_t p) {
+    for (int k = 0; k < 3; k++) {
+        if (ntt_primes[k] == p) return 1;
+    }
+    return 0;
+}
+
+static int ntt_applicable(int len, int small) {
+    if (len > (1 << NTT_MAX_LOG) || small > (1 << (NTT_MAX_LOG - 1))) return 0;
+    return ring.kind != RING_MOD || is_ntt_prime(ring.modulus);
+}
+
+// Оценка времени алгоритма на входах в любом представлении, нс; -1 - алгоритм неприменим
+static double mult_cost(const Polynomial* a, const Polynomial* b, MultAlgorithm algorithm) {
+    const MultCosts* costs = ring.kind == RING_MOD ? &mult_costs_mod : &mult_costs_int64;
+    int na = a->degree + 1, nb = b->degree + 1, len = na + nb - 1;
+    int small = na < nb ? na : nb, big = na < nb ? nb : na;
+    double setup = costs->dense_fixed + costs->dense_setup * len;
+
+    switch (algorithm) {
+    case MULT_SCHOOLBOOK: {
+        double rows_a = (double)a->count * nb, rows_b = (double)b->count * na;
+        return setup + costs->school * (rows_a < rows_b ? rows_a : rows_b);
+    }
+    case MULT_KARATSUBA:
+        return setup + costs->karatsuba * ((big + small - 1) / small) * pow(small, log2(3));
+    case MULT_NTT: {
+        if (!ntt_applicable(len, small)) return -1;
+        double size = 1;
+        while (size < len) size *= 2;
+        return setup + costs->ntt * size * log2(size);
+    }
+    case MULT_HEAP: {
+        int fewer = a->count < b->count ? a->count : b->count;
+        return costs->heap * a->count * b->count * log2(fewer + 1);
+    }
+    default:
+        return -1;
+    }
+}
+
+static MultAlgorithm mult_choose(const Polynomial* a, const Polynomial* b) {
+    MultAlgorithm best = MULT_SCHOOLBOOK;
+    double best_cost = mult_cost(a, b, MULT_SCHOOLBOOK);
+    for (int m = MULT_KARATSUBA; m <= MULT_HEAP; m++) {
+        double cost = mult_cost(a, b, (MultAlgorithm)m);
+        if (cost >= 0 && cost < best_cost) {
+            best = (MultAlgorithm)m;
+            best_cost = cost;
+        }
+    }
+    return best;
+}
+
+static uint64_t max_abs_coef(const Polynomial* p) {
+    uint64_t max = 0;
+    for (int e = 0; e <= p->degree; e++) {
+        Coef c = p->coefs[e];
+        uint64_t mag = c < 0 ? 0ULL - (uint64_t)c : (uint64_t)c;
+        if (mag > max) max = mag;
+    }
+    return max;
+}
+
+// Школьное умножение int64 со 128-битным накоплением и контролем переполнения
+static void school_checked(const Coef* a, int na, const Coef* b, int nb, Coef* out) {
+    for (int k = 0; k < na + nb - 1; k++) {
+        __int128 acc = 0;
+        int from = k - nb + 1 > 0 ? k - nb + 1 : 0;
+        int to = k < na - 1 ? k : na - 1;
+        for (int i = from; i <= to; i++) {
+            if (__builtin_add_overflow(acc, (__int128)a[i] * b[k - i], &acc)) coef_overflow = 1;
+        }
+        if (acc > LLONG_MAX || acc < LLONG_MIN) coef_overflow = 1;
+        out[k] = (Coef)acc;
+    }
+}
+
+static Polynomial* mult_dense(const Polynomial* a, const Polynomial* b, MultAlgorithm algorithm) {
+    int na = a->degree + 1, nb = b->degree + 1;
+    int len = na + nb - 1;
+    int small = na < nb ? na : nb;
+    int modular = ring.kind == RING_MOD;
+
+    if (algorithm == MULT_NTT && !ntt_applicable(len, small)) algorithm = MULT_KARATSUBA;
+
+    // Без риска переполнения результат в кольце 2^64 совпадает с точным
+    int safe = 1;
+    if (!modular) {
+        unsigned __int128 bound = (unsigned __int128)max_abs_coef(a) * max_abs_coef(b);
+        safe = bound <= (unsigned __int128)LLONG_MAX / (unsigned)small;
+    }
+
+    Polynomial* result = poly_new(POLY_DENSE);
+    reserve_coefs(result, len - 1);
+
+    if (!safe) {
+        school_checked(a->coefs, na, b->coefs, nb, result->coefs);
+    }
+    else if (algorithm == MULT_NTT && modular) {
+        int size = 1;
+        while (size < len) size <<= 1;
+        unsigned* r = ntt_convolve(a->coefs, na, b->coefs, nb, size, (unsigned)ring.modulus);
+        for (int i = 0; i < len; i++) result->coefs[i] = r[i];
+        free(r);
+    }
+    else if (algorithm == MULT_NTT) {
+        mult_ntt_exact(a->coefs, na, b->coefs, nb, result->coefs);
+    }
+    else {
+        const uint64_t* ua = (const uint64_t*)a->coefs;
+        const uint64_t* ub = (const uint64_t*)b->coefs;
+        uint64_t* ma = NULL, * mb = NULL;
+        if (modular) {
+            ma = malloc(sizeof(uint64_t) * na);
+            mb = malloc(sizeof(uint64_t) * nb);
+            for (int i = 0; i < na; i++) ma[i] = to_mont(ua[i]);
+            for (int i = 0; i < nb; i++) mb[i] = to_mont(ub[i]);
+            ua = ma;
+            ub = mb;
+        }
+
+        uint64_t* out = (uint64_t*)result->coefs;
+        if (algorithm == MULT_KARATSUBA && small > 1) mult_karatsuba_blocked(ua, na, ub, nb, out, modular);
+        else if (b->count < a->count) {
+            // Снаружи - множитель с меньшим числом ненулевых коэффициентов
+            if (modular) school_mont(ub, nb, ua, na, out);
+            else school_wrap(ub, nb, ua, na, out);
+        }
+        else if (modular) school_mont(ua, na, ub, nb, out);
+        else school_wrap(ua, na, ub, nb, out);
+
+        if (modular) {
+            for (int i = 0; i < len; i++) out[i] = from_mont(out[i]);
+            free(ma);
+            free(mb);
+        }
+    }
+
+    result->degree = len - 1;
+    poly_normalize(result);
+    return result;
+}
+
+// Разреженное умножение слиянием через кучу: строки i - произведения ta[i] на tb[*],
+// вывод сразу упорядочен по убыванию степени
+typedef struct HeapItem {
+    int exp;
+    int i, j;
+} HeapItem;
+
+static void heap_sift_down(HeapItem* heap, int size, int pos) {
+    for (;;) {
+        int largest = pos, l = 2 * pos + 1, r = l + 1;
+        if (l < size && heap[l].exp > heap[largest].exp) largest = l;
+        if (r < size && heap[r].exp > heap[largest].exp) largest = r;
+        if (largest == pos) return;
+        HeapItem t = heap[pos]; heap[pos] = heap[largest]; heap[largest] = t;
+        pos = largest;
+    }
+}
+
+static Polynomial* mult_heap(const Polynomial* a, const Polynomial* b) {
+    int na, nb;
+    Term* ta = poly_terms(a, &na);
+    Term* tb = poly_terms(b, &nb);
+    if (na > nb) {
+        // Куча строится по меньшему множителю
+        Term* t = ta; ta = tb; tb = t;
+        int n = na; na = nb; nb = n;
+        const Polynomial* p = a; a = b; b = p;
+    }
+
+    HeapItem* heap = malloc(sizeof(HeapItem) * na);
+    int size = 0;
+    for (int i = 0; i < na; i++) {
+        heap[size].exp = ta[i].exp + tb[0].exp;
+        heap[size].i = i;
+        heap[size].j = 0;
+        size++;
+    }
+    for (int i = size / 2 - 1; i >= 0; i--) heap_sift_down(heap, size, i);
+
+    Polynomial* result = poly_new(POLY_SPARSE);
+    while (size > 0) {
+        int exp = heap[0].exp;
+        __int128 acc = 0;
+        Coef coef = 0;
+        while (size > 0 && heap[0].exp == exp) {
+            HeapItem* top = &heap[0];
+            if (ring.kind == RING_MOD) {
+                coef = coef_add(coef, coef_mul(ta[top->i].coef, tb[top->j].coef));
+            }
+            else if (__builtin_add_overflow(acc, (__int128)ta[top->i].coef * tb[top->j].coef, &acc)) {
+                coef_overflow = 1;
+            }
+            if (++top->j < nb) {
+                top->exp = ta[top->i].exp + tb[top->j].exp;
+            }
+            else {
+                heap[0] = heap[--size];
+            }
+            heap_sift_down(heap, size, 0);
+        }
+        if (ring.kind != RING_MOD) {
+            if (acc > LLONG_MAX || acc < LLONG_MIN) coef_overflow = 1;
+            coef = (Coef)acc;
+        }
+        push_term(result, coef, exp);
+    }
+
+    free(heap);
+    release_terms(a, ta);
+    release_terms(b, tb);
+    poly_normalize(result);
+    return result;
+}
+
+static Polynomial* big_poly_mult(const Polynomial* a, const Polynomial* b) {
+    Polynomial* result = poly_new(POLY_BIG);
+    reserve_terms(result, a->count * b->count);
+    for (int i = 0; i < a->count; i++) {
+        for (int j = 0; j < b->count; j++) {
+            push_big_term(result, big_mul(&a->big_terms[i].coef, &b->big_terms[j].coef),
+                a->big_terms[i].exp + b->big_terms[j].exp);
+        }
+    }
+    poly_normalize(result);
+    return result;
+}
+
+Polynomial* poly_mult_with(const Polynomial* a, const Polynomial* b, MultAlgorithm algorithm) {
+    if (a->degree < 0 || b->degree < 0) return poly_new(a->layout == POLY_BIG ? POLY_BIG : POLY_SPARSE);
+    if (a->layout == POLY_BIG) return big_poly_mult(a, b);
+    if (a->layout == POLY_MULTI || b->layout == POLY_MULTI) return multi_mult(a, b);
+
+    if (algorithm == MULT_AUTO) algorithm = mult_choose(a, b);
+    if (algorithm == MULT_HEAP) return mult_heap(a, b);
+
+    // Явно запрошенный плотный алгоритм на разреженном входе - через временную копию
+    Polynomial* da = a->layout == POLY_DENSE ? NULL : poly_copy(a);
+    Polynomial* db = b->layout == POLY_DENSE ? NULL : poly_copy(b);
+    if (da) to_dense(da);
+    if (db) to_dense(db);
+
+    Polynomial* result = mult_dense(da ? da : a, db ? db : b, algorithm);
+
+    free_poly(da);
+    free_poly(db);
+    return result;
+}
+
+Polynomial* poly_mult(const Polynomial* a, const Polynomial* b) {
+    return poly_mult_with(a, b, MULT_AUTO);
+}
+
+static Coef coef_pow(Coef x, int exp) {
+    Coef result = coef_from_ll(1);
+    while (exp > 0) {
+        if (exp & 1) result = coef_mul(result, x);
+        exp >>= 1;
+        if (exp) x = coef_mul(x, x);
+    }
+    return result;
+}
+
+Coef poly_eval(const Polynomial* poly, Coef x) {
+    x = coef_from_ll(x);
+
+    if (ring.kind == RING_MOD) {
+        // Горнер в форме Монтгомери
+        uint64_t xm = to_mont((uint64_t)x), result = 0;
+        if (poly->layout == POLY_DENSE) {
+            for (int e = poly->degree; e >= 0; e--) {
+                result = add_mod(mont_mul(result, xm), to_mont((uint64_t)poly->coefs[e]));
+            }
+        }
+        else {
+            for (int i = 0; i < poly->count; i++) {
+                int next_exp = i + 1 < poly->count ? poly->terms[i + 1].exp : 0;
+                result = add_mod(result, to_mont((uint64_t)poly->terms[i].coef));
+                result = mont_mul(result, to_mont((uint64_t)coef_pow(x, poly->terms[i].exp - next_exp)));
+            }
+        }
+        return (Coef)from_mont(result);
+    }
+
+    Coef result = 0;
+    if (poly->layout == POLY_DENSE) {
+        // Схема Горнера
+        for (int e = poly->degree; e >= 0; e--) {
+            result = coef_add(coef_mul(result, x), poly->coefs[e]);
+        }
+        return result;
+    }
+
+    // Горнер по разреженным степеням: между членами домножаем на x^(разность степеней)
+    for (int i = 0; i < poly->count; i++) {
+        int next_exp = i + 1 < poly->count ? poly->terms[i + 1].exp : 0;
+        result = coef_mul(coef_add(result, poly->terms[i].coef), coef_pow(x, poly->terms[i].exp - next_exp));
+    }
+    return result;
+}
+
+static BigInt big_pow(long long x, int exp) {
+    BigInt result = big_from_ll(1);
+    BigInt base = big_from_ll(x);
+    while (exp > 0) {
+        if (exp & 1) {
+            BigInt t = big_mul(&result, &base);
+            big_free(&result);
+            result = t;
+        }
+        exp >>= 1;
+        if (exp) {
+            BigInt t = big_mul(&base, &base);
+            big_free(&base);
+            base = t;
+        }
+    }
+    big_free(&base);
+    return result;
+}
+
+BigInt big_poly_eval(const Polynomial* poly, long long x) {
+    BigInt result = big_alloc(0);
+    for (int i = 0; i < poly->count; i++) {
+        int next_exp = i + 1 < poly->count ? poly->big_terms[i + 1].exp : 0;
+        BigInt sum = big_add(&result, &poly->big_terms[i].coef);
+        BigInt power = big_pow(x, poly->big_terms[i].exp - next_exp);
+        big_free(&result);
+        result = big_mul(&sum, &power);
+        big_free(&sum);
+        big_free(&power);
+    }
+    return result;
+}
+
+Polynomial* poly_diff(const Polynomial* poly) {
+    Polynomial* result = poly_new(poly->layout);
+
+    if (poly->layout == POLY_DENSE) {
+        if (poly->degree > 0) {
+            reserve_coefs(result, poly->degree - 1);
+            for (int e = 1; e <= poly->degree; e++) {
+                result->coefs[e - 1] = coef_mul(poly->coefs[e], coef_from_ll(e));
+            }
+            result->degree = poly->degree - 1;
+        }
+    }
+    else if (poly->layout == POLY_BIG) {
+        reserve_terms(result, poly->count);
+        for (int i = 0; i < poly->count; i++) {
+            const BigTerm* t = &poly->big_terms[i];
+            if (t->exp == 0) continue;
+            BigInt factor = big_from_ll(t->exp);
+            push_big_term(result, big_mul(&t->coef, &factor), t->exp - 1);
+            big_free(&factor);
+        }
+    }
+    else {
+        reserve_terms(result, poly->count);
+        for (int i = 0; i < poly->count; i++) {
+            if (poly->terms[i].exp > 0) {
+                push_term(result, coef_mul(poly->terms[i].coef, coef_from_ll(poly->terms[i].exp)),
+                    poly->terms[i].exp - 1);
+            }
+        }
+    }
+
+    poly_normalize(result);
+    return result;
+}
+
+// Частная производная по переменной var (0 - x, 1 - y, 2 - z)
+Polynomial* poly_partial(const Polynomial* poly, int var) {
+    if (poly->layout == POLY_MULTI) return multi_diff(poly, var);
+    return var == 0 ? poly_diff(poly) : poly_new(poly->layout == POLY_BIG ? POLY_BIG : POLY_SPARSE);
+}
+
+// Число переменных, от которых зависит многочлен (x - 1, y - 2, z - 3)
+int poly_vars(const Polynomial* poly) {
+    if (poly->layout != POLY_MULTI) return 1;
+    int vars = 1;
+    for (int i = 0; i < poly->count; i++) {
+        if (mono_exp(poly->mterms[i].mono, 2)) return 3;
+        if (mono_exp(poly->mterms[i].mono, 1)) vars = 2;
+    }
+    return vars;
+}
+
+// Значение в точке (x, y, z); степени переменных берутся из таблиц, пока показатели невелики
+#define EVAL_POWER_TABLE_MAX 4096
+
+Coef poly_eval_point(const Polynomial* poly, const Coef* point) {
+    if (poly->layout != POLY_MULTI) return poly_eval(poly, point[0]);
+
+    Coef* powers[3];
+    for (int var = 0; var < 3; var++) {
+        int max_exp = 0;
+        for (int i = 0; i < poly->count; i++) {
+            if (mono_exp(poly->mterms[i].mono, var) > max_exp) max_exp = mono_exp(poly->mterms[i].mono, var);
+        }
+        powers[var] = NULL;
+        if (max_exp > EVAL_POWER_TABLE_MAX) continue;
+
+        Coef x = coef_from_ll(point[var]);
+        powers[var] = malloc(sizeof(Coef) * (max_exp + 1));
+        powers[var][0] = coef_from_ll(1);
+        for (int e = 1; e <= max_exp; e++) powers[var][e] = coef_mul(powers[var][e - 1], x);
+    }
+
+    Coef result = 0;
+    for (int i = 0; i < poly->count; i++) {
+        Coef term = poly->mterms[i].coef;
+        for (int var = 0; var < 3; var++) {
+            int exp = mono_exp(poly->mterms[i].mono, var);
+            if (exp == 0) continue;
+            term = coef_mul(term, powers[var] ? powers[var][exp] : coef_pow(coef_from_ll(point[var]), exp));
+        }
+        result = coef_add(result, term);
+    }
+
+    for (int var = 0; var < 3; var++) free(powers[var]);
+    return result;
+}
+
+// Вспомогательные операции для быстрых алгоритмов (RING_INT64 / RING_MOD)
+static Polynomial* poly_from_coefs(Coef* coefs, int degree) {
+    Polynomial* poly = poly_new(POLY_DENSE);
+    poly->coefs = coefs;
+    poly->capacity = degree + 1;
+    poly->degree = degree;
+    poly_normalize(poly);
+    return poly;
+}
+
+// Коэффициенты 0..len-1 в плотном массиве (недостающие - нули)
+static Coef* poly_dense_coefs(const Polynomial* poly, int len) {
+    Coef* coefs = calloc(len > 0 ? len : 1, sizeof(Coef));
+    if (poly->layout == POLY_DENSE) {
+        int n = poly->degree + 1 < len ? poly->degree + 1 : len;
+        if (n > 0) memcpy(coefs, poly->coefs, sizeof(Coef) * n);
+    }
+    else {
+        for (int i = 0; i < poly->count; i++) {
+            if (poly->terms[i].exp < len) coefs[poly->terms[i].exp] = poly->terms[i].coef;
+        }
+    }
+    return coefs;
+}
+
+// p mod x^k
+static Polynomial* poly_truncate(const Polynomial* poly, int k) {
+    return poly_from_coefs(poly_dense_coefs(poly, k), k - 1);
+}
+
+// x^n * p(1/x), n >= deg p
+static Polynomial* poly_reverse(const Polynomial* poly, int n) {
+    Coef* coefs = poly_dense_coefs(poly, n + 1);
+    for (int i = 0, j = n; i < j; i++, j--) {
+        Coef t = coefs[i]; coefs[i] = coefs[j]; coefs[j] = t;
+    }
+    return poly_from_coefs(coefs, n);
+}
+
+static Polynomial* poly_scale(const Polynomial* poly, Coef factor) {
+    Polynomial* result = poly_copy(poly);
+    if (result->layout == POLY_DENSE) {
+        for (int e = 0; e <= result->degree; e++) result->coefs[e] = coef_mul(result->coefs[e], factor);
+    }
+    else {
+        for (int i = 0; i < result->count; i++) result->terms[i].coef = coef_mul(result->terms[i].coef, factor);
+    }
+    poly_normalize(result);
+    return result;
+}
+
+static Polynomial* poly_sub(const Polynomial* a, const Polynomial* b) {
+    Polynomial* neg = poly_scale(b, coef_from_ll(-1));
+    Polynomial* result = poly_add(a, neg);
+    free_poly(neg);
+    return result;
+}
+
+// Обратный ряд f^(-1) mod x^k итерациями Ньютона: g <- g(2 - fg); свободный член f обратим
+static Polynomial* series_inverse(const Polynomial* f, Coef inv_f0, int k) {
+    Polynomial* g = poly_new(POLY_SPARSE);
+    push_term(g, inv_f0, 0);
+    poly_normalize(g);
+
+    for (int len = 1; len < k; ) {
+        len = len * 2 < k ? len * 2 : k;
+        Polynomial* f_trunc = poly_truncate(f, len);
+        Polynomial* fg = poly_mult(f_trunc, g);
+        Polynomial* fg_trunc = poly_truncate(fg, len);
+        Polynomial* two = poly_new(POLY_SPARSE);
+        push_term(two, coef_from_ll(2), 0);
+        poly_normalize(two);
+        Polynomial* correction = poly_sub(two, fg_trunc);
+        Polynomial* next = poly_mult(g, correction);
+
+        free_poly(g);
+        g = poly_truncate(next, len);
+
+        free_poly(f_trunc);
+        free_poly(fg);
+        free_poly(fg_trunc);
+        free_poly(two);
+        free_poly(correction);
+        free_poly(next);
+    }
+    return g;
+}
+
+// Деление на многочлен со старшим коэффициентом 1 за O(M(n)):
+// q = rev(a) * rev(m)^(-1) mod x^(n-m+1), r = a - q*m; частное - в *quotient, если он задан
+static Polynomial* poly_divrem_monic(const Polynomial* a, const Polynomial* m, Polynomial** quotient) {
+    int n = a->degree, d = m->degree;
+    if (n < d) {
+        if (quotient) *quotient = poly_zero();
+        return poly_copy(a);
+    }
+
+    int k = n - d + 1;
+    Polynomial* rev_a = poly_reverse(a, n);
+    Polynomial* rev_m = poly_reverse(m, d);
+    Polynomial* inv = series_inverse(rev_m, coef_from_ll(1), k);
+    Polynomial* rev_q_full = poly_mult(rev_a, inv);
+    Polynomial* rev_q = poly_truncate(rev_q_full, k);
+    Polynomial* q = poly_reverse(rev_q, k - 1);
+    Polynomial* qm = poly_mult(q, m);
+    Polynomial* r = poly_sub(a, qm);
+
+    free_poly(rev_a);
+    free_poly(rev_m);
+    free_poly(inv);
+    free_poly(rev_q_full);
+    free_poly(rev_q);
+    free_poly(qm);
+    if (quotient) *quotient = q;
+    else free_poly(q);
+    return r;
+}
+
+static Polynomial* poly_rem_monic(const Polynomial* a, const Polynomial* m) {
+    return poly_divrem_monic(a, m, NULL);
+}
+
+// Вычисление во многих точках: блоки точек считаются схемой Горнера одновременно
+// (векторизуется по точкам), большие партии в кольце по модулю - через дерево произведений
+#define EVAL_BATCH 8
+#define MULTIPOINT_MIN_POINTS 8192
+#define MULTIPOINT_MIN_DEGREE 8192
+
+// int64: Горнер в кольце 2^64 с оценкой модуля в double; где оценка велика - точный пересчет
+static void eval_batch_int64(const Polynomial* poly, const Coef* xs, int n, Coef* out) {
+    for (int start = 0; start < n; start += EVAL_BATCH) {
+        int count = n - start < EVAL_BATCH ? n - start : EVAL_BATCH;
+        uint64_t acc[EVAL_BATCH] = { 0 }, x[EVAL_BATCH] = { 0 };
+        double bound[EVAL_BATCH] = { 0 }, ax[EVAL_BATCH] = { 0 };
+        for (int j = 0; j < count; j++) {
+            x[j] = (uint64_t)xs[start + j];
+            ax[j] = fabs((double)xs[start + j]);
+        }
+
+        for (int e = poly->degree; e >= 0; e--) {
+            uint64_t c = (uint64_t)poly->coefs[e];
+            double ac = fabs((double)poly->coefs[e]);
+            for (int j = 0; j < EVAL_BATCH; j++) {
+                acc[j] = acc[j] * x[j] + c;
+                bound[j] = bound[j] * ax[j] + ac;
+            }
+        }
+
+        for (int j = 0; j < count; j++) {
+            out[start + j] = bound[j] < 0x1p62 ? (Coef)acc[j] : poly_eval(poly, xs[start + j]);
+        }
+    }
+}
+
+static void eval_batch_mod(const Polynomial* poly, const Coef* xs, int n, Coef* out) {
+    uint64_t* mcoefs = malloc(sizeof(uint64_t) * (poly->degree + 1));
+    for (int e = 0; e <= poly->degree; e++) mcoefs[e] = to_mont((uint64_t)poly->coefs[e]);
+
+    for (int start = 0; start < n; start += EVAL_BATCH) {
+        int count = n - start < EVAL_BATCH ? n - start : EVAL_BATCH;
+        uint64_t acc[EVAL_BATCH] = { 0 }, x[EVAL_BATCH] = { 0 };
+        for (int j = 0; j < count; j++) x[j] = to_mont((uint64_t)xs[start + j]);
+
+        for (int e = poly->degree; e >= 0; e--) {
+            for (int j = 0; j < EVAL_BATCH; j++) acc[j] = add_mod(mont_mul(acc[j], x[j]), mcoefs[e]);
+        }
+        for (int j = 0; j < count; j++) out[start + j] = (Coef)from_mont(acc[j]);
+    }
+
+    free(mcoefs);
+}
+
+#define SUBPRODUCT_LEAF 64 // поддеревья с меньшим числом точек считаются Горнером
+
+static void eval_batch_any(const Polynomial* poly, const Coef* xs, int n, Coef* out) {
+    if (poly->layout == POLY_DENSE) {
+        eval_batch_mod(poly, xs, n, out);
+        return;
+    }
+    for (int i = 0; i < n; i++) out[i] = poly_eval(poly, xs[i]);
+}
+
+// Остаток rem спускается по дереву: узел (level, i) покрывает точки [i << level, (i + 1) << level)
+static void eval_tree_node(Polynomial*** tree, const int* sizes, const Polynomial* rem, int level, int i,
+    const Coef* xs, int n, Coef* out) {
+    int from = i << level;
+    int to = (i + 1) << level < n ? (i + 1) << level : n;
+
+    if ((1 << level) <= SUBPRODUCT_LEAF) {
+        eval_batch_any(rem, xs + from, to - from, out + from);
+        return;
+    }
+
+    for (int child = 2 * i; child <= 2 * i + 1 && child < sizes[level - 1]; child++) {
+        Polynomial* child_rem = poly_rem_monic(rem, tree[level - 1][child]);
+        eval_tree_node(tree, sizes, child_rem, level - 1, child, xs, n, out);
+        free_poly(child_rem);
+    }
+}
+
+// Дерево произведений: tree[level][i] = prod (x - x_j) по точкам узла
+static void eval_subproduct(const Polynomial* poly, const Coef* xs, int n, Coef* out) {
+    int levels = 1;
+    while ((1 << (levels - 1)) < n) levels++;
+
+    Polynomial*** tree = malloc(sizeof(Polynomial**) * levels);
+    int* sizes = malloc(sizeof(int) * levels);
+
+    sizes[0] = n;
+    tree[0] = malloc(sizeof(Polynomial*) * n);
+    for (int i = 0; i < n; i++) {
+        Polynomial* leaf = poly_new(POLY_SPARSE);
+        push_term(leaf, 1, 1);
+        push_term(leaf, coef_neg(xs[i]), 0);
+        poly_normalize(leaf);
+        tree[0][i] = leaf;
+    }
+    for (int l = 1; l < levels; l++) {
+        sizes[l] = (sizes[l - 1] + 1) / 2;
+        tree[l] = malloc(sizeof(Polynomial*) * sizes[l]);
+        for (int i = 0; i < sizes[l]; i++) {
+            if (2 * i + 1 < sizes[l - 1]) tree[l][i] = poly_mult(tree[l - 1][2 * i], tree[l - 1][2 * i + 1]);
+            else tree[l][i] = poly_copy(tree[l - 1][2 * i]);
+        }
+    }
+
+    Polynomial* rem = poly_rem_monic(poly, tree[levels - 1][0]);
+    eval_tree_node(tree, sizes, rem, levels - 1, 0, xs, n, out);
+    free_poly(rem);
+
+    for (int l = 0; l < levels; l++) {
+        for (int i = 0; i < sizes[l]; i++) free_poly(tree[l][i]);
+        free(tree[l]);
+    }
+    free(tree);
+    free(sizes);
+}
+
+void poly_eval_many(const Polynomial* poly, const Coef* xs, int n, Coef* out) {
+    if (poly->layout == POLY_SPARSE) {
+        for (int i = 0; i < n; i++) out[i] = poly_eval(poly, xs[i]);
+        return;
+    }
+
+    Coef* points = malloc(sizeof(Coef) * (n ? n : 1));
+    for (int i = 0; i < n; i++) points[i] = coef_from_ll(xs[i]);
+
+    if (ring.kind == RING_MOD && n >= MULTIPOINT_MIN_POINTS && poly->degree >= MULTIPOINT_MIN_DEGREE) {
+        eval_subproduct(poly, points, n, out);
+    }
+    else if (ring.kind == RING_MOD) {
+        eval_batch_mod(poly, points, n, out);
+    }
+    else {
+        eval_batch_int64(poly, points, n, out);
+    }
+
+    free(points);
+}
+
+static double big_to_double(const BigInt* a) {
+    double r = 0;
+    for (int i = a->len - 1; i >= 0; i--) r = r * 4294967296.0 + a->limbs[i];
+    return a->sign < 0 ? -r : r;
+}
+
+// Вещественный вариант: коэффициенты приводятся к double
+void poly_eval_many_double(const Polynomial* poly, const double* xs, int n, double* out) {
+    if (poly->layout != POLY_DENSE) {
+        int count = poly->count;
+        for (int i = 0; i < n; i++) {
+            double result = 0;
+            for (int t = 0; t < count; t++) {
+                int exp = poly->layout == POLY_BIG ? poly->big_terms[t].exp : poly->terms[t].exp;
+                double coef = poly->layout == POLY_BIG ? big_to_double(&poly->big_terms[t].coef)
+                    : (double)poly->terms[t].coef;
+                int next_exp = t + 1 < count ? (poly->layout == POLY_BIG ? poly->big_terms[t + 1].exp
+                    : poly->terms[t + 1].exp) : 0;
+                result = (result + coef) * pow(xs[i], exp - next_exp);
+            }
+            out[i] = result;
+        }
+        return;
+    }
+
+    double* coefs = malloc(sizeof(double) * (poly->degree + 1));
+    for (int e = 0; e <= poly->degree; e++) coefs[e] = (double)poly->coefs[e];
+
+    int i = 0;
+#ifdef __AVX2__
+    for (; i + 4 <= n; i += 4) {
+        __m256d x = _mm256_loadu_pd(xs + i);
+        __m256d acc = _mm256_setzero_pd();
+        for (int e = poly->degree; e >= 0; e--) {
+            acc = _mm256_add_pd(_mm256_mul_pd(acc, x), _mm256_set1_pd(coefs[e]));
+        }
+        _mm256_storeu_pd(out + i, acc);
+    }
+#endif
+    for (; i < n; i += EVAL_BATCH) {
+        int count = n - i < EVAL_BATCH ? n - i : EVAL_BATCH;
+        double acc[EVAL_BATCH] = { 0 }, x[EVAL_BATCH] = { 0 };
+        for (int j = 0; j < count; j++) x[j] = xs[i + j];
+        for (int e = poly->degree; e >= 0; e--) {
+            for (int j = 0; j < EVAL_BATCH; j++) acc[j] = acc[j] * x[j] + coefs[e];
+        }
+        for (int j = 0; j < count; j++) out[i + j] = acc[j];
+    }
+
+    free(coefs);
+}
+
+// Деление, НОД и композиция (RING_INT64 / RING_MOD, композиция - в любом кольце).
+// Ошибка операции (деление на ноль, необратимый старший коэффициент) - в poly_error.
+#define DIV_SCHOOLBOOK_MAX 32
+#define HGCD_LEAF 256     // ниже - шаги Евклида внутри половинного НОД
+#define GCD_HALF_MIN 2048 // ниже - обычный алгоритм Евклида
+
+typedef struct PolyMatrix {
+    Polynomial* m[4]; // [m0 m1; m2 m3]
+} PolyMatrix;
+
+static Coef poly_lead(const Polynomial* poly) {
+    return poly->layout == POLY_DENSE ? poly->coefs[poly->degree] : poly->terms[0].coef;
+}
+
+// Обратный элемент: в int64 обратимы только 1 и -1
+static int coef_inverse(Coef c, Coef* inv) {
+    if (ring.kind == RING_MOD) {
+        *inv = (Coef)pow_mod_u64((uint64_t)c, ring.modulus - 2, ring.modulus);
+        return 1;
+    }
+    *inv = c;
+    return c == 1 || c == -1;
+}
+
+// Деление столбиком; выгодно, когда мало частное или делитель
+static Polynomial* divrem_school(const Polynomial* a, const Polynomial* b, Coef inv_lead, Polynomial** quotient) {
+    int n = a->degree, d = b->degree;
+    Coef* r = poly_dense_coefs(a, n + 1);
+    Coef* bc = poly_dense_coefs(b, d + 1);
+    Coef* qc = calloc(n - d + 1, sizeof(Coef));
+
+    for (int i = n - d; i >= 0; i--) {
+        Coef c = coef_mul(r[i + d], inv_lead);
+        qc[i] = c;
+        if (c == 0) continue;
+        Coef neg = coef_neg(c);
+        for (int j = 0; j <= d; j++) r[i + j] = coef_add(r[i + j], coef_mul(neg, bc[j]));
+    }
+
+    free(bc);
+    if (quotient) *quotient = poly_from_coefs(qc, n - d);
+    else free(qc);
+    return poly_from_coefs(r, d - 1);
+}
+
+// Деление с остатком; делитель ненулевой, старший коэффициент обратим
+static Polynomial* poly_divrem(const Polynomial* a, const Polynomial* b, Polynomial** quotient) {
+    Coef inv_lead;
+    coef_inverse(poly_lead(b), &inv_lead);
+
+    if (a->degree < b->degree) {
+        if (quotient) *quotient = poly_zero();
+        return poly_copy(a);
+    }
+    if (a->degree - b->degree < DIV_SCHOOLBOOK_MAX || b->degree < DIV_SCHOOLBOOK_MAX) {
+        return divrem_school(a, b, inv_lead, quotient);
+    }
+
+    // Обращение Ньютона для нормированного делителя, частное масштабируется обратно
+    Polynomial* monic = poly_scale(b, inv_lead);
+    Polynomial* q_monic = NULL;
+    Polynomial* r = poly_divrem_monic(a, monic, quotient ? &q_monic : NULL);
+    if (quotient) *quotient = poly_scale(q_monic, inv_lead);
+
+    free_poly(monic);
+    free_poly(q_monic);
+    return r;
+}
+
+static const char* const UNIVARIATE_ERROR = "Div, Mod, Gcd and Compose need polynomials in x only";
+
+static int check_univariate(const Polynomial* a, const Polynomial* b) {
+    if (a->layout != POLY_MULTI && b->layout != POLY_MULTI) return 1;
+    poly_error = UNIVARIATE_ERROR;
+    return 0;
+}
+
+static int check_divisor(const Polynomial* a, const Polynomial* b) {
+    Coef inv;
+    if (!check_univariate(a, b)) return 0;
+    if (ring.kind == RING_BIG) poly_error = "Div, Mod and Gcd are not supported in Ring(big)";
+    else if (b->degree < 0) poly_error = "division by zero";
+    else if (!coef_inverse(poly_lead(b), &inv)) {
+        poly_error = "over int64 the divisor must have leading coefficient 1 or -1, use Ring(mod)";
+    }
+    else return 1;
+    return 0;
+}
+
+Polynomial* poly_div(const Polynomial* a, const Polynomial* b) {
+    if (!check_divisor(a, b)) return NULL;
+    Polynomial* q;
+    free_poly(poly_divrem(a, b, &q));
+    return q;
+}
+
+Polynomial* poly_mod(const Polynomial* a, const Polynomial* b) {
+    if (!check_divisor(a, b)) return NULL;
+    return poly_divrem(a, b, NULL);
+}
+
+// p div x^k
+static Polynomial* poly_shift_down(const Polynomial* poly, int k) {
+    if (poly->degree < k) return poly_zero();
+    Coef* coefs = poly_dense_coefs(poly, poly->degree + 1);
+    memmove(coefs, coefs + k, sizeof(Coef) * (poly->degree - k + 1));
+    return poly_from_coefs(coefs, poly->degree - k);
+}
+
+static Polynomial* poly_monic(const Polynomial* poly) {
+    Coef inv;
+    if (poly->degree < 0 || !coef_inverse(poly_lead(poly), &inv)) return poly_copy(poly);
+    return poly_scale(poly, inv);
+}
+
+// a - q * b
+static Polynomial* poly_sub_mult(const Polynomial* a, const Polynomial* q, const Polynomial* b) {
+    Polynomial* qb = poly_mult(q, b);
+    Polynomial* result = poly_sub(a, qb);
+    free_poly(qb);
+    return result;
+}
+
+static PolyMatrix mat_identity() {
+    PolyMatrix m;
+    for (int i = 0; i < 4; i++) m.m[i] = poly_zero();
+    push_term(m.m[0], coef_from_ll(1), 0);
+    push_term(m.m[3], coef_from_ll(1), 0);
+    poly_normalize(m.m[0]);
+    poly_normalize(m.m[3]);
+    return m;
+}
+
+static void mat_free(PolyMatrix* m) {
+    for (int i = 0; i < 4; i++) free_poly(m->m[i]);
+}
+
+static Polynomial* dot2(const Polynomial* a, const Polynomial* b, const Polynomial* c, const Polynomial* d) {
+    Polynomial* ab = poly_mult(a, b);
+    Polynomial* cd = poly_mult(c, d);
+    Polynomial* result = poly_add(ab, cd);
+    free_poly(ab);
+    free_poly(cd);
+    return result;
+}
+
+// x * y
+static PolyMatrix mat_mul(const PolyMatrix* x, const PolyMatrix* y) {
+    PolyMatrix r;
+    r.m[0] = dot2(x->m[0], y->m[0], x->m[1], y->m[2]);
+    r.m[1] = dot2(x->m[0], y->m[1], x->m[1], y->m[3]);
+    r.m[2] = dot2(x->m[2], y->m[0], x->m[3], y->m[2]);
+    r.m[3] = dot2(x->m[2], y->m[1], x->m[3], y->m[3]);
+    return r;
+}
+
+static void mat_apply(const PolyMatrix* m, const Polynomial* a, const Polynomial* b, Polynomial** ra, Polynomial** rb) {
+    *ra = dot2(m->m[0], a, m->m[1], b);
+    *rb = dot2(m->m[2], a, m->m[3], b);
+}
+
+// [0 1; 1 -q] * m, матрица m освобождается
+static PolyMatrix mat_euclid_step(PolyMatrix* m, const Polynomial* q) {
+    PolyMatrix r;
+    r.m[0] = m->m[2];
+    r.m[1] = m->m[3];
+    r.m[2] = poly_sub_mult(m->m[0], q, m->m[2]);
+    r.m[3] = poly_sub_mult(m->m[1], q, m->m[3]);
+    free_poly(m->m[0]);
+    free_poly(m->m[1]);
+    return r;
+}
+
+// Шаги Евклида, пока степень второго многочлена не меньше m
+static PolyMatrix euclid_matrix(const Polynomial* a0, const Polynomial* a1, int m) {
+    PolyMatrix result = mat_identity();
+    Polynomial* a = poly_copy(a0);
+    Polynomial* b = poly_copy(a1);
+    while (b->degree >= m) {
+        Polynomial* q;
+        Polynomial* r = poly_divrem(a, b, &q);
+        result = mat_euclid_step(&result, q);
+        free_poly(q);
+        free_poly(a);
+        a = b;
+        b = r;
+    }
+    free_poly(a);
+    free_poly(b);
+    return result;
+}
+
+// Половинный НОД (deg a0 > deg a1): матрица M, для которой (c0, c1) = M (a0, a1) -
+// соседние остатки алгоритма Евклида с deg c0 >= ceil(deg a0 / 2) > deg c1.
+// Каждая половина вычисляется рекурсивно по старшим коэффициентам, итого O(M(n) log n).
+static PolyMatrix half_gcd(const Polynomial* a0, const Polynomial* a1) {
+    int m = (a0->degree + 1) / 2;
+    if (a1->degree < m) return mat_identity();
+    if (a0->degree < HGCD_LEAF) return euclid_matrix(a0, a1, m);
+
+    Polynomial* s0 = poly_shift_down(a0, m);
+    Polynomial* s1 = poly_shift_down(a1, m);
+    PolyMatrix r = half_gcd(s0, s1);
+    free_poly(s0);
+    free_poly(s1);
+
+    Polynomial *b0, *b1;
+    mat_apply(&r, a0, a1, &b0, &b1);
+    if (b1->degree < m) {
+        free_poly(b0);
+        free_poly(b1);
+        return r;
+    }
+
+    Polynomial* q;
+    Polynomial* c1 = poly_divrem(b0, b1, &q);
+    r = mat_euclid_step(&r, q);
+    free_poly(q);
+    free_poly(b0);
+    if (c1->degree < m) {
+        free_poly(b1);
+        free_poly(c1);
+        return r;
+    }
+
+    int k = 2 * m - b1->degree;
+    s0 = poly_shift_down(b1, k);
+    s1 = poly_shift_down(c1, k);
+    PolyMatrix s = half_gcd(s0, s1);
+    PolyMatrix result = mat_mul(&s, &r);
+
+    free_poly(s0);
+    free_poly(s1);
+    free_poly(b1);
+    free_poly(c1);
+    mat_free(&s);
+    mat_free(&r);
+    return result;
+}
 
-#define MAX_LINE 256
+// НОД над полем вычетов: половинный НОД сокращает степень вдвое за шаг
+static Polynomial* gcd_field(const Polynomial* x, const Polynomial* y) {
+    Polynomial* a = poly_copy(x->degree >= y->degree ? x : y);
+    Polynomial* b = poly_copy(x->degree >= y->degree ? y : x);
+
+    while (b->degree >= 0) {
+        if (a->degree > b->degree && a->degree >= GCD_HALF_MIN) {
+            PolyMatrix m = half_gcd(a, b);
+            Polynomial *c0, *c1;
+            mat_apply(&m, a, b, &c0, &c1);
+            mat_free(&m);
+            free_poly(a);
+            free_poly(b);
+            a = c0;
+            b = c1;
+            if (b->degree < 0) break;
+        }
+        Polynomial* r = poly_divrem(a, b, NULL);
+        free_poly(a);
+        a = b;
+        b = r;
+    }
 
-typedef struct Term {
-    int coef;
-    int exp;
-    struct Term* next;
-} Term;
+    free_poly(b);
+    Polynomial* result = poly_monic(a);
+    free_poly(a);
+    return result;
+}
 
-typedef struct Polynomial {
-    Term* head;
-} Polynomial;
+static Coef gcd_ll(Coef a, Coef b) {
+    if (a < 0) a = -a;
+    if (b < 0) b = -b;
+    while (b) { Coef t = a % b; a = b; b = t; }
+    return a;
+}
 
-Polynomial accumulator = { NULL };
+// Содержание (НОД коэффициентов) со знаком старшего коэффициента
+static Coef poly_content(const Polynomial* poly) {
+    Coef g = 0;
+    Coef* coefs = poly_dense_coefs(poly, poly->degree + 1);
+    for (int e = 0; e <= poly->degree; e++) g = gcd_ll(g, coefs[e]);
+    free(coefs);
+    return poly_lead(poly) < 0 ? -g : g;
+}
 
-// Базовые функции
-void add_term(Polynomial* poly, int coef, int exp) {
-    if (coef == 0) return;
+static Polynomial* poly_primitive(const Polynomial* poly) {
+    Coef c = poly_content(poly);
+    Coef* coefs = poly_dense_coefs(poly, poly->degree + 1);
+    for (int e = 0; e <= poly->degree; e++) coefs[e] /= c;
+    return poly_from_coefs(coefs, poly->degree);
+}
 
-    Term* new_term = malloc(sizeof(Term));
-    new_term->coef = coef;
-    new_term->exp = exp;
-    new_term->next = NULL;
+// НОД над целыми: примитивные псевдоостатки с проверкой переполнения
+static Polynomial* gcd_int64(const Polynomial* x, const Polynomial* y) {
+    if (x->degree < 0) return y->degree < 0 ? poly_zero() : poly_scale(y, poly_content(y) < 0 ? -1 : 1);
+    if (y->degree < 0) return poly_scale(x, poly_content(x) < 0 ? -1 : 1);
+
+    Coef content = gcd_ll(poly_content(x), poly_content(y));
+    Polynomial* a = poly_primitive(x->degree >= y->degree ? x : y);
+    Polynomial* b = poly_primitive(x->degree >= y->degree ? y : x);
+
+    while (b->degree > 0) {
+        // lc(b)^(deg a - deg b + 1) * a = q * b + r
+        int n = a->degree, d = b->degree;
+        Coef lead = poly_lead(b);
+        Coef* r = poly_dense_coefs(a, n + 1);
+        Coef* bc = poly_dense_coefs(b, d + 1);
+        for (int i = n - d; i >= 0; i--) {
+            Coef c = r[i + d];
+            for (int e = 0; e < i + d; e++) r[e] = coef_mul(r[e], lead);
+            r[i + d] = 0;
+            for (int j = 0; j < d; j++) r[i + j] = coef_add(r[i + j], coef_neg(coef_mul(c, bc[j])));
+        }
+        free(bc);
 
-    if (!poly->head || exp > poly->head->exp) {
-        new_term->next = poly->head;
-        poly->head = new_term;
-        return;
+        Polynomial* rem = poly_from_coefs(r, d - 1);
+        free_poly(a);
+        a = b;
+        b = rem;
+        if (rem->degree < 0 || coef_overflow) break;
+        b = poly_primitive(rem);
+        free_poly(rem);
     }
 
-    Term* current = poly->head;
-    while (current->next && current->next->exp > exp) {
-        current = current->next;
+    // Ненулевой остаток нулевой степени - многочлены взаимно просты
+    Polynomial* result;
+    if (b->degree == 0) {
+        result = poly_zero();
+        push_term(result, content, 0);
+        poly_normalize(result);
     }
+    else result = poly_scale(a, content);
+    free_poly(a);
+    free_poly(b);
+    return result;
+}
 
-    if (current->exp == exp) {
-        current->coef += coef;
-        free(new_term);
-        if (current->coef == 0) {
-            // Упрощенное удаление нулевого члена
-            if (current == poly->head) {
-                poly->head = current->next;
-                free(current);
-            }
+Polynomial* poly_gcd(const Polynomial* a, const Polynomial* b) {
+    if (!check_univariate(a, b)) return NULL;
+    if (ring.kind == RING_BIG) {
+        poly_error = "Div, Mod and Gcd are not supported in Ring(big)";
+        return NULL;
+    }
+    return ring.kind == RING_MOD ? gcd_field(a, b) : gcd_int64(a, b);
+}
+
+// Композиция по Горнеру в Ring(big)
+static Polynomial* compose_horner(const Polynomial* p, const Polynomial* q) {
+    Polynomial* result = poly_zero();
+    for (int i = 0, e = p->degree; e >= 0; e--) {
+        Polynomial* next = poly_mult(result, q);
+        free_poly(result);
+        result = next;
+        if (i < p->count && p->big_terms[i].exp == e) {
+            Polynomial* c = poly_new(POLY_BIG);
+            push_big_term(c, big_copy(&p->big_terms[i++].coef), 0);
+            next = poly_add(result, c);
+            free_poly(result);
+            free_poly(c);
+            result = next;
         }
     }
-    else {
-        new_term->next = current->next;
-        current->next = new_term;
+    return result;
+}
+
+// Сборка блоков: parts[0] + G * parts[1] + G^2 * parts[2] + ..., count - степень двойки,
+// giant[l] = G^(2^l). Половины сливаются попарно, умножения сбалансированы по размеру
+static Polynomial* combine_blocks(Polynomial** parts, int count, Polynomial** giant, int level) {
+    if (count == 1) return poly_copy(parts[0]);
+
+    int half = count / 2;
+    Polynomial* low = combine_blocks(parts, half, giant, level - 1);
+    Polynomial* high = combine_blocks(parts + half, half, giant, level - 1);
+    if (high->degree < 0) {
+        free_poly(high);
+        return low;
     }
+
+    Polynomial* shifted = poly_mult(high, giant[level - 1]);
+    Polynomial* result = poly_add(low, shifted);
+    free_poly(low);
+    free_poly(high);
+    free_poly(shifted);
+    return result;
 }
 
-Polynomial* parse_poly(const char* str) {
-    Polynomial* poly = malloc(sizeof(Polynomial));
-    poly->head = NULL;
+// Композиция p(q) по Брент-Кунгу: p разбивается на блоки по k ~ sqrt(n) коэффициентов,
+// блоки - линейные комбинации q^0..q^(k-1) (без умножений); блоки собираются по степеням
+// G = q^k деревом вместо схемы Горнера с sqrt(n) длинными умножениями.
+// Стоимость: малые степени - O(sqrt(n) M(sqrt(n) m)), линейные комбинации - O(n^1.5 m)
+// операций с коэффициентами (при больших n преобладают), дерево - O(M(nm) log n)
+Polynomial* poly_compose(const Polynomial* p, const Polynomial* q) {
+    if (!check_univariate(p, q)) return NULL;
+    if (p->degree < 0) return poly_zero();
+    if (ring.kind == RING_BIG) return compose_horner(p, q);
+
+    int n = p->degree;
+    int m = q->degree > 0 ? q->degree : 0;
+    int k = (int)ceil(sqrt((double)n + 1));
+    int blocks = (n + k) / k;
+    int block_len = (k - 1) * m + 1;
+
+    // Малые степени q^0..q^(k-1) в плотном виде
+    Coef** baby = malloc(sizeof(Coef*) * k);
+    Polynomial* power = poly_zero();
+    push_term(power, coef_from_ll(1), 0);
+    poly_normalize(power);
+    for (int i = 0; i < k; i++) {
+        baby[i] = poly_dense_coefs(power, i * m + 1);
+        Polynomial* next = poly_mult(power, q);
+        free_poly(power);
+        power = next;
+    }
 
-    const char* p = str;
-    while (*p) {
-        while (*p && isspace(*p)) p++;
-        if (!*p) break;
+    int levels = 0;
+    while ((1 << levels) < blocks) levels++;
+    Polynomial** parts = malloc(sizeof(Polynomial*) << levels);
+    Polynomial** giant = malloc(sizeof(Polynomial*) * (levels + 1));
+    giant[0] = power;
+    for (int l = 1; l < levels; l++) giant[l] = poly_mult(giant[l - 1], giant[l - 1]);
+
+    Coef* pc = poly_dense_coefs(p, n + 1);
+    for (int j = 0; j < (1 << levels); j++) {
+        Coef* block = calloc(block_len, sizeof(Coef));
+        for (int i = 0; i < k && j * k + i <= n; i++) {
+            Coef c = pc[j * k + i];
+            if (c == 0) continue;
+            for (int e = 0; e <= i * m; e++) block[e] = coef_add(block[e], coef_mul(c, baby[i][e]));
+        }
+        parts[j] = poly_from_coefs(block, block_len - 1);
+    }
 
-        int sign = 1, coef = 1, exp = 0;
+    Polynomial* result = combine_blocks(parts, 1 << levels, giant, levels);
 
-        if (*p == '+') { sign = 1; p++; }
-        else if (*p == '-') { sign = -1; p++; }
+    for (int i = 0; i < k; i++) free(baby[i]);
+    for (int j = 0; j < (1 << levels); j++) free_poly(parts[j]);
+    for (int l = 0; l < (levels > 0 ? levels : 1); l++) free_poly(giant[l]);
+    free(baby);
+    free(parts);
+    free(giant);
+    free(pc);
+    return result;
+}
 
-        if (isdigit(*p)) {
-            coef = 0;
-            while (isdigit(*p)) {
-                coef = coef * 10 + (*p - '0');
-                p++;
-            }
+// Разбор списка точек "1, 2, 3" или диапазона "a..b"; *is_float - есть дробные точки,
+// end указывает на закрывающую скобку
+static int parse_points(const char* args, const char* end, double** points, int* is_float) {
+    char* next;
+    long long from = strtoll(args, &next, 10);
+    const char* p = next;
+    while (p < end && isspace((unsigned char)*p)) p++;
+    if (next != args && end - p > 2 && p[0] == '.' && p[1] == '.') {
+        long long to = strtoll(p + 2, &next, 10);
+        if (next == p + 2) return -1;
+        p = next;
+        while (p < end && isspace((unsigned char)*p)) p++;
+        if (p != end || to < from || to - from >= 100000000) return -1;
+        int n = (int)(to - from + 1);
+        *points = malloc(sizeof(double) * n);
+        for (int i = 0; i < n; i++) (*points)[i] = (double)(from + i);
+        *is_float = 0;
+        return n;
+    }
+
+    int capacity = 16, n = 0;
+    *points = malloc(sizeof(double) * capacity);
+    *is_float = 0;
+    for (p = args; p < end; p++) {
+        if (*p == '.' || *p == 'e' || *p == 'E') *is_float = 1;
+    }
+
+    p = args;
+    while (p < end && isspace((unsigned char)*p)) p++;
+    while (p < end) {
+        double value = strtod(p, &next);
+        if (next == p || next > end) {
+            free(*points);
+            return -1;
         }
+        if (n == capacity) {
+            capacity *= 2;
+            *points = realloc(*points, sizeof(double) * capacity);
+        }
+        (*points)[n++] = value;
+        p = next;
+        while (p < end && (isspace((unsigned char)*p) || *p == ',')) p++;
+    }
+    return n;
+}
 
-        coef *= sign;
+// Выражения: неизменяемые многочлены со счетчиком ссылок в ленивом DAG.
+// Одинаковые подвыражения (литерал с тем же текстом, операция над теми же узлами)
+// разделяются через таблицу интернирования, значение узла вычисляется один раз.
+typedef enum {
+    EXPR_LITERAL, EXPR_ADD, EXPR_MULT, EXPR_DIFF, EXPR_DIV, EXPR_MOD, EXPR_GCD, EXPR_COMPOSE
+} ExprOp;
+
+#define INTERN_SIZE 4096
+#define MAX_REGISTERS 256
+#define MAX_NAME 32
+
+typedef struct Expr {
+    ExprOp op;
+    int refs;
+    struct Expr* args[2];
+    const char* text;  // литерал в буфере скрипта (не копируется); NULL у готового значения
+    int text_len;
+    Polynomial* value; // кэш результата, после вычисления не меняется
+    int overflow;      // при вычислении было переполнение int64
+    const char* error; // операция не определена (деление на ноль и т.п.)
+    int var;           // EXPR_DIFF: переменная дифференцирования (0 - x, 1 - y, 2 - z)
+    unsigned epoch;    // последняя смена кольца, в которую узел уже сброшен или переведен
+    int interned;
+    unsigned hash;
+    struct Expr* next_interned;
+} Expr;
+
+typedef struct Register {
+    char name[MAX_NAME];
+    Expr* expr;
+} Register;
+
+_Thread_local Expr* intern_table[INTERN_SIZE];
+_Thread_local Register registers[MAX_REGISTERS];
+_Thread_local int register_count = 0;
+_Thread_local Expr* accumulator = NULL;
+_Thread_local unsigned ring_epoch = 0; // счетчик смен кольца для expr_invalidate
+
+static Expr* expr_retain(Expr* e) {
+    if (e) e->refs++;
+    return e;
+}
 
-        if (*p == 'x') {
-            p++;
-            exp = 1;
-            if (*p == '^') {
-                p++;
-                exp = 0;
-                while (isdigit(*p)) {
-                    exp = exp * 10 + (*p - '0');
-                    p++;
-                }
+void expr_release(Expr* e) {
+    if (!e || --e->refs > 0) return;
+
+    if (e->interned) {
+        Expr** link = &intern_table[e->hash % INTERN_SIZE];
+        while (*link != e) link = &(*link)->next_interned;
+        *link = e->next_interned;
+    }
+    expr_release(e->args[0]);
+    expr_release(e->args[1]);
+    free_poly(e->value);
+    free(e);
+}
+
+static Expr* expr_alloc(ExprOp op) {
+    Expr* e = calloc(1, sizeof(Expr));
+    e->op = op;
+    e->refs = 1;
+    return e;
+}
+
+static void expr_intern(Expr* e, unsigned hash) {
+    e->interned = 1;
+    e->hash = hash;
+    e->next_interned = intern_table[hash % INTERN_SIZE];
+    intern_table[hash % INTERN_SIZE] = e;
+}
+
+// Сравнение литералов без учета пробелов
+static int same_literal(const char* a, const char* a_end, const char* b, const char* b_end) {
+    for (;;) {
+        while (a < a_end && isspace((unsigned char)*a)) a++;
+        while (b < b_end && isspace((unsigned char)*b)) b++;
+        if (a == a_end || b == b_end) return a == a_end && b == b_end;
+        if (*a++ != *b++) return 0;
+    }
+}
+
+// Литерал ссылается на текст скрипта, разбор откладывается до вычисления.
+// Буфер скрипта должен жить дольше всех выражений.
+Expr* expr_literal(const char* text, int len) {
+    unsigned hash = 2166136261u;
+    for (int i = 0; i < len; i++) {
+        if (!isspace((unsigned char)text[i])) hash = (hash ^ (unsigned char)text[i]) * 16777619u;
+    }
+
+    for (Expr* e = intern_table[hash % INTERN_SIZE]; e; e = e->next_interned) {
+        if (e->op == EXPR_LITERAL && e->hash == hash &&
+            same_literal(e->text, e->text + e->text_len, text, text + len)) {
+            return expr_retain(e);
+        }
+    }
+
+    Expr* e = expr_alloc(EXPR_LITERAL);
+    e->text = text;
+    e->text_len = len;
+    expr_intern(e, hash);
+    return e;
+}
+
+// Узел операции забирает ссылки на аргументы
+static Expr* expr_node(ExprOp op, Expr* left, Expr* right, int var) {
+    unsigned hash = (unsigned)op * 2654435761u ^ (unsigned)((uintptr_t)left >> 4) * 40503u ^
+        (unsigned)((uintptr_t)right >> 4) * 97u ^ (unsigned)var * 7919u;
+
+    for (Expr* e = intern_table[hash % INTERN_SIZE]; e; e = e->next_interned) {
+        if (e->op == op && e->args[0] == left && e->args[1] == right && e->var == var) {
+            expr_release(left);
+            expr_release(right);
+            return expr_retain(e);
+        }
+    }
+
+    Expr* e = expr_alloc(op);
+    e->args[0] = left;
+    e->args[1] = right;
+    e->var = var;
+    expr_intern(e, hash);
+    return e;
+}
+
+Expr* expr_op(ExprOp op, Expr* left, Expr* right) {
+    return expr_node(op, left, right, 0);
+}
+
+Expr* expr_diff(Expr* arg, int var) {
+    return expr_node(EXPR_DIFF, arg, NULL, var);
+}
+
+// Готовое значение (например, результат смены кольца); многочлен переходит во владение
+Expr* expr_value(Polynomial* poly) {
+    Expr* e = expr_alloc(EXPR_LITERAL);
+    e->value = poly;
+    return e;
+}
+
+const Polynomial* expr_force(Expr* e) {
+    if (!e->value) {
+        const Polynomial* a = e->args[0] ? expr_force(e->args[0]) : NULL;
+        const Polynomial* b = e->args[1] ? expr_force(e->args[1]) : NULL;
+        int outer_overflow = coef_overflow;
+        coef_overflow = 0;
+        poly_error = NULL;
+        if (e->args[0] && e->args[0]->error) poly_error = e->args[0]->error;
+        if (e->args[1] && e->args[1]->error) poly_error = e->args[1]->error;
+
+        if (!poly_error) {
+            switch (e->op) {
+            case EXPR_ADD: e->value = poly_add(a, b); break;
+            case EXPR_MULT: e->value = poly_mult(a, b); break;
+            case EXPR_DIFF: e->value = poly_partial(a, e->var); break;
+            case EXPR_DIV: e->value = poly_div(a, b); break;
+            case EXPR_MOD: e->value = poly_mod(a, b); break;
+            case EXPR_GCD: e->value = poly_gcd(a, b); break;
+            case EXPR_COMPOSE: e->value = poly_compose(a, b); break;
+            default: e->value = parse_poly_span(e->text, e->text + e->text_len); break;
             }
         }
+        if (!e->value) {
+            e->error = poly_error;
+            e->value = poly_zero();
+        }
 
-        add_term(poly, coef, exp);
-        while (*p && *p != '+' && *p != '-') p++;
+        e->overflow = coef_overflow ||
+            (e->args[0] && e->args[0]->overflow) || (e->args[1] && e->args[1]->overflow);
+        coef_overflow = outer_overflow;
     }
+    if (e->overflow) coef_overflow = 1;
+    return e->value;
+}
 
-    return poly;
+// После смены кольца: вычисленное сбрасывается, готовые значения переводятся.
+// Граф общий (hash-consing), поэтому каждый узел обрабатывается один раз за смену epoch
+static void expr_invalidate(Expr* e, unsigned epoch) {
+    if (!e || e->epoch == epoch) return;
+    e->epoch = epoch;
+    if (e->text || e->op != EXPR_LITERAL) {
+        free_poly(e->value);
+        e->value = NULL;
+        e->overflow = 0;
+        e->error = NULL;
+    }
+    else if (e->value) {
+        Polynomial* converted;
+        if (!poly_convert(e->value, &converted)) {
+            free_poly(converted);
+            converted = poly_zero();
+        }
+        free_poly(e->value);
+        e->value = converted;
+    }
+    expr_invalidate(e->args[0], epoch);
+    expr_invalidate(e->args[1], epoch);
 }
 
-void print_poly(const Polynomial* poly) {
-    if (!poly || !poly->head) {
-        printf("0");
-        return;
+static Register* find_register(const char* name, int len, int create) {
+    for (int i = 0; i < register_count; i++) {
+        if ((int)strlen(registers[i].name) == len && strncmp(registers[i].name, name, len) == 0) {
+            return &registers[i];
+        }
     }
+    if (!create || register_count == MAX_REGISTERS || len >= MAX_NAME) return NULL;
 
-    Term* current = poly->head;
-    int first = 1;
+    Register* r = &registers[register_count++];
+    memcpy(r->name, name, len);
+    r->name[len] = 0;
+    r->expr = NULL;
+    return r;
+}
+
+// Сумматор
+void set_accumulator(Expr* e) {
+    expr_retain(e);
+    expr_release(accumulator);
+    accumulator = e;
+}
+
+const Polynomial* get_accumulator() {
+    return expr_force(accumulator);
+}
+
+// Разбор выражений: Add(e, e) | Mult(e, e) | Diff(e) | Diff(e, y) | Div(e, e) | Mod(e, e) |
+// Gcd(e, e) | Compose(e, e) | $имя | литерал. Форма с одним аргументом (Add(e), Diff() и т.д.)
+// берет сумматор, как и Diff(, y); Diff без переменной - по x.
+// Разбор идет по отрезку [*p, end) буфера скрипта без копирования текста.
+static Expr* parse_expr(const char** p, const char* end);
+
+static void skip_spaces(const char** p, const char* end) {
+    while (*p < end && isspace((unsigned char)**p)) (*p)++;
+}
+
+static int has_prefix(const char* p, const char* end, const char* name) {
+    size_t len = strlen(name);
+    return (size_t)(end - p) >= len && memcmp(p, name, len) == 0;
+}
+
+static int match_call(const char** p, const char* end, const char* name) {
+    if (!has_prefix(*p, end, name)) return 0;
+    const char* q = *p + strlen(name);
+    skip_spaces(&q, end);
+    if (q == end || *q != '(') return 0;
+    *p = q + 1;
+    return 1;
+}
+
+static int expect_char(const char** p, const char* end, char c) {
+    skip_spaces(p, end);
+    if (*p == end || **p != c) return 0;
+    (*p)++;
+    return 1;
+}
+
+static Expr* parse_call(const char** p, const char* end, ExprOp op) {
+    skip_spaces(p, end);
+    if (*p < end && **p == ')') {
+        (*p)++;
+        return op == EXPR_DIFF ? expr_op(op, expr_retain(accumulator), NULL) : NULL;
+    }
 
-    while (current) {
-        int coef = current->coef;
-        int exp = current->exp;
+    // Diff(, y) - частная производная сумматора
+    Expr* first = op == EXPR_DIFF && *p < end && **p == ',' ? expr_retain(accumulator) : parse_expr(p, end);
+    if (!first) return NULL;
 
-        if (!first) printf(" %c ", coef >= 0 ? '+' : '-');
-        else if (coef < 0) printf("-");
+    if (op == EXPR_DIFF) {
+        int var = 0;
+        if (expect_char(p, end, ',')) {
+            skip_spaces(p, end);
+            var = *p < end && **p >= 'x' && **p <= 'z' ? **p - 'x' : -1;
+            if (var >= 0) (*p)++;
+        }
+        if (var < 0 || !expect_char(p, end, ')')) { expr_release(first); return NULL; }
+        return expr_diff(first, var);
+    }
 
-        coef = abs(coef);
+    if (expect_char(p, end, ')')) return expr_op(op, expr_retain(accumulator), first);
+    if (!expect_char(p, end, ',')) { expr_release(first); return NULL; }
 
-        if (exp == 0) printf("%d", coef);
-        else if (exp == 1) printf(coef == 1 ? "x" : "%dx", coef);
-        else printf(coef == 1 ? "x^%d" : "%dx^%d", coef, exp);
+    Expr* second = parse_expr(p, end);
+    if (!second || !expect_char(p, end, ')')) {
+        expr_release(first);
+        expr_release(second);
+        return NULL;
+    }
+    return expr_op(op, first, second);
+}
 
-        first = 0;
-        current = current->next;
+static Expr* parse_expr(const char** p, const char* end) {
+    skip_spaces(p, end);
+
+    if (match_call(p, end, "Add")) return parse_call(p, end, EXPR_ADD);
+    if (match_call(p, end, "Mult")) return parse_call(p, end, EXPR_MULT);
+    if (match_call(p, end, "Diff")) return parse_call(p, end, EXPR_DIFF);
+    if (match_call(p, end, "Div")) return parse_call(p, end, EXPR_DIV);
+    if (match_call(p, end, "Mod")) return parse_call(p, end, EXPR_MOD);
+    if (match_call(p, end, "Gcd")) return parse_call(p, end, EXPR_GCD);
+    if (match_call(p, end, "Compose")) return parse_call(p, end, EXPR_COMPOSE);
+
+    if (*p < end && **p == '$') {
+        const char* name = ++(*p);
+        while (*p < end && (isalnum((unsigned char)**p) || **p == '_')) (*p)++;
+        Register* r = find_register(name, (int)(*p - name), 0);
+        return r ? expr_retain(r->expr) : NULL;
     }
+
+    const char* start = *p;
+    while (*p < end && **p != ',' && **p != ')' && **p != '(') (*p)++;
+    if (*p == start || (*p < end && **p == '(')) return NULL;
+    return expr_literal(start, (int)(*p - start));
 }
 
-void free_poly(Polynomial* poly) {
-    if (!poly) return;
-    Term* current = poly->head;
-    while (current) {
-        Term* next = current->next;
-        free(current);
-        current = next;
+// Вычисляет выражение; при ошибке или переполнении int64 возвращает NULL
+static const Polynomial* force_checked(Expr* e) {
+    coef_overflow = 0;
+    const Polynomial* value = expr_force(e);
+    if (e->error) {
+        fprintf(poly_out, "Error: %s\n", e->error);
+        return NULL;
     }
-    free(poly);
+    if (coef_overflow) {
+        fprintf(poly_out, "Error: coefficient overflow, switch to Ring(big)\n");
+        return NULL;
+    }
+    return value;
 }
 
-// Операции
-Polynomial* poly_add(const Polynomial* a, const Polynomial* b) {
-    Polynomial* result = malloc(sizeof(Polynomial));
-    result->head = NULL;
+// Аргументы команды в скобках: open - после '(', close - на последней ')'
+static int call_args(const char* start, const char* end, const char** open, const char** close) {
+    const char* p = memchr(start, '(', end - start);
+    const char* q = end;
+    while (q > start && q[-1] != ')') q--;
+    if (!p || q <= p + 1) return 0;
+    *open = p + 1;
+    *close = q - 1;
+    return 1;
+}
+
+// Обработка команды из строки [line, end) буфера скрипта
+void process_command(const char* line, const char* end) {
+    const char* sc = memchr(line, ';', end - line);
+    if (sc) end = sc;
+
+    if (line < end && (line[0] == '%' || line[0] == '[')) return;
+
+    const char* start = line;
+    skip_spaces(&start, end);
+    while (end > start && isspace((unsigned char)end[-1])) end--;
+    if (start == end) return;
+
+    fprintf(poly_out, "> %.*s\n", (int)(end - start), start);
+    coef_overflow = 0;
+    command_count++;
+
+    if (*start == '$') {
+        // $имя = выражение - вычисление откладывается до первого использования
+        const char* p = start + 1;
+        const char* name = p;
+        while (p < end && (isalnum((unsigned char)*p) || *p == '_')) p++;
+        int len = (int)(p - name);
+        if (len == 0 || !expect_char(&p, end, '=')) { fprintf(poly_out, "Error\n"); return; }
+
+        Expr* e = parse_expr(&p, end);
+        if (e) skip_spaces(&p, end);
+        Register* r = e && p == end ? find_register(name, len, 1) : NULL;
+        if (!r) { expr_release(e); fprintf(poly_out, "Error\n"); return; }
+
+        expr_release(r->expr);
+        r->expr = e;
+    }
+    else if (has_prefix(start, end, "Print")) {
+        const char* p = start + 5;
+        Expr* e = expect_char(&p, end, '(') ? parse_expr(&p, end) : NULL;
+        if (!e || !expect_char(&p, end, ')')) { expr_release(e); fprintf(poly_out, "Error\n"); return; }
+
+        const Polynomial* value = force_checked(e);
+        if (value) { fprintf(poly_out, "Result: "); print_poly(value); fprintf(poly_out, "\n"); }
+        expr_release(e);
+    }
+    else if (has_prefix(start, end, "Add") || has_prefix(start, end, "Mult") ||
+        has_prefix(start, end, "Diff") || has_prefix(start, end, "Div") || has_prefix(start, end, "Mod") ||
+        has_prefix(start, end, "Gcd") || has_prefix(start, end, "Compose")) {
+        const char* p = start;
+        Expr* e = parse_expr(&p, end);
+        if (!e) { fprintf(poly_out, "Error\n"); return; }
+
+        const Polynomial* value = force_checked(e);
+        if (value) {
+            set_accumulator(e);
+            fprintf(poly_out, "Result: "); print_poly(value); fprintf(poly_out, "\n");
+        }
+        expr_release(e);
+    }
+    else if (has_prefix(start, end, "EvalMany")) {
+        const char *open, *close;
+        if (!call_args(start, end, &open, &close)) { fprintf(poly_out, "Error\n"); return; }
+
+        double* points;
+        int is_float;
+        int n = parse_points(open, close, &points, &is_float);
+        if (n <= 0) { fprintf(poly_out, "Error\n"); return; }
+
+        const Polynomial* a = get_accumulator();
+        if (a->layout == POLY_MULTI) {
+            fprintf(poly_out, "Error: EvalMany needs a polynomial in x only\n");
+        }
+        else if (is_float) {
+            double* values = malloc(sizeof(double) * n);
+            poly_eval_many_double(a, points, n, values);
+            for (int i = 0; i < n; i++) fprintf(poly_out, "P(%g) = %.17g\n", points[i], values[i]);
+            free(values);
+        }
+        else if (a->layout == POLY_BIG) {
+            for (int i = 0; i < n; i++) {
+                BigInt val = big_poly_eval(a, (long long)points[i]);
+                fprintf(poly_out, "P(%lld) = %s", (long long)points[i], val.sign < 0 ? "-" : "");
+                print_big_abs(&val);
+                fprintf(poly_out, "\n");
+                big_free(&val);
+            }
+        }
+        else {
+            Coef* xs = malloc(sizeof(Coef) * n);
+            Coef* values = malloc(sizeof(Coef) * n);
+            for (int i = 0; i < n; i++) xs[i] = (Coef)points[i];
+            poly_eval_many(a, xs, n, values);
+            if (coef_overflow) fprintf(poly_out, "Error: value overflow, switch to Ring(big)\n");
+            else {
+                for (int i = 0; i < n; i++) fprintf(poly_out, "P(%lld) = %lld\n", xs[i], values[i]);
+            }
+            free(xs);
+            free(values);
+        }
 
-    Term* current = a->head;
-    while (current) {
-        add_term(result, current->coef, current->exp);
-        current = current->next;
+        free(points);
     }
+    else if (has_prefix(start, end, "Eval")) {
+        const char *open, *close;
+        if (!call_args(start, end, &open, &close)) { fprintf(poly_out, "Error\n"); return; }
+
+        // Точка (x[, y[, z]]); strtoll остановится на ')' и не выйдет за пределы команды
+        Coef point[3] = { 0, 0, 0 };
+        int n = 0;
+        const char* p = open;
+        for (;;) {
+            char* next;
+            point[n++] = strtoll(p, &next, 10);
+            if (next == p) { fprintf(poly_out, "Error\n"); return; }
+            p = next;
+            skip_spaces(&p, close);
+            if (p == close) break;
+            if (*p != ',' || n == 3) { fprintf(poly_out, "Error\n"); return; }
+            p++;
+        }
+
+        const Polynomial* a = get_accumulator();
+        if (n < poly_vars(a)) {
+            fprintf(poly_out, "Error: Eval needs a value for each of x, y, z in use\n");
+            return;
+        }
+
+        // Подпись точки в том виде, в каком ее задали
+        char label[80];
+        int len = 0;
+        for (int i = 0; i < n; i++) len += sprintf(label + len, "%s%lld", i ? ", " : "", point[i]);
+
+        if (a->layout == POLY_BIG) {
+            BigInt val = big_poly_eval(a, point[0]);
+            fprintf(poly_out, "P(%s) = %s", label, val.sign < 0 ? "-" : "");
+            print_big_abs(&val);
+            fprintf(poly_out, "\n");
+            big_free(&val);
+        }
+        else {
+            Coef val = poly_eval_point(a, point);
+            if (coef_overflow) fprintf(poly_out, "Error: value overflow, switch to Ring(big)\n");
+            else fprintf(poly_out, "P(%s) = %lld\n", label, val);
+        }
 
-    current = b->head;
-    while (current) {
-        add_term(result, current->coef, current->exp);
-        current = current->next;
     }
+    else if (has_prefix(start, end, "Ring")) {
+        // Аргументы кольца короткие, их можно скопировать для sscanf
+        char args[64];
+        const char *open, *close;
+        if (!call_args(start, end, &open, &close) || close - open >= (long)sizeof(args)) {
+            fprintf(poly_out, "Error\n");
+            return;
+        }
+        memcpy(args, open, close - open);
+        args[close - open] = 0;
+
+        char name[16];
+        unsigned long long modulus = DEFAULT_MODULUS;
+        if (sscanf(args, " %15[a-z0-9] , %llu", name, &modulus) < 1) { fprintf(poly_out, "Error\n"); return; }
+
+        int ok;
+        if (strcmp(name, "int64") == 0) ok = set_ring(RING_INT64, 0);
+        else if (strcmp(name, "mod") == 0) ok = set_ring(RING_MOD, modulus);
+        else if (strcmp(name, "big") == 0) ok = set_ring(RING_BIG, 0);
+        else ok = 0;
+
+        if (!ok) {
+            fprintf(poly_out, "Error: unknown ring or modulus is not a prime below 2^62\n");
+            return;
+        }
 
-    return result;
+        // Сумматор переводится в новое кольцо, регистры будут пересчитаны
+        Polynomial* converted;
+        if (!poly_convert(get_accumulator(), &converted)) {
+            fprintf(poly_out, "Warning: accumulator does not fit the new ring, reset to 0\n");
+            free_poly(converted);
+            converted = poly_zero();
+        }
+        ring_epoch++;
+        for (int i = 0; i < register_count; i++) expr_invalidate(registers[i].expr, ring_epoch);
+        Expr* e = expr_value(converted);
+        set_accumulator(e);
+        expr_release(e);
+
+        if (ring.kind == RING_MOD) fprintf(poly_out, "Ring: integers mod %llu\n", (unsigned long long)ring.modulus);
+        else fprintf(poly_out, "Ring: %s\n", ring.kind == RING_BIG ? "big integers" : "int64 (checked)");
+    }
+    else {
+        fprintf(poly_out, "Unknown command\n");
+    }
 }
 
-Polynomial* poly_mult(const Polynomial* a, const Polynomial* b) {
-    Polynomial* result = malloc(sizeof(Polynomial));
-    result->head = NULL;
+// Скрипт целиком отображается в память; если mmap невозможен (канал, пустой файл),
+// содержимое читается в кучу. Литералы выражений ссылаются прямо на этот буфер.
+typedef struct Script {
+    const char* data;
+    size_t size;
+    int mapped;
+} Script;
+
+int open_script(const char* path, Script* script) {
+    script->data = NULL;
+    script->size = 0;
+    script->mapped = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            madvise(data, st.st_size, MADV_SEQUENTIAL);
+            script->data = data;
+            script->size = st.st_size;
+            script->mapped = 1;
+            close(fd);
+            return 1;
+        }
+    }
 
-    Term* ta = a->head;
-    while (ta) {
-        Term* tb = b->head;
-        while (tb) {
-            add_term(result, ta->coef * tb->coef, ta->exp + tb->exp);
-            tb = tb->next;
+    size_t capacity = 1 << 16;
+    char* buffer = malloc(capacity);
+    ssize_t got;
+    while ((got = read(fd, buffer + script->size, capacity - script->size)) > 0) {
+        script->size += got;
+        if (script->size == capacity) {
+            capacity *= 2;
+            buffer = realloc(buffer, capacity);
         }
-        ta = ta->next;
     }
+    close(fd);
+    script->data = buffer;
+    return 1;
+}
 
-    return result;
+void close_script(Script* script) {
+    if (script->mapped) munmap((void*)script->data, script->size);
+    else free((void*)script->data);
+    script->data = NULL;
 }
 
-int poly_eval(const Polynomial* poly, int x) {
-    int result = 0;
-    Term* current = poly->head;
-    while (current) {
-        int term = current->coef;
-        for (int i = 0; i < current->exp; i++) term *= x;
-        result += term;
-        current = current->next;
+void run_script(const Script* script) {
+    const char* line = script->data;
+    const char* end = script->data + script->size;
+    while (line < end) {
+        const char* nl = memchr(line, '\n', end - line);
+        const char* line_end = nl ? nl : end;
+        process_command(line, line_end);
+        line = line_end + 1;
     }
-    return result;
 }
 
-Polynomial* poly_diff(const Polynomial* poly) {
-    Polynomial* result = malloc(sizeof(Polynomial));
-    result->head = NULL;
+// Выполняет скрипт в сеансе текущего потока с чистым сумматором в кольце int64;
+// *bytes - размер скрипта. Вывод идет в poly_out
+int run_script_file(const char* path, size_t* bytes) {
+    set_ring(RING_INT64, 0);
+    Expr* zero = expr_value(poly_zero());
+    set_accumulator(zero);
+    expr_release(zero);
+
+    Script script;
+    int ok = open_script(path, &script);
+    if (ok) {
+        *bytes = script.size;
+        run_script(&script);
+    }
+    else fprintf(poly_out, "Cannot open file\n");
+
+    // Выражения ссылаются на текст скрипта, поэтому освобождаются раньше него
+    set_accumulator(NULL);
+    for (int i = 0; i < register_count; i++) expr_release(registers[i].expr);
+    register_count = 0;
+    if (ok) close_script(&script);
+    return ok;
+}
 
-    Term* current = poly->head;
-    while (current) {
-        if (current->exp > 0) {
-            add_term(result, current->coef * current->exp, current->exp - 1);
-        }
-        current = current->next;
+// Пакетный режим: каждый скрипт выполняется на рабочем потоке в собственном сеансе,
+// вывод скрипта копится в памяти и печатается в порядке входа по мере готовности
+typedef struct ScriptJob {
+    char* path;
+    char* output;
+    size_t output_size;
+    size_t bytes;
+    long commands;
+    int ok;
+    int ready;
+} ScriptJob;
+
+typedef struct ScriptBatch {
+    ScriptJob* jobs;
+    int count;
+    int capacity;
+    int next_job;
+    pthread_mutex_t lock;
+    pthread_cond_t ready_cond;
+} ScriptBatch;
+
+static void add_job(ScriptBatch* batch, const char* path) {
+    if (batch->count == batch->capacity) {
+        batch->capacity = batch->capacity ? batch->capacity * 2 : 64;
+        batch->jobs = realloc(batch->jobs, sizeof(ScriptJob) * batch->capacity);
     }
+    ScriptJob* job = &batch->jobs[batch->count++];
+    memset(job, 0, sizeof(ScriptJob));
+    job->path = strdup(path);
+}
 
-    return result;
+static int compare_names(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
 }
 
-// Сумматор
-void set_accumulator(Polynomial* poly) {
-    free_poly(&accumulator);
-    accumulator.head = NULL;
-    if (poly) {
-        Term* current = poly->head;
-        while (current) {
-            add_term(&accumulator, current->coef, current->exp);
-            current = current->next;
+// Файл добавляется как есть, из каталога - все обычные файлы по алфавиту
+static int collect_scripts(ScriptBatch* batch, const char* path) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        fprintf(stderr, "Error: Cannot open %s\n", path);
+        return 0;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        add_job(batch, path);
+        return 1;
+    }
+
+    DIR* dir = opendir(path);
+    if (!dir) {
+        fprintf(stderr, "Error: Cannot open directory %s\n", path);
+        return 0;
+    }
+
+    int count = 0, capacity = 64;
+    char** names = malloc(sizeof(char*) * capacity);
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+
+        size_t len = strlen(path) + strlen(entry->d_name) + 2;
+        char* full = malloc(len);
+        snprintf(full, len, "%s/%s", path, entry->d_name);
+        if (stat(full, &st) != 0 || !S_ISREG(st.st_mode)) {
+            free(full);
+            continue;
+        }
+        if (count == capacity) {
+            capacity *= 2;
+            names = realloc(names, sizeof(char*) * capacity);
         }
+        names[count++] = full;
     }
-}
+    closedir(dir);
 
-Polynomial* get_accumulator() {
-    Polynomial* copy = malloc(sizeof(Polynomial));
-    copy->head = NULL;
-    Term* current = accumulator.head;
-    while (current) {
-        add_term(copy, current->coef, current->exp);
-        current = current->next;
+    qsort(names, count, sizeof(char*), compare_names);
+    for (int i = 0; i < count; i++) {
+        add_job(batch, names[i]);
+        free(names[i]);
     }
-    return copy;
+    free(names);
+    return 1;
 }
 
-// Обработка команд
-void process_command(const char* line) {
-    char buf[MAX_LINE];
-    strcpy(buf, line);
+static void* script_worker(void* arg) {
+    ScriptBatch* batch = arg;
+
+    for (;;) {
+        pthread_mutex_lock(&batch->lock);
+        int idx = batch->next_job++;
+        pthread_mutex_unlock(&batch->lock);
+        if (idx >= batch->count) break;
+
+        ScriptJob* job = &batch->jobs[idx];
+        poly_out = open_memstream(&job->output, &job->output_size);
+        command_count = 0;
+        job->ok = run_script_file(job->path, &job->bytes);
+        job->commands = command_count;
+        fclose(poly_out);
+        poly_out = NULL;
+
+        pthread_mutex_lock(&batch->lock);
+        job->ready = 1;
+        pthread_cond_broadcast(&batch->ready_cond);
+        pthread_mutex_unlock(&batch->lock);
+    }
+
+    return NULL;
+}
 
-    char* nl = strchr(buf, '\n');
-    if (nl) *nl = 0;
-    char* sc = strchr(buf, ';');
-    if (sc) *sc = 0;
+static double elapsed_since(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) * 1e-9;
+}
 
-    if (buf[0] == '%' || buf[0] == '[') return;
+// --batch [--threads N] <скрипт | каталог>...
+int batch_mode(int argc, char** argv) {
+    ScriptBatch batch;
+    memset(&batch, 0, sizeof(ScriptBatch));
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
 
-    char* start = buf;
-    while (*start && isspace(*start)) start++;
-    if (!*start) return;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) threads = atoi(argv[++i]);
+        else collect_scripts(&batch, argv[i]);
+    }
+    if (batch.count == 0) {
+        fprintf(stderr, "Error: expected --batch [--threads N] <script|directory>...\n");
+        free(batch.jobs);
+        return 1;
+    }
+    if (threads < 1) threads = 1;
+    if (threads > batch.count) threads = batch.count;
 
-    printf("> %s\n", start);
+    pthread_mutex_init(&batch.lock, NULL);
+    pthread_cond_init(&batch.ready_cond, NULL);
 
-    if (strncmp(start, "Add", 3) == 0) {
-        char* p = strchr(start, '(');
-        if (!p) { printf("Error\n"); return; }
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
 
-        char p1[100], p2[100];
-        int count = sscanf(p, "(%99[^,],%99[^)])", p1, p2);
+    pthread_t* workers = malloc(sizeof(pthread_t) * threads);
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&workers[i], NULL, script_worker, &batch);
+    }
 
-        Polynomial* a, * b;
-        if (count == 2) {
-            a = parse_poly(p1);
-            b = parse_poly(p2);
+    // Прогресс - в stderr, если это терминал, не чаще раза в 0.2 с
+    int show_progress = isatty(STDERR_FILENO);
+    double last_report = 0;
+    size_t total_bytes = 0;
+    long total_commands = 0;
+    int failed = 0;
+
+    for (int i = 0; i < batch.count; i++) {
+        ScriptJob* job = &batch.jobs[i];
+
+        pthread_mutex_lock(&batch.lock);
+        while (!job->ready) pthread_cond_wait(&batch.ready_cond, &batch.lock);
+        pthread_mutex_unlock(&batch.lock);
+
+        printf("=== %s ===\n", job->path);
+        fwrite(job->output, 1, job->output_size, stdout);
+        free(job->output);
+        job->output = NULL;
+
+        total_bytes += job->bytes;
+        total_commands += job->commands;
+        if (!job->ok) failed++;
+
+        double elapsed = elapsed_since(&start);
+        if (show_progress && (elapsed - last_report >= 0.2 || i + 1 == batch.count)) {
+            fprintf(stderr, "\r[%d/%d] %.1f scripts/s, %.0f commands/s, %.2f MB/s   ",
+                i + 1, batch.count, (i + 1) / elapsed, total_commands / elapsed, total_bytes / elapsed / 1e6);
+            last_report = elapsed;
         }
-        else if (count == 1) {
-            a = get_accumulator();
-            b = parse_poly(p1);
-        }
-        else { printf("Error\n"); return; }
+    }
+    fflush(stdout);
 
-        Polynomial* res = poly_add(a, b);
-        set_accumulator(res);
-        printf("Result: "); print_poly(res); printf("\n");
+    for (int i = 0; i < threads; i++) {
+        pthread_join(workers[i], NULL);
+    }
 
-        free_poly(a);
-        if (count == 2) free_poly(b);
-        free_poly(res);
+    double elapsed = elapsed_since(&start);
+    if (show_progress) fprintf(stderr, "\n");
+    fprintf(stderr, "Scripts: %d (%d failed), commands: %ld, input: %.2f MB, threads: %d\n",
+        batch.count, failed, total_commands, total_bytes / 1e6, threads);
+    fprintf(stderr, "Time: %.3f s, %.1f scripts/s, %.0f commands/s, %.2f MB/s\n",
+        elapsed, batch.count / elapsed, total_commands / elapsed, total_bytes / elapsed / 1e6);
+
+    for (int i = 0; i < batch.count; i++) free(batch.jobs[i].path);
+    pthread_cond_destroy(&batch.ready_cond);
+    pthread_mutex_destroy(&batch.lock);
+    free(workers);
+    free(batch.jobs);
+    return failed ? 1 : 0;
+}
+
+// Микробенчмарк ядер: случайные плотные и разреженные многочлены, замер операций
+// по представлениям и алгоритмам умножения, точки перехода для настройки порогов
+#define BENCH_MIN_TIME 0.02 // повторяем операцию, пока замер не займет столько секунд
+#define BENCH_MAX_TIME 0.5  // дольше - операция пропускается на больших размерах
+#define BENCH_SWEEP_DEGREE 4096
+
+typedef struct BenchCase {
+    const Polynomial* a;
+    const Polynomial* b;
+    const char* text;
+    MultAlgorithm algorithm;
+} BenchCase;
+
+typedef void (*BenchOp)(const BenchCase* c);
+
+static uint64_t bench_state = 88172645463325252ULL;
+
+static uint64_t bench_rand() {
+    bench_state ^= bench_state << 13;
+    bench_state ^= bench_state >> 7;
+    bench_state ^= bench_state << 17;
+    return bench_state;
+}
+
+// Каждая степень до degree присутствует с вероятностью density, старшая - всегда;
+// коэффициенты ненулевые из [-99, 99]; представление выбирает poly_normalize
+static Polynomial* bench_poly(int degree, double density) {
+    Polynomial* poly = poly_new(POLY_SPARSE);
+    for (int e = degree; e >= 0; e--) {
+        if (e != degree && (bench_rand() >> 11) * 0x1.0p-53 >= density) continue;
+        long long coef = (long long)(bench_rand() % 99) + 1;
+        push_term(poly, coef_from_ll(bench_rand() & 1 ? coef : -coef), e);
+    }
+    poly_normalize(poly);
+    return poly;
+}
+
+static Polynomial* bench_relayout(const Polynomial* poly, PolyLayout layout) {
+    Polynomial* copy = poly_copy(poly);
+    if (layout == POLY_DENSE && copy->layout != POLY_DENSE) to_dense(copy);
+    if (layout == POLY_SPARSE && copy->layout != POLY_SPARSE) to_sparse(copy);
+    return copy;
+}
+
+static char* bench_text(const Polynomial* poly) {
+    char* text = NULL;
+    size_t size = 0;
+    FILE* saved = poly_out;
+    poly_out = open_memstream(&text, &size);
+    print_poly(poly);
+    fclose(poly_out);
+    poly_out = saved;
+    return text;
+}
+
+static void bench_add_term(const BenchCase* c) {
+    // Члены a по одному в порядке возрастания степени и одна нормализация в конце
+    int count;
+    Term* terms = poly_terms(c->a, &count);
+    Polynomial* poly = poly_zero();
+    for (int i = count - 1; i >= 0; i--) add_term(poly, terms[i].coef, terms[i].exp);
+    poly_normalize(poly);
+    release_terms(c->a, terms);
+    free_poly(poly);
+}
+
+static void bench_add(const BenchCase* c) {
+    free_poly(poly_add(c->a, c->b));
+}
+
+static void bench_eval(const BenchCase* c) {
+    volatile Coef sink = poly_eval(c->a, -1);
+    (void)sink;
+}
+
+static void bench_parse(const BenchCase* c) {
+    free_poly(parse_poly(c->text));
+}
 
+static void bench_mult(const BenchCase* c) {
+    free_poly(poly_mult_with(c->a, c->b, c->algorithm));
+}
+
+static double bench_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// Секунды на одну операцию; -1, если прошлый замер этой колонки превысил BENCH_MAX_TIME
+static double bench_run(BenchOp op, const BenchCase* c, double* last) {
+    if (*last > BENCH_MAX_TIME) return -1;
+
+    long reps = 1;
+    double elapsed;
+    for (;;) {
+        double start = bench_now();
+        for (long i = 0; i < reps; i++) op(c);
+        elapsed = bench_now() - start;
+        if (elapsed >= BENCH_MIN_TIME) break;
+        reps *= 2;
     }
-    else if (strncmp(start, "Mult", 4) == 0) {
-        char* p = strchr(start, '(');
-        if (!p) { printf("Error\n"); return; }
+    coef_overflow = 0;
+    *last = elapsed / reps;
+    return *last;
+}
 
-        char p1[100], p2[100];
-        int count = sscanf(p, "(%99[^,],%99[^)])", p1, p2);
+static void bench_print_time(double seconds) {
+    if (seconds < 0) printf(" %11s", "-");
+    else if (seconds < 1e-3) printf(" %9.2fus", seconds * 1e6);
+    else if (seconds < 1) printf(" %9.2fms", seconds * 1e3);
+    else printf(" %10.2fs", seconds);
+}
 
-        Polynomial* a, * b;
-        if (count == 2) {
-            a = parse_poly(p1);
-            b = parse_poly(p2);
+// Первая точка, начиная с которой slow[i] > fast[i] во всех последующих измеренных точках
+static int bench_crossover(const double* fast, const double* slow, int count) {
+    int from = -1;
+    for (int i = 0; i < count; i++) {
+        if (fast[i] < 0 || slow[i] < 0) continue;
+        if (fast[i] < slow[i]) {
+            if (from < 0) from = i;
         }
-        else if (count == 1) {
-            a = get_accumulator();
-            b = parse_poly(p1);
-        }
-        else { printf("Error\n"); return; }
+        else from = -1;
+    }
+    return from;
+}
 
-        Polynomial* res = poly_mult(a, b);
-        set_accumulator(res);
-        printf("Result: "); print_poly(res); printf("\n");
+static void bench_report_degree(const char* what, const int* degrees, const double* fast, const double* slow,
+                                int count, const char* threshold) {
+    int i = bench_crossover(fast, slow, count);
+    if (i < 0) printf("  %-36s no crossover measured (%s)\n", what, threshold);
+    else printf("  %-36s from degree %d (%s)\n", what, degrees[i], threshold);
+}
 
-        free_poly(a);
-        if (count == 2) free_poly(b);
-        free_poly(res);
+static void bench_report_density(const char* what, const double* densities, const double* fast, const double* slow,
+                                 int count, const char* threshold) {
+    int i = bench_crossover(fast, slow, count);
+    if (i < 0) printf("  %-36s no crossover measured (%s)\n", what, threshold);
+    else printf("  %-36s from density %.3f (%s)\n", what, densities[i], threshold);
+}
 
+// Первая точка, начиная с которой MULT_AUTO во всех последующих точках выбирает algorithm
+// (при leaves - выбирает что угодно, кроме него); -1, если такой нет
+static int bench_auto_switch(const MultAlgorithm* picks, int count, MultAlgorithm algorithm, int leaves) {
+    int from = -1;
+    for (int i = 0; i < count; i++) {
+        if ((picks[i] == algorithm) != leaves) {
+            if (from < 0) from = i;
+        }
+        else from = -1;
     }
-    else if (strncmp(start, "Eval", 4) == 0) {
-        char* p = strchr(start, '(');
-        if (!p) { printf("Error\n"); return; }
+    return from;
+}
+
+// Лучшее время среди плотных алгоритмов (school, karatsuba, ntt) - против кучи
+static double bench_best_dense(double school, double karatsuba, double ntt) {
+    double best = -1;
+    if (school >= 0) best = school;
+    if (karatsuba >= 0 && (best < 0 || karatsuba < best)) best = karatsuba;
+    if (ntt >= 0 && (best < 0 || ntt < best)) best = ntt;
+    return best;
+}
 
-        int x;
-        if (sscanf(p, "(%d)", &x) == 1) {
-            Polynomial* a = get_accumulator();
-            int val = poly_eval(a, x);
-            printf("P(%d) = %d\n", x, val);
+#define BENCH_MAX_POINTS 32
+
+// Кольцо int64 или mod; степени 16, 32, ..., max_degree; разреженные входы с плотностью density
+static void bench_kernels(int max_degree, double density) {
+    static const char* mult_names[] = { "auto", "school", "karatsuba", "ntt", "heap" };
+    int degrees[BENCH_MAX_POINTS], points = 0;
+    for (int d = 16; d <= max_degree && points < BENCH_MAX_POINTS; d *= 2) degrees[points++] = d;
+
+    // Операции по представлениям: индекс [0] - плотный вход, [1] - разреженный
+    double add_term_t[2][BENCH_MAX_POINTS], add_t[2][2][BENCH_MAX_POINTS], eval_t[2][2][BENCH_MAX_POINTS];
+    double parse_t[2][BENCH_MAX_POINTS], mult_t[2][5][BENCH_MAX_POINTS], dense_mult_t[BENCH_MAX_POINTS];
+    MultAlgorithm picks[2][BENCH_MAX_POINTS];
+    double last_add_term[2] = { 0 }, last_add[2][2] = { { 0 } }, last_eval[2][2] = { { 0 } };
+    double last_parse[2] = { 0 }, last_mult[2][5] = { { 0 } };
+
+    for (int input = 0; input < 2; input++) {
+        double fill = input == 0 ? 1.0 : density;
+        printf("\n%s inputs (density %.3f), time per operation:\n", input == 0 ? "Dense" : "Sparse", fill);
+        printf("%8s %11s %11s %11s %11s %11s %11s", "degree", "add_term", "add:dense", "add:sparse",
+            "eval:dense", "eval:sparse", "parse");
+        for (int m = 0; m < 5; m++) printf(" %11s", mult_names[m]);
+        printf("\n");
+
+        for (int i = 0; i < points; i++) {
+            Polynomial* a = bench_poly(degrees[i], fill);
+            Polynomial* b = bench_poly(degrees[i], fill);
+            char* text = bench_text(a);
+
+            BenchCase c = { a, b, text, MULT_AUTO };
+            picks[input][i] = mult_choose(a, b);
+            printf("%8d", degrees[i]);
+            bench_print_time(add_term_t[input][i] = bench_run(bench_add_term, &c, &last_add_term[input]));
+
+            for (int layout = 0; layout < 2; layout++) {
+                PolyLayout kind = layout == 0 ? POLY_DENSE : POLY_SPARSE;
+                Polynomial* la = bench_relayout(a, kind);
+                Polynomial* lb = bench_relayout(b, kind);
+                BenchCase lc = { la, lb, NULL, MULT_AUTO };
+                add_t[input][layout][i] = bench_run(bench_add, &lc, &last_add[input][layout]);
+                eval_t[input][layout][i] = bench_run(bench_eval, &lc, &last_eval[input][layout]);
+                free_poly(la);
+                free_poly(lb);
+            }
+            bench_print_time(add_t[input][0][i]);
+            bench_print_time(add_t[input][1][i]);
+            bench_print_time(eval_t[input][0][i]);
+            bench_print_time(eval_t[input][1][i]);
+            bench_print_time(parse_t[input][i] = bench_run(bench_parse, &c, &last_parse[input]));
+
+            for (int m = 0; m < 5; m++) {
+                c.algorithm = (MultAlgorithm)m;
+                bench_print_time(mult_t[input][m][i] = bench_run(bench_mult, &c, &last_mult[input][m]));
+            }
+            printf("\n");
+            fflush(stdout);
+
+            free(text);
             free_poly(a);
+            free_poly(b);
         }
-        else printf("Error\n");
+    }
 
+    for (int i = 0; i < points; i++) {
+        dense_mult_t[i] = bench_best_dense(mult_t[1][MULT_SCHOOLBOOK][i], mult_t[1][MULT_KARATSUBA][i],
+            mult_t[1][MULT_NTT][i]);
     }
-    else if (strncmp(start, "Diff", 4) == 0) {
-        Polynomial* a = get_accumulator();
-        Polynomial* res = poly_diff(a);
-        set_accumulator(res);
-        printf("Result: "); print_poly(res); printf("\n");
+
+    // В скобках - где переключается MULT_AUTO по оценкам mult_costs; должно совпадать с замером
+    char threshold[64];
+    int from;
+    printf("\nCrossovers by degree (MULT_AUTO switch by its cost estimate in parentheses):\n");
+    from = bench_auto_switch(picks[0], points, MULT_SCHOOLBOOK, 1);
+    if (from < 0) snprintf(threshold, sizeof(threshold), "auto: never");
+    else snprintf(threshold, sizeof(threshold), "auto: from degree %d", degrees[from]);
+    bench_report_degree("karatsuba beats schoolbook", degrees, mult_t[0][MULT_KARATSUBA], mult_t[0][MULT_SCHOOLBOOK],
+        points, threshold);
+    from = bench_auto_switch(picks[0], points, MULT_NTT, 0);
+    if (from < 0) snprintf(threshold, sizeof(threshold), "auto: never");
+    else snprintf(threshold, sizeof(threshold), "auto: from degree %d", degrees[from]);
+    bench_report_degree("ntt beats karatsuba", degrees, mult_t[0][MULT_NTT], mult_t[0][MULT_KARATSUBA],
+        points, threshold);
+    from = bench_auto_switch(picks[1], points, MULT_HEAP, 1);
+    if (from < 0) snprintf(threshold, sizeof(threshold), "auto: never");
+    else snprintf(threshold, sizeof(threshold), "auto: from degree %d", degrees[from]);
+    bench_report_degree("sparse: dense mult beats heap", degrees, dense_mult_t, mult_t[1][MULT_HEAP],
+        points, threshold);
+    bench_report_degree("sparse: dense add beats sparse add", degrees, add_t[1][0], add_t[1][1],
+        points, "DENSE_MIN_FILL");
+}
+
+// Развертка по плотности при фиксированной степени: где плотное представление и
+// плотное умножение начинают выигрывать у разреженных
+static void bench_density_sweep(int degree) {
+    double densities[BENCH_MAX_POINTS];
+    int points = 0;
+    for (double d = 1.0 / 512; d <= 1.0 && points < BENCH_MAX_POINTS; d *= 2) densities[points++] = d;
+    if (densities[points - 1] < 1.0) densities[points++] = 1.0;
+
+    double add_t[2][BENCH_MAX_POINTS], eval_t[2][BENCH_MAX_POINTS], mult_t[4][BENCH_MAX_POINTS];
+    double dense_mult_t[BENCH_MAX_POINTS];
+    double last_add[2] = { 0 }, last_eval[2] = { 0 }, last_mult[4] = { 0 };
+    MultAlgorithm picks[BENCH_MAX_POINTS];
+    static const MultAlgorithm sweep_algorithms[] = { MULT_SCHOOLBOOK, MULT_KARATSUBA, MULT_NTT, MULT_HEAP };
+
+    printf("\nDensity sweep at degree %d, time per operation:\n", degree);
+    printf("%8s %8s %11s %11s %11s %11s %11s %11s %11s %11s\n", "density", "terms", "add:dense", "add:sparse",
+        "eval:dense", "eval:sparse", "school", "karatsuba", "ntt", "heap");
+
+    for (int i = 0; i < points; i++) {
+        Polynomial* a = bench_poly(degree, densities[i]);
+        Polynomial* b = bench_poly(degree, densities[i]);
+        printf("%8.4f %8d", densities[i], a->count);
+
+        for (int layout = 0; layout < 2; layout++) {
+            Polynomial* la = bench_relayout(a, layout == 0 ? POLY_DENSE : POLY_SPARSE);
+            Polynomial* lb = bench_relayout(b, layout == 0 ? POLY_DENSE : POLY_SPARSE);
+            BenchCase c = { la, lb, NULL, MULT_AUTO };
+            add_t[layout][i] = bench_run(bench_add, &c, &last_add[layout]);
+            eval_t[layout][i] = bench_run(bench_eval, &c, &last_eval[layout]);
+            free_poly(la);
+            free_poly(lb);
+        }
+
+        BenchCase c = { a, b, NULL, MULT_AUTO };
+        picks[i] = mult_choose(a, b);
+        for (int m = 0; m < 4; m++) {
+            c.algorithm = sweep_algorithms[m];
+            mult_t[m][i] = bench_run(bench_mult, &c, &last_mult[m]);
+        }
+        dense_mult_t[i] = bench_best_dense(mult_t[0][i], mult_t[1][i], mult_t[2][i]);
+
+        bench_print_time(add_t[0][i]);
+        bench_print_time(add_t[1][i]);
+        bench_print_time(eval_t[0][i]);
+        bench_print_time(eval_t[1][i]);
+        for (int m = 0; m < 4; m++) bench_print_time(mult_t[m][i]);
+        printf("\n");
+        fflush(stdout);
+
         free_poly(a);
-        free_poly(res);
+        free_poly(b);
+    }
+
+    char threshold[64];
+    printf("\nCrossovers by density at degree %d:\n", degree);
+    snprintf(threshold, sizeof(threshold), "DENSE_MIN_FILL = %.2f", DENSE_MIN_FILL);
+    bench_report_density("dense add beats sparse add", densities, add_t[0], add_t[1], points, threshold);
+    bench_report_density("dense eval beats sparse eval", densities, eval_t[0], eval_t[1], points, threshold);
+    int from = bench_auto_switch(picks, points, MULT_HEAP, 1);
+    if (from < 0) snprintf(threshold, sizeof(threshold), "auto: never");
+    else snprintf(threshold, sizeof(threshold), "auto: from density %.3f", densities[from]);
+    bench_report_density("dense mult beats heap", densities, dense_mult_t, mult_t[3], points, threshold);
+}
 
+// --bench [--max-degree N] [--density D] [--ring int64|mod] [--seed S]
+int bench_mode(int argc, char** argv) {
+    int max_degree = 1 << 14;
+    double density = 0.05;
+    RingKind kind = RING_INT64;
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--max-degree") == 0 && i + 1 < argc) max_degree = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--density") == 0 && i + 1 < argc) density = atof(argv[++i]);
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) bench_state = strtoull(argv[++i], NULL, 10) | 1;
+        else if (strcmp(argv[i], "--ring") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "mod") == 0) kind = RING_MOD;
+            else if (strcmp(argv[i], "int64") != 0) {
+                fprintf(stderr, "Error: benchmark ring must be int64 or mod\n");
+                return 1;
+            }
+        }
+        else {
+            fprintf(stderr, "Error: expected --bench [--max-degree N] [--density D] [--ring int64|mod] [--seed S]\n");
+            return 1;
+        }
     }
-    else {
-        printf("Unknown command\n");
+    if (max_degree < 16 || density <= 0 || density > 1) {
+        fprintf(stderr, "Error: max degree must be at least 16 and density in (0, 1]\n");
+        return 1;
     }
+
+    set_ring(kind, DEFAULT_MODULUS);
+    poly_out = stdout;
+    printf("Kernel benchmark: ring %s, degrees 16..%d, sparse density %.3f\n",
+        kind == RING_MOD ? "mod" : "int64", max_degree, density);
+    printf("Columns past %.1f s per operation are skipped at larger sizes (-)\n", BENCH_MAX_TIME);
+
+    bench_kernels(max_degree, density);
+    bench_density_sweep(max_degree < BENCH_SWEEP_DEGREE ? max_degree : BENCH_SWEEP_DEGREE);
+    return 0;
 }
 
 // Создание тестового файла
@@ -337,29 +3806,23 @@ void create_demo_file() {
     }
 }
 
-int main() {
-    printf("=== Simple Polynomial Calculator ===\n");
-
-    // Инициализация сумматора
-    add_term(&accumulator, 0, 0);
-
-    // Создаем демо файл
-    create_demo_file();
-
-    // Читаем и выполняем команды
-    FILE* f = fopen("poly_demo.txt", "r");
-    if (!f) {
-        printf("Cannot open file\n");
-        return 1;
+int main(int argc, char** argv) {
+    if (argc >= 2 && strcmp(argv[1], "--batch") == 0) {
+        return batch_mode(argc, argv);
     }
-
-    char line[MAX_LINE];
-    while (fgets(line, sizeof(line), f)) {
-        process_command(line);
+    if (argc >= 2 && strcmp(argv[1], "--bench") == 0) {
+        return bench_mode(argc, argv);
     }
 
-    fclose(f);
-    free_poly(&accumulator);
+    printf("=== Simple Polynomial Calculator ===\n");
+    poly_out = stdout;
+
+    // Без аргументов создаем и выполняем демо файл
+    const char* path = argc > 1 ? argv[1] : "poly_demo.txt";
+    if (argc <= 1) create_demo_file();
+
+    size_t bytes;
+    if (!run_script_file(path, &bytes)) return 1;
 
     printf("\nPress any key to exit...");
     getchar();
@@ -2,6 +2,21 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
 
 typedef struct Node {
     int value;
@@ -53,11 +68,364 @@ long long calculate_prime_product(int x) {
     return product;
 }
 
-int josephus_simulation(int n, int k, int forward) {
+// Решето Эратосфена, общее для всех запросов пакетного режима
+#define SIEVE_BLOCK 4096
+
+typedef struct Sieve {
+    int limit;
+    unsigned char* composite;
+    unsigned long long* block_product; // произведение простых < i * SIEVE_BLOCK
+} Sieve;
+
+Sieve* create_sieve(int limit) {
+    if (limit < 2) limit = 2;
+
+    Sieve* sieve = malloc(sizeof(Sieve));
+    sieve->limit = limit;
+    sieve->composite = calloc((size_t)limit + 1, 1);
+    sieve->composite[0] = sieve->composite[1] = 1;
+
+    for (long long i = 2; i * i <= limit; i++) {
+        if (sieve->composite[i]) continue;
+        for (long long j = i * i; j <= limit; j += i) {
+            sieve->composite[j] = 1;
+        }
+    }
+
+    int blocks = limit / SIEVE_BLOCK + 1;
+    sieve->block_product = malloc(sizeof(unsigned long long) * blocks);
+    unsigned long long product = 1;
+    // long long: при limit == INT_MAX счетчик int переполнился бы на i <= limit
+    for (long long i = 0; i <= limit; i++) {
+        if (i % SIEVE_BLOCK == 0) sieve->block_product[i / SIEVE_BLOCK] = product;
+        if (!sieve->composite[i]) product *= (unsigned long long)i;
+    }
+
+    return sieve;
+}
+
+void free_sieve(Sieve* sieve) {
+    if (!sieve) return;
+    free(sieve->composite);
+    free(sieve->block_product);
+    free(sieve);
+}
+
+// То же, что calculate_prime_product, но без пробных делений (x <= limit)
+long long sieve_prime_product(const Sieve* sieve, int x) {
+    if (x <= 2) return 1;
+    if (x > sieve->limit) return calculate_prime_product(x);
+
+    int start = x / SIEVE_BLOCK * SIEVE_BLOCK;
+    unsigned long long product = sieve->block_product[x / SIEVE_BLOCK];
+    for (int i = start; i < x; i++) {
+        if (!sieve->composite[i]) product *= (unsigned long long)i;
+    }
+    return (long long)product;
+}
+
+// Кэш простых чисел: битовое решето, отображенное в память (и, при желании, на диск).
+// Бит i установлен, если i простое. Решето расширяется только при запросе большей границы.
+#define PRIME_CACHE_MAGIC 0x4D525050u // "PPRM"
+#define PRIME_CACHE_HEADER 64
+
+typedef struct PrimeCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t limit;
+} PrimeCacheHeader;
+
+typedef struct PrimeCache {
+    int fd;                   // -1 для анонимного отображения
+    unsigned char* map;
+    size_t map_size;
+    PrimeCacheHeader* header;
+    uint64_t* bits;
+} PrimeCache;
+
+static size_t prime_cache_size(uint64_t limit) {
+    return PRIME_CACHE_HEADER + (size_t)(limit / 64 + 1) * sizeof(uint64_t);
+}
+
+static int prime_cache_map(PrimeCache* cache, size_t size) {
+    void* map;
+    if (cache->fd >= 0) {
+        if (ftruncate(cache->fd, (off_t)size) != 0) return 0;
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, cache->fd, 0);
+    }
+    else {
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if (map == MAP_FAILED) return 0;
+
+    if (cache->map) {
+        // Анонимное отображение нельзя просто продлить - переносим содержимое
+        if (cache->fd < 0) memcpy(map, cache->map, cache->map_size);
+        munmap(cache->map, cache->map_size);
+    }
+
+    cache->map = map;
+    cache->map_size = size;
+    cache->header = (PrimeCacheHeader*)map;
+    cache->bits = (uint64_t*)(cache->map + PRIME_CACHE_HEADER);
+    return 1;
+}
+
+static inline int prime_bit(const PrimeCache* cache, uint64_t n) {
+    return (int)((cache->bits[n / 64] >> (n % 64)) & 1);
+}
+
+static inline void clear_prime_bit(PrimeCache* cache, uint64_t n) {
+    cache->bits[n / 64] &= ~(1ULL << (n % 64));
+}
+
+PrimeCache* open_prime_cache(const char* path) {
+    PrimeCache* cache = calloc(1, sizeof(PrimeCache));
+    cache->fd = -1;
+
+    size_t size = prime_cache_size(63);
+    if (path) {
+        cache->fd = open(path, O_RDWR | O_CREAT, 0644);
+        if (cache->fd < 0) {
+            free(cache);
+            return NULL;
+        }
+
+        struct stat st;
+        if (fstat(cache->fd, &st) == 0 && (size_t)st.st_size > size) {
+            size = (size_t)st.st_size;
+        }
+    }
+
+    if (!prime_cache_map(cache, size)) {
+        if (cache->fd >= 0) close(cache->fd);
+        free(cache);
+        return NULL;
+    }
+
+    PrimeCacheHeader* h = cache->header;
+    if (h->magic != PRIME_CACHE_MAGIC || h->version != 1 ||
+        prime_cache_size(h->limit) > cache->map_size) {
+        // Новый или поврежденный файл - начинаем с пустого решета
+        h->magic = PRIME_CACHE_MAGIC;
+        h->version = 1;
+        h->limit = 1;
+        cache->bits[0] = 0;
+    }
+
+    return cache;
+}
+
+void close_prime_cache(PrimeCache* cache) {
+    if (!cache) return;
+    if (cache->fd >= 0) {
+        msync(cache->map, cache->map_size, MS_SYNC);
+        close(cache->fd);
+    }
+    munmap(cache->map, cache->map_size);
+    free(cache);
+}
+
+// Досеивает решето до limit включительно (сегмент [старая граница + 1, limit])
+int extend_prime_cache(PrimeCache* cache, uint64_t limit) {
+    uint64_t old_limit = cache->header->limit;
+    if (limit <= old_limit) return 1;
+
+    // Растем геометрически, чтобы серия возрастающих запросов стоила O(x)
+    if (limit < old_limit * 2) limit = old_limit * 2;
+    limit = limit | 63;
+
+    uint64_t root = (uint64_t)sqrtl((long double)limit);
+    while (root * root > limit) root--;
+    while ((root + 1) * (root + 1) <= limit) root++;
+
+    if (prime_cache_size(limit) > cache->map_size &&
+        !prime_cache_map(cache, prime_cache_size(limit))) {
+        return 0;
+    }
+
+    uint64_t lo = old_limit + 1;
+    for (uint64_t i = lo; i <= limit && i % 64 != 0; i++) {
+        cache->bits[i / 64] |= 1ULL << (i % 64);
+    }
+    uint64_t first_word = (lo + 63) / 64;
+    memset(&cache->bits[first_word], 0xFF, (size_t)(limit / 64 + 1 - first_word) * sizeof(uint64_t));
+    if (lo <= 1) {
+        clear_prime_bit(cache, 0);
+        clear_prime_bit(cache, 1);
+    }
+
+    // Простые p <= root из нового сегмента к моменту проверки уже отсеяны меньшими
+    for (uint64_t p = 2; p <= root; p++) {
+        if (!prime_bit(cache, p)) continue;
+        uint64_t start = p * p;
+        if (start < lo) start = (lo + p - 1) / p * p;
+        for (uint64_t j = start; j <= limit; j += p) {
+            clear_prime_bit(cache, j);
+        }
+    }
+
+    cache->header->limit = limit;
+    return 1;
+}
+
+int cached_is_prime(PrimeCache* cache, uint64_t n) {
+    if (!extend_prime_cache(cache, n)) return -1;
+    return prime_bit(cache, n);
+}
+
+// pi(x) - количество простых, не превосходящих x
+uint64_t prime_count(PrimeCache* cache, uint64_t x) {
+    if (x < 2 || !extend_prime_cache(cache, x)) return 0;
+
+    uint64_t count = 0;
+    uint64_t words = x / 64;
+    for (uint64_t i = 0; i < words; i++) {
+        count += (uint64_t)__builtin_popcountll(cache->bits[i]);
+    }
+    uint64_t tail_mask = (x % 64 == 63) ? ~0ULL : ((1ULL << (x % 64 + 1)) - 1);
+    count += (uint64_t)__builtin_popcountll(cache->bits[words] & tail_mask);
+    return count;
+}
+
+// Сумма и произведение (по модулю 2^64, как в calculate_prime_product) простых из [a, b)
+static void prime_range_fold(PrimeCache* cache, uint64_t a, uint64_t b,
+    unsigned long long* sum, unsigned long long* product) {
+    *sum = 0;
+    *product = 1;
+    if (b <= a || b <= 2 || !extend_prime_cache(cache, b - 1)) return;
+
+    for (uint64_t w = a / 64; w <= (b - 1) / 64; w++) {
+        uint64_t word = cache->bits[w];
+        while (word) {
+            uint64_t n = w * 64 + (uint64_t)__builtin_ctzll(word);
+            word &= word - 1;
+            if (n < a) continue;
+            if (n >= b) break;
+            *sum += n;
+            *product *= n;
+        }
+    }
+}
+
+unsigned long long prime_sum_range(PrimeCache* cache, uint64_t a, uint64_t b) {
+    unsigned long long sum, product;
+    prime_range_fold(cache, a, b, &sum, &product);
+    return sum;
+}
+
+long long prime_product_range(PrimeCache* cache, uint64_t a, uint64_t b) {
+    unsigned long long sum, product;
+    prime_range_fold(cache, a, b, &sum, &product);
+    return (long long)product;
+}
+
+// Только номер выжившего, без построения списка: J(n) = (J(n-1) + k) mod n
+int josephus_survivor(int n, int k, int forward) {
+    if (n <= 0 || k <= 0) return -1;
+
+    long long pos = 0;
+    for (int m = 2; m <= n; m++) {
+        pos = (pos + k) % m;
+    }
+
+    int survivor = (int)pos + 1;
+    // Обход назад зеркален обходу вперед: узел i соответствует узлу n + 1 - i
+    return forward ? survivor : n + 1 - survivor;
+}
+
+// Буферизованный вывод порядка выбывания
+#define OUT_BUFFER_SIZE (1 << 16)
+
+typedef enum { OUT_TEXT, OUT_BINARY, OUT_VARINT } OutputFormat;
+
+typedef struct EliminationWriter {
+    FILE* file;
+    OutputFormat format;
+    int every;          // писать только каждое every-е выбывание
+    long long from, to; // диапазон раундов [from, to), to = 0 - до конца
+    long long round;
+    int prev_value;     // для дельта-кодирования
+    size_t len;
+    unsigned char buffer[OUT_BUFFER_SIZE];
+} EliminationWriter;
+
+void init_writer(EliminationWriter* w, FILE* file, OutputFormat format) {
+    w->file = file;
+    w->format = format;
+    w->every = 1;
+    w->from = 0;
+    w->to = 0;
+    w->round = 0;
+    w->prev_value = 0;
+    w->len = 0;
+}
+
+void flush_writer(EliminationWriter* w) {
+    if (w->len > 0) fwrite(w->buffer, 1, w->len, w->file);
+    w->len = 0;
+    fflush(w->file);
+}
+
+static void write_value(EliminationWriter* w, int value) {
+    // В худшем случае 11 байт текста или 5 байт varint
+    if (w->len + 16 > OUT_BUFFER_SIZE) {
+        fwrite(w->buffer, 1, w->len, w->file);
+        w->len = 0;
+    }
+
+    unsigned char* out = w->buffer + w->len;
+
+    if (w->format == OUT_TEXT) {
+        char digits[12];
+        int count = 0;
+        unsigned v = (unsigned)value;
+        do {
+            digits[count++] = (char)('0' + v % 10);
+            v /= 10;
+        } while (v);
+        while (count) *out++ = (unsigned char)digits[--count];
+        *out++ = ' ';
+    }
+    else if (w->format == OUT_BINARY) {
+        uint32_t v = (uint32_t)value;
+        *out++ = (unsigned char)(v & 0xFF);
+        *out++ = (unsigned char)((v >> 8) & 0xFF);
+        *out++ = (unsigned char)((v >> 16) & 0xFF);
+        *out++ = (unsigned char)((v >> 24) & 0xFF);
+    }
+    else {
+        // Разность с предыдущим значением, zigzag + LEB128
+        int32_t delta = (int32_t)value - (int32_t)w->prev_value;
+        uint32_t v = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+        while (v >= 0x80) {
+            *out++ = (unsigned char)(v | 0x80);
+            v >>= 7;
+        }
+        *out++ = (unsigned char)v;
+        w->prev_value = value;
+    }
+
+    w->len = (size_t)(out - w->buffer);
+}
+
+void write_elimination(EliminationWriter* w, int value) {
+    long long round = w->round++;
+    if (round < w->from) return;
+    if (w->to > 0 && round >= w->to) return;
+    if ((round - w->from) % w->every != 0) return;
+    write_value(w, value);
+}
+
+int josephus_simulation_to(int n, int k, int forward, EliminationWriter* w) {
     Node* current = create_circular_list(n);
     if (!current) return -1;
 
-    printf("Elimination order: ");
+    int to_console = w->format == OUT_TEXT && w->file == stdout;
+    if (to_console) {
+        printf("Elimination order: ");
+        fflush(stdout);
+    }
 
     if (!forward) {
         current = current->prev;
@@ -69,7 +437,7 @@ int josephus_simulation(int n, int k, int forward) {
         }
 
         Node* to_remove = current;
-        printf("%d ", to_remove->value);
+        write_elimination(w, to_remove->value);
 
         to_remove->prev->next = to_remove->next;
         to_remove->next->prev = to_remove->prev;
@@ -81,7 +449,136 @@ int josephus_simulation(int n, int k, int forward) {
     int last_remaining = current->value;
     free(current);
 
-    printf("\nLast remaining: %d\n", last_remaining);
+    flush_writer(w);
+    if (to_console) printf("\n");
+    return last_remaining;
+}
+
+int josephus_simulation(int n, int k, int forward) {
+    EliminationWriter* w = malloc(sizeof(EliminationWriter));
+    init_writer(w, stdout, OUT_TEXT);
+    int last_remaining = josephus_simulation_to(n, k, forward, w);
+    free(w);
+
+    printf("Last remaining: %d\n", last_remaining);
+    return last_remaining;
+}
+
+// Обобщенная задача Иосифа: переменный шаг, смена направления, несколько жертв за раунд.
+// Живые позиции хранятся в дереве Фенвика, поиск k-го живого - O(log n).
+typedef enum { STEP_FIXED, STEP_LIST, STEP_LINEAR } StepKind;
+typedef enum { DIR_FORWARD, DIR_BACKWARD, DIR_ALTERNATE } DirectionMode;
+
+typedef struct StepSchedule {
+    StepKind kind;
+    long long a, b;  // STEP_FIXED: шаг a; STEP_LINEAR: шаг a + b * раунд
+    long long* steps; // STEP_LIST: шаги по кругу
+    int count;
+} StepSchedule;
+
+long long schedule_step(const StepSchedule* schedule, long long round) {
+    long long step;
+    switch (schedule->kind) {
+    case STEP_LIST: step = schedule->steps[round % schedule->count]; break;
+    case STEP_LINEAR: step = schedule->a + schedule->b * round; break;
+    default: step = schedule->a; break;
+    }
+    return step > 0 ? step : 1;
+}
+
+int load_step_schedule(const char* filename, StepSchedule* schedule) {
+    FILE* file = fopen(filename, "r");
+    if (!file) return 0;
+
+    int capacity = 64;
+    schedule->kind = STEP_LIST;
+    schedule->steps = malloc(sizeof(long long) * capacity);
+    schedule->count = 0;
+
+    long long step;
+    while (fscanf(file, "%lld", &step) == 1) {
+        if (step <= 0) continue;
+        if (schedule->count == capacity) {
+            capacity *= 2;
+            schedule->steps = realloc(schedule->steps, sizeof(long long) * capacity);
+        }
+        schedule->steps[schedule->count++] = step;
+    }
+    fclose(file);
+
+    if (schedule->count == 0) {
+        free(schedule->steps);
+        schedule->steps = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+typedef struct Fenwick {
+    int n;
+    int top; // старшая степень двойки <= n
+    int* tree;
+} Fenwick;
+
+static void fenwick_init_ones(Fenwick* f, int n) {
+    f->n = n;
+    f->tree = malloc(sizeof(int) * ((size_t)n + 1));
+    for (int i = 1; i <= n; i++) f->tree[i] = i & -i;
+    f->top = 1;
+    while (f->top * 2 <= n) f->top *= 2;
+}
+
+static void fenwick_remove(Fenwick* f, int pos) {
+    for (; pos <= f->n; pos += pos & -pos) f->tree[pos]--;
+}
+
+// Позиция k-го (с 1) живого элемента
+static int fenwick_find(const Fenwick* f, int k) {
+    int pos = 0;
+    for (int step = f->top; step; step >>= 1) {
+        if (pos + step <= f->n && f->tree[pos + step] < k) {
+            pos += step;
+            k -= f->tree[pos];
+        }
+    }
+    return pos + 1;
+}
+
+// Ранг current - номер (с 0) текущего узла среди живых, как указатель current в списке
+int josephus_variant(int n, const StepSchedule* schedule, DirectionMode direction,
+    int victims_per_round, EliminationWriter* w) {
+    if (n <= 0) return -1;
+    if (victims_per_round < 1) victims_per_round = 1;
+
+    Fenwick alive;
+    fenwick_init_ones(&alive, n);
+
+    long long alive_count = n;
+    long long current = direction == DIR_BACKWARD ? n - 1 : 0;
+
+    for (long long round = 0; alive_count > 1; round++) {
+        int forward = direction == DIR_FORWARD || (direction == DIR_ALTERNATE && round % 2 == 0);
+        long long step = schedule_step(schedule, round);
+
+        for (int v = 0; v < victims_per_round && alive_count > 1; v++) {
+            long long shift = (step - 1) % alive_count;
+            long long victim = forward ? (current + shift) % alive_count
+                : (current - shift + alive_count) % alive_count;
+
+            int pos = fenwick_find(&alive, (int)victim + 1);
+            write_elimination(w, pos);
+            fenwick_remove(&alive, pos);
+            alive_count--;
+
+            // Следующий узел в текущем направлении занимает ранг жертвы (или предыдущий)
+            current = forward ? victim % alive_count : (victim - 1 + alive_count) % alive_count;
+        }
+    }
+
+    int last_remaining = fenwick_find(&alive, 1);
+    free(alive.tree);
+
+    flush_writer(w);
     return last_remaining;
 }
 
@@ -96,11 +593,508 @@ int is_natural_number(const char* str) {
     return num > 0;
 }
 
+// Пакетный режим: много запросов "N k -f/-b" за один запуск
+typedef struct Query {
+    int n, k, forward;
+    int valid;
+    int survivor;
+    long long product;
+    int ready;
+} Query;
+
+#define MEMO_SIZE 4096
+
+typedef struct MemoEntry {
+    int n, k;
+    int survivor; // для прямого обхода
+    struct MemoEntry* next;
+} MemoEntry;
+
+typedef struct Batch {
+    Query* queries;
+    int count;
+    int next_query;
+    int done;
+    const Sieve* sieve;
+    MemoEntry* memo[MEMO_SIZE];
+    pthread_mutex_t lock;
+    pthread_cond_t ready_cond;
+} Batch;
+
+static unsigned memo_hash(int n, int k) {
+    return ((unsigned)n * 2654435761u ^ (unsigned)k * 40503u) % MEMO_SIZE;
+}
+
+static int memo_survivor(Batch* batch, int n, int k) {
+    unsigned h = memo_hash(n, k);
+
+    pthread_mutex_lock(&batch->lock);
+    for (MemoEntry* e = batch->memo[h]; e; e = e->next) {
+        if (e->n == n && e->k == k) {
+            int survivor = e->survivor;
+            pthread_mutex_unlock(&batch->lock);
+            return survivor;
+        }
+    }
+    pthread_mutex_unlock(&batch->lock);
+
+    int survivor = josephus_survivor(n, k, 1);
+
+    MemoEntry* e = malloc(sizeof(MemoEntry));
+    e->n = n;
+    e->k = k;
+    e->survivor = survivor;
+    pthread_mutex_lock(&batch->lock);
+    e->next = batch->memo[h];
+    batch->memo[h] = e;
+    pthread_mutex_unlock(&batch->lock);
+
+    return survivor;
+}
+
+static void* batch_worker(void* arg) {
+    Batch* batch = arg;
+
+    for (;;) {
+        pthread_mutex_lock(&batch->lock);
+        int idx = batch->next_query++;
+        pthread_mutex_unlock(&batch->lock);
+        if (idx >= batch->count) break;
+
+        Query* q = &batch->queries[idx];
+        if (q->valid) {
+            int survivor = memo_survivor(batch, q->n, q->k);
+            q->survivor = q->forward ? survivor : q->n + 1 - survivor;
+            q->product = sieve_prime_product(batch->sieve, q->survivor);
+        }
+
+        pthread_mutex_lock(&batch->lock);
+        q->ready = 1;
+        pthread_cond_broadcast(&batch->ready_cond);
+        pthread_mutex_unlock(&batch->lock);
+    }
+
+    return NULL;
+}
+
+static int parse_query(const char* line, Query* q) {
+    char n_str[32], k_str[32], flag[8];
+    memset(q, 0, sizeof(Query));
+
+    if (sscanf(line, "%31s %31s %7s", n_str, k_str, flag) != 3) return 0;
+    if (!is_natural_number(n_str) || !is_natural_number(k_str)) return 0;
+
+    q->n = atoi(n_str);
+    q->k = atoi(k_str);
+    if (q->k >= q->n) return 0;
+
+    if (strcmp(flag, "-f") == 0) q->forward = 1;
+    else if (strcmp(flag, "-b") == 0) q->forward = 0;
+    else return 0;
+
+    q->valid = 1;
+    return 1;
+}
+
+int batch_mode(FILE* in, int threads) {
+    int capacity = 1024;
+    Batch batch;
+    memset(&batch, 0, sizeof(Batch));
+    batch.queries = malloc(sizeof(Query) * capacity);
+
+    char line[256];
+    int max_n = 2;
+    while (fgets(line, sizeof(line), in)) {
+        char* start = line;
+        while (*start && isspace(*start)) start++;
+        if (!*start || *start == '#') continue;
+
+        if (batch.count == capacity) {
+            capacity *= 2;
+            batch.queries = realloc(batch.queries, sizeof(Query) * capacity);
+        }
+
+        Query* q = &batch.queries[batch.count++];
+        if (parse_query(start, q) && q->n > max_n) max_n = q->n;
+    }
+
+    Sieve* sieve = create_sieve(max_n);
+    batch.sieve = sieve;
+    pthread_mutex_init(&batch.lock, NULL);
+    pthread_cond_init(&batch.ready_cond, NULL);
+
+    if (threads < 1) threads = 1;
+    pthread_t* workers = malloc(sizeof(pthread_t) * threads);
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&workers[i], NULL, batch_worker, &batch);
+    }
+
+    // Результаты выводятся в порядке входа по мере готовности
+    for (int i = 0; i < batch.count; i++) {
+        Query* q = &batch.queries[i];
+
+        pthread_mutex_lock(&batch.lock);
+        while (!q->ready) pthread_cond_wait(&batch.ready_cond, &batch.lock);
+        pthread_mutex_unlock(&batch.lock);
+
+        if (q->valid) {
+            printf("%d %d %s %d %lld\n", q->n, q->k, q->forward ? "-f" : "-b",
+                q->survivor, q->product);
+        }
+        else {
+            printf("Error: invalid query #%d\n", i + 1);
+        }
+    }
+    fflush(stdout);
+
+    for (int i = 0; i < threads; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    for (int i = 0; i < MEMO_SIZE; i++) {
+        MemoEntry* e = batch.memo[i];
+        while (e) {
+            MemoEntry* next = e->next;
+            free(e);
+            e = next;
+        }
+    }
+
+    pthread_cond_destroy(&batch.ready_cond);
+    pthread_mutex_destroy(&batch.lock);
+    free(workers);
+    free_sieve(sieve);
+    free(batch.queries);
+    return 0;
+}
+
+int primes_mode(int argc, char* argv[]) {
+    const char* cache_path = NULL;
+    const char* args[3];
+    int count = 0;
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--prime-cache") == 0 && i + 1 < argc) cache_path = argv[++i];
+        else if (count < 3) args[count++] = argv[i];
+        else count++;
+    }
+
+    int needs_range = count >= 1 && (strcmp(args[0], "sum") == 0 || strcmp(args[0], "product") == 0);
+    if (count != (needs_range ? 3 : 2) ||
+        !isdigit(args[1][0]) || (needs_range && !isdigit(args[2][0]))) {
+        fprintf(stderr, "Error: expected pi <x> | isprime <x> | sum <a> <b> | product <a> <b>\n");
+        return 1;
+    }
+
+    PrimeCache* cache = open_prime_cache(cache_path);
+    if (!cache) {
+        fprintf(stderr, "Error: Cannot open prime cache %s\n", cache_path ? cache_path : "(memory)");
+        return 1;
+    }
+
+    uint64_t a = strtoull(args[1], NULL, 10);
+    uint64_t b = needs_range ? strtoull(args[2], NULL, 10) : 0;
+    int status = 0;
+
+    if (strcmp(args[0], "pi") == 0) {
+        printf("pi(%llu) = %llu\n", (unsigned long long)a, (unsigned long long)prime_count(cache, a));
+    }
+    else if (strcmp(args[0], "isprime") == 0) {
+        printf("%llu is %s\n", (unsigned long long)a, cached_is_prime(cache, a) == 1 ? "prime" : "not prime");
+    }
+    else if (strcmp(args[0], "sum") == 0) {
+        printf("Sum of primes in [%llu, %llu): %llu\n", (unsigned long long)a,
+            (unsigned long long)b, prime_sum_range(cache, a, b));
+    }
+    else if (strcmp(args[0], "product") == 0) {
+        printf("Product of primes in [%llu, %llu): %lld\n", (unsigned long long)a,
+            (unsigned long long)b, prime_product_range(cache, a, b));
+    }
+    else {
+        fprintf(stderr, "Error: Unknown prime query %s\n", args[0]);
+        status = 1;
+    }
+
+    close_prime_cache(cache);
+    return status;
+}
+
+// Бенчмарк движков задачи Иосифа и способов получения простых
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Счетчик промахов кэша через perf_event_open; -1, если недоступен
+static int open_cache_miss_counter() {
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    return -1;
+#endif
+}
+
+static void counter_start(int fd) {
+#ifdef __linux__
+    if (fd < 0) return;
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+#else
+    (void)fd;
+#endif
+}
+
+static long long counter_stop(int fd) {
+#ifdef __linux__
+    long long value;
+    if (fd < 0) return -1;
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(fd, &value, sizeof(value)) != sizeof(value)) return -1;
+    return value;
+#else
+    (void)fd;
+    return -1;
+#endif
+}
+
+typedef enum {
+    ENGINE_LIST,
+    ENGINE_FENWICK,
+    ENGINE_SURVIVOR,
+    ENGINE_TRIAL,
+    ENGINE_SIEVE,
+    ENGINE_CACHE
+} BenchEngine;
+
+// Результат одного замера, передается из дочернего процесса через pipe
+typedef struct {
+    double ns;
+    long long misses;
+    long long result;
+    long peak_kb;   // рост пикового RSS за время прогона; -1, если замер не удался
+} BenchRun;
+
+static long long run_engine(BenchEngine engine, int n, int k, EliminationWriter* writer, FILE* sink) {
+    switch (engine) {
+    case ENGINE_LIST:
+        init_writer(writer, sink, OUT_BINARY);
+        return josephus_simulation_to(n, k, 1, writer);
+    case ENGINE_FENWICK: {
+        StepSchedule schedule = { STEP_FIXED, k, 0, NULL, 0 };
+        init_writer(writer, sink, OUT_BINARY);
+        return josephus_variant(n, &schedule, DIR_FORWARD, 1, writer);
+    }
+    case ENGINE_SURVIVOR:
+        return josephus_survivor(n, k, 1);
+    case ENGINE_TRIAL:
+        return calculate_prime_product(n);
+    case ENGINE_SIEVE: {
+        Sieve* sieve = create_sieve(n);
+        long long product = sieve_prime_product(sieve, n);
+        free_sieve(sieve);
+        return product;
+    }
+    case ENGINE_CACHE: {
+        PrimeCache* cache = open_prime_cache(NULL);
+        long long product = cache ? prime_product_range(cache, 2, (uint64_t)n) : calculate_prime_product(n);
+        close_prime_cache(cache);
+        return product;
+    }
+    }
+    return 0;
+}
+
+// Каждый прогон идет в отдельном процессе: пиковый RSS ребенка начинается с размера
+// родителя на момент fork, поэтому разность ru_maxrss до и после прогона - это память,
+// которую потребовал сам движок. Память родителя движки не трогают и не засоряют
+static int bench_isolated(BenchEngine engine, int n, int k, EliminationWriter* writer, FILE* sink,
+    BenchRun* run) {
+    int fds[2];
+    if (pipe(fds) != 0) return -1;
+    fflush(NULL);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+
+    if (pid == 0) {
+        close(fds[0]);
+        BenchRun child;
+        struct rusage before, after;
+        int fd = open_cache_miss_counter();
+
+        getrusage(RUSAGE_SELF, &before);
+        counter_start(fd);
+        double t = now_ns();
+        child.result = run_engine(engine, n, k, writer, sink);
+        child.ns = now_ns() - t;
+        child.misses = counter_stop(fd);
+        getrusage(RUSAGE_SELF, &after);
+        child.peak_kb = after.ru_maxrss - before.ru_maxrss;
+
+        int ok = write(fds[1], &child, sizeof(child)) == (ssize_t)sizeof(child);
+        _exit(ok ? 0 : 1);
+    }
+
+    close(fds[1]);
+    ssize_t got = read(fds[0], run, sizeof(*run));
+    close(fds[0]);
+
+    int status;
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0 ||
+        got != (ssize_t)sizeof(*run)) {
+        return -1;
+    }
+    return 0;
+}
+
+static void print_bench_row(const char* name, int n, int k, long long ops, const BenchRun* run) {
+    char miss_str[32];
+    char peak_str[32];
+    if (run->misses >= 0) snprintf(miss_str, sizeof(miss_str), "%lld", run->misses);
+    else strcpy(miss_str, "n/a");
+    if (run->peak_kb >= 0) snprintf(peak_str, sizeof(peak_str), "%ld", run->peak_kb);
+    else strcpy(peak_str, "n/a");
+
+    printf("%-12s %10d %6d %12.2f %10.2f %14s %12s\n",
+        name, n, k, run->ns / 1e6, ops > 0 ? run->ns / ops : 0.0, miss_str, peak_str);
+}
+
+// Прогон движка с печатью строки; при сбое fork результат -1 и строка n/a
+static long long bench_row(const char* name, BenchEngine engine, int n, int k, long long ops,
+    EliminationWriter* writer, FILE* sink) {
+    BenchRun run;
+    if (bench_isolated(engine, n, k, writer, sink, &run) != 0) {
+        fprintf(stderr, "Error: Benchmark run %s failed\n", name);
+        BenchRun failed = { 0, -1, -1, -1 };
+        run = failed;
+    }
+    print_bench_row(name, n, k, ops, &run);
+    return run.result;
+}
+
+int bench_mode(int max_n) {
+    static const int ks[] = { 2, 10, 100 };
+    int fd = open_cache_miss_counter();
+    FILE* sink = fopen("/dev/null", "w");
+    if (!sink) {
+        fprintf(stderr, "Error: Cannot open /dev/null\n");
+        return 1;
+    }
+    if (fd >= 0) close(fd);
+
+    EliminationWriter* writer = malloc(sizeof(EliminationWriter));
+
+    printf("=== JOSEPHUS ENGINES ===\n");
+    printf("%-12s %10s %6s %12s %10s %14s %12s\n",
+        "engine", "N", "k", "total ms", "ns/elim", "cache misses", "peak KB");
+
+    for (int n = 1000; n <= max_n; n *= 10) {
+        for (size_t ki = 0; ki < sizeof(ks) / sizeof(ks[0]); ki++) {
+            int k = ks[ki];
+            if (k >= n) continue;
+
+            long long list_result = bench_row("linked-list", ENGINE_LIST, n, k, n - 1, writer, sink);
+            long long tree_result = bench_row("fenwick", ENGINE_FENWICK, n, k, n - 1, writer, sink);
+            long long survivor = bench_row("survivor", ENGINE_SURVIVOR, n, k, n - 1, writer, sink);
+
+            if (list_result != tree_result || list_result != survivor) {
+                fprintf(stderr, "Mismatch for N=%d k=%d: %lld %lld %lld\n",
+                    n, k, list_result, tree_result, survivor);
+            }
+        }
+    }
+
+    printf("\n=== PRIME PRODUCT UP TO X ===\n");
+    printf("%-12s %10s %6s %12s %10s %14s %12s\n",
+        "backend", "x", "", "total ms", "ns/number", "cache misses", "peak KB");
+
+    for (int x = 1000; x <= max_n; x *= 10) {
+        long long trial = bench_row("trial-div", ENGINE_TRIAL, x, 0, x, writer, sink);
+        long long sieved = bench_row("byte-sieve", ENGINE_SIEVE, x, 0, x, writer, sink);
+        long long cached = bench_row("bitset-cache", ENGINE_CACHE, x, 0, x, writer, sink);
+
+        if (trial != sieved || trial != cached) {
+            fprintf(stderr, "Mismatch for x=%d\n", x);
+        }
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_CHILDREN, &usage);
+    printf("\nPeak KB: growth of the peak RSS during one run (each run is a separate process)\n");
+    printf("Largest run peak RSS: %ld KB\n", usage.ru_maxrss);
+    if (fd < 0) printf("Cache miss counters unavailable (perf_event_open failed)\n");
+
+    free(writer);
+    fclose(sink);
+    return 0;
+}
+
 int main(int argc, char* argv[]) {
-    if (argc != 4) {
-        printf("Usage: %s <N> <k> <-f/-b>\n", argv[0]);
+    if (argc >= 2 && strcmp(argv[1], "--primes") == 0) {
+        return primes_mode(argc, argv);
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "--bench") == 0) {
+        int max_n = 100000;
+        if (argc >= 3) {
+            if (!is_natural_number(argv[2])) {
+                fprintf(stderr, "Error: max N must be a natural number\n");
+                return 1;
+            }
+            max_n = atoi(argv[2]);
+        }
+        return bench_mode(max_n);
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "--batch") == 0) {
+        FILE* in = stdin;
+        int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+        if (argc >= 3 && strcmp(argv[2], "-") != 0) {
+            in = fopen(argv[2], "r");
+            if (!in) {
+                fprintf(stderr, "Error: Cannot open file %s\n", argv[2]);
+                return 1;
+            }
+        }
+        if (argc >= 4) threads = atoi(argv[3]);
+
+        int status = batch_mode(in, threads);
+        if (in != stdin) fclose(in);
+        return status;
+    }
+
+    if (argc < 4) {
+        printf("Usage: %s <N> <k> <-f/-b> [options]\n", argv[0]);
+        printf("       %s --batch [file|-] [threads]\n", argv[0]);
+        printf("       %s --primes pi|isprime <x> | sum|product <a> <b> [--prime-cache <file>]\n", argv[0]);
+        printf("       %s --bench [max N]\n", argv[0]);
         printf("N, k - natural numbers, k < N\n");
         printf("Flags: -f for forward, -b for backward\n");
+        printf("Batch input: one \"N k -f/-b\" query per line\n");
+        printf("Options:\n");
+        printf("  --format text|bin|varint  elimination order format (bin: LE uint32)\n");
+        printf("  --out <file>              write elimination order to file\n");
+        printf("  --every <m>               write only every m-th elimination\n");
+        printf("  --rounds <a>:<b>          write only rounds a..b-1 (0-based)\n");
+        printf("  --prime-cache <file>      persistent sieve for the prime product\n");
+        printf("  --steps <file>            per-round steps (cycled), overrides k\n");
+        printf("  --step-fn <a>,<b>         step of round r is a + b*r\n");
+        printf("  --alternate               alternate direction every round\n");
+        printf("  --victims <v>             eliminate v victims per round\n");
         return 1;
     }
 
@@ -130,13 +1124,125 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
+    OutputFormat format = OUT_TEXT;
+    const char* out_path = NULL;
+    const char* cache_path = NULL;
+    StepSchedule schedule = { STEP_FIXED, k, 0, NULL, 0 };
+    int alternate = 0;
+    int victims = 1;
+    int use_variant = 0;
+    int every = 1;
+    long long from = 0, to = 0;
+
+    for (int i = 4; i < argc; i++) {
+        if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            const char* name = argv[++i];
+            if (strcmp(name, "text") == 0) format = OUT_TEXT;
+            else if (strcmp(name, "bin") == 0) format = OUT_BINARY;
+            else if (strcmp(name, "varint") == 0) format = OUT_VARINT;
+            else {
+                fprintf(stderr, "Error: Unknown format %s\n", name);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            out_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--prime-cache") == 0 && i + 1 < argc) {
+            cache_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--steps") == 0 && i + 1 < argc) {
+            if (!load_step_schedule(argv[++i], &schedule)) {
+                fprintf(stderr, "Error: Cannot read steps from %s\n", argv[i]);
+                return 1;
+            }
+            use_variant = 1;
+        }
+        else if (strcmp(argv[i], "--step-fn") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%lld,%lld", &schedule.a, &schedule.b) != 2 || schedule.a <= 0 || schedule.b < 0) {
+                fprintf(stderr, "Error: --step-fn expects a,b with a > 0, b >= 0\n");
+                return 1;
+            }
+            schedule.kind = STEP_LINEAR;
+            use_variant = 1;
+        }
+        else if (strcmp(argv[i], "--alternate") == 0) {
+            alternate = 1;
+            use_variant = 1;
+        }
+        else if (strcmp(argv[i], "--victims") == 0 && i + 1 < argc) {
+            if (!is_natural_number(argv[i + 1])) {
+                fprintf(stderr, "Error: --victims must be a natural number\n");
+                return 1;
+            }
+            victims = atoi(argv[++i]);
+            use_variant = 1;
+        }
+        else if (strcmp(argv[i], "--every") == 0 && i + 1 < argc) {
+            if (!is_natural_number(argv[i + 1])) {
+                fprintf(stderr, "Error: --every must be a natural number\n");
+                return 1;
+            }
+            every = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--rounds") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%lld:%lld", &from, &to) != 2 || from < 0 || to <= from) {
+                fprintf(stderr, "Error: --rounds expects a:b with 0 <= a < b\n");
+                return 1;
+            }
+        }
+        else {
+            fprintf(stderr, "Error: Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if (format != OUT_TEXT && !out_path) {
+        fprintf(stderr, "Error: binary formats require --out <file>\n");
+        return 1;
+    }
+
+    FILE* out = stdout;
+    if (out_path) {
+        out = fopen(out_path, format == OUT_TEXT ? "w" : "wb");
+        if (!out) {
+            fprintf(stderr, "Error: Cannot open file %s\n", out_path);
+            return 1;
+        }
+    }
+
     printf("Josephus problem: N=%d, k=%d, direction=%s\n",
-        N, k, forward ? "forward" : "backward");
+        N, k, alternate ? "alternating" : (forward ? "forward" : "backward"));
+
+    EliminationWriter* writer = malloc(sizeof(EliminationWriter));
+    init_writer(writer, out, format);
+    writer->every = every;
+    writer->from = from;
+    writer->to = to;
+
+    int last_remaining;
+    if (use_variant) {
+        DirectionMode direction = alternate ? DIR_ALTERNATE : (forward ? DIR_FORWARD : DIR_BACKWARD);
+        int to_console = format == OUT_TEXT && out == stdout;
+
+        if (to_console) printf("Elimination order: ");
+        last_remaining = josephus_variant(N, &schedule, direction, victims, writer);
+        if (to_console) printf("\n");
+        free(schedule.steps);
+    }
+    else {
+        last_remaining = josephus_simulation_to(N, k, forward, writer);
+    }
+    printf("Last remaining: %d\n", last_remaining);
 
-    int last_remaining = josephus_simulation(N, k, forward);
+    free(writer);
+    if (out != stdout) fclose(out);
 
     if (last_remaining != -1) {
-        long long prime_product = calculate_prime_product(last_remaining);
+        PrimeCache* cache = open_prime_cache(cache_path);
+        long long prime_product = cache ? prime_product_range(cache, 2, (uint64_t)last_remaining)
+            : calculate_prime_product(last_remaining);
+        close_prime_cache(cache);
         printf("Product of primes less than %d: %lld\n", last_remaining, prime_product);
     }
 
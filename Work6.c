@@ -2,70 +2,69 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
+#include <errno.h>
+#include <stdint.h>
 #include <math.h>
-
-#define MAX_EXPR_LENGTH 256
-
-// Структура для стека
-typedef struct StackNode {
-    char data[MAX_EXPR_LENGTH];
-    struct StackNode* next;
-} StackNode;
-
-typedef struct {
-    StackNode* top;
-} Stack;
-
-// Базовые операции со стеком
-Stack* create_stack() {
-    Stack* stack = malloc(sizeof(Stack));
-    stack->top = NULL;
-    return stack;
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// Счетчик выделений памяти для --bench. Через counted_* идут выделения, достижимые из
+// измеряемых стадий (длинные числа: лексемы BigNum и арифметика --big); у каждого потока
+// свой счетчик, поэтому --parallel не делит его между потоками
+static _Thread_local long alloc_count = 0;
+
+static void* counted_malloc(size_t size) {
+    alloc_count++;
+    return malloc(size);
 }
 
-int is_empty(Stack* stack) {
-    return stack->top == NULL;
+static void* counted_calloc(size_t count, size_t size) {
+    alloc_count++;
+    return calloc(count, size);
 }
 
-void push(Stack* stack, const char* data) {
-    StackNode* new_node = malloc(sizeof(StackNode));
-    strcpy(new_node->data, data);
-    new_node->next = stack->top;
-    stack->top = new_node;
+static char* counted_strdup(const char* text) {
+    alloc_count++;
+    return strdup(text);
 }
 
-char* pop(Stack* stack) {
-    if (is_empty(stack)) return NULL;
-
-    StackNode* temp = stack->top;
-    char* data = malloc(strlen(temp->data) + 1);
-    strcpy(data, temp->data);
-
-    stack->top = temp->next;
-    free(temp);
+#define MAX_EXPR_LENGTH 256
 
-    return data;
-}
+#define MAX_TOKENS MAX_EXPR_LENGTH // каждая лексема занимает хотя бы один символ
 
-char* peek(Stack* stack) {
-    if (is_empty(stack)) return NULL;
-    return stack->top->data;
-}
+// Лексемы: код операции и значение для чисел
+typedef enum {
+    OP_NUM,
+    OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_MOD, OP_POW,
+    OP_NEG, // унарный минус, в RPN записывается как ~
+    OP_LPAREN, OP_RPAREN,
+    OP_VAR,  // переменная: value - номер слота
+    OP_FNUM, // дробная константа (только режим CSV): value - биты double
+    OP_BIGNUM// число больше int64 (только ARITH_BIG): value - указатель на BigNum,
+             // которым владеет код; освобождается free_code
+} OpCode;
 
-void free_stack(Stack* stack) {
-    while (!is_empty(stack)) {
-        char* data = pop(stack);
-        free(data);
-    }
-    free(stack);
-}
+typedef struct {
+    OpCode op;
+    int pos;         // позиция в исходном тексте, -1 - нет
+    long long value;
+} Token;
 
 // Функции для работы с выражениями
-int get_priority(char op) {
+int get_priority(OpCode op) {
     switch (op) {
-    case '+': case '-': return 1;
-    case '*': case '/': case '%': return 2;
-    case '^': return 3;
+    case OP_ADD: case OP_SUB: return 1;
+    case OP_MUL: case OP_DIV: case OP_MOD: return 2;
+    case OP_NEG: return 3;
+    case OP_POW: return 4;
     default: return 0;
     }
 }
@@ -74,6 +73,12 @@ int is_operator(char c) {
     return c == '+' || c == '-' || c == '*' || c == '/' || c == '%' || c == '^';
 }
 
+static const char op_symbols[] = { 0, '+', '-', '*', '/', '%', '^', '~', '(', ')', '$', '.', '#' };
+
+static int is_operand(OpCode op) {
+    return op == OP_NUM || op == OP_VAR || op == OP_FNUM || op == OP_BIGNUM;
+}
+
 int check_balance(const char* expr) {
     int balance = 0;
 
@@ -90,360 +95,3234 @@ int check_balance(const char* expr) {
     return balance == 0;
 }
 
-// Преобразование в обратную польскую запись
-int infix_to_postfix(const char* infix, char* postfix) {
-    if (!check_balance(infix)) {
-        return 0;
+// Позиция непарной скобки: первой лишней ')' или первой незакрытой '('; -1 - баланс есть
+int unbalanced_position(const char* expr) {
+    int balance = 0;
+    int len = 0;
+    for (; expr[len] != '\0'; len++) {
+        if (expr[len] == '(') balance++;
+        else if (expr[len] == ')' && --balance < 0) return len;
+    }
+    if (balance == 0) return -1;
+
+    // Справа налево: '(' без ')' после нее не закрыта
+    int pos = -1;
+    int closing = 0;
+    for (int i = len - 1; i >= 0; i--) {
+        if (expr[i] == ')') closing++;
+        else if (expr[i] == '(') {
+            if (closing > 0) closing--;
+            else pos = i;
+        }
     }
+    return pos;
+}
 
-    Stack* stack = create_stack();
-    char output[MAX_EXPR_LENGTH * 2] = "";
-    int output_len = 0;
+// Таблица переменных: имя -> номер слота (открытая адресация по хешу имени).
+// Слоты выдаются по порядку, значения хранит исполнитель в массиве по номеру слота
+typedef struct {
+    char** names;  // имя по номеру слота
+    int count;
+    int* table;    // номера слотов, -1 - пусто
+    int table_capacity;
+} VarTable;
+
+void vars_init(VarTable* vars) {
+    vars->names = NULL;
+    vars->count = 0;
+    vars->table_capacity = 64;
+    vars->table = malloc(sizeof(int) * vars->table_capacity);
+    for (int i = 0; i < vars->table_capacity; i++) vars->table[i] = -1;
+}
 
-    for (int i = 0; infix[i] != '\0'; i++) {
-        if (isspace(infix[i])) continue;
+void vars_free(VarTable* vars) {
+    for (int i = 0; i < vars->count; i++) free(vars->names[i]);
+    free(vars->names);
+    free(vars->table);
+}
 
-        // Число
-        if (isdigit(infix[i])) {
-            while (isdigit(infix[i])) {
-                output[output_len++] = infix[i++];
-            }
-            output[output_len++] = ' ';
-            i--;
-        }
-        // Открывающая скобка
-        else if (infix[i] == '(') {
-            push(stack, "(");
+static unsigned hash_name(const char* name, int len) {
+    unsigned hash = 2166136261u;
+    for (int i = 0; i < len; i++) hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+    return hash;
+}
+
+static int* vars_bucket(const VarTable* vars, const char* name, int len) {
+    int mask = vars->table_capacity - 1;
+    int pos = hash_name(name, len) & mask;
+    while (vars->table[pos] >= 0) {
+        const char* other = vars->names[vars->table[pos]];
+        if ((int)strlen(other) == len && memcmp(other, name, len) == 0) break;
+        pos = (pos + 1) & mask;
+    }
+    return &vars->table[pos];
+}
+
+// Номер слота или -1
+int vars_find(const VarTable* vars, const char* name, int len) {
+    return *vars_bucket(vars, name, len);
+}
+
+// Номер слота; новая переменная получает следующий слот
+int vars_intern(VarTable* vars, const char* name, int len) {
+    int* bucket = vars_bucket(vars, name, len);
+    if (*bucket >= 0) return *bucket;
+
+    if (2 * (vars->count + 1) > vars->table_capacity) {
+        free(vars->table);
+        vars->table_capacity *= 2;
+        vars->table = malloc(sizeof(int) * vars->table_capacity);
+        for (int i = 0; i < vars->table_capacity; i++) vars->table[i] = -1;
+        for (int slot = 0; slot < vars->count; slot++) {
+            *vars_bucket(vars, vars->names[slot], strlen(vars->names[slot])) = slot;
         }
-        // Закрывающая скобка
-        else if (infix[i] == ')') {
-            while (!is_empty(stack) && strcmp(peek(stack), "(") != 0) {
-                char* op = pop(stack);
-                strcat(output, op);
-                strcat(output, " ");
-                free(op);
-            }
-            if (is_empty(stack)) {
-                free_stack(stack);
-                return 0;
+        bucket = vars_bucket(vars, name, len);
+    }
+
+    vars->names = realloc(vars->names, sizeof(char*) * (vars->count + 1));
+    vars->names[vars->count] = strndup(name, len);
+    *bucket = vars->count;
+    return vars->count++;
+}
+
+static int is_name_start(char c) {
+    return isalpha((unsigned char)c) || c == '_';
+}
+
+static int is_name_char(char c) {
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+// Режим арифметики: проверяемый int64 (по умолчанию), по модулю или длинная
+typedef enum { ARITH_CHECKED, ARITH_MOD, ARITH_BIG } ArithMode;
+
+ArithMode arith_mode = ARITH_CHECKED;
+long long arith_modulus = 0; // для ARITH_MOD, не меньше 2
+
+#define TOKENIZE_ERROR -1
+#define TOKENIZE_UNDEFINED -2 // имя, которого нет в таблице переменных
+
+// Длинные константы (определены у длинных целых)
+static int big_literal(const char* digits, int len, long long* value);
+void free_code(Token* code, int count);
+
+// Разбор строки в массив лексем; '-' всегда OP_SUB (унарность решает to_postfix),
+// '~' - OP_NEG. Имена переменных сразу заменяются номерами слотов из vars (без vars
+// имена недопустимы). С allow_fraction числа с точкой дают OP_FNUM, в ARITH_BIG числа
+// больше int64 - OP_BIGNUM (при ошибке они освобождаются). Возвращает число
+// лексем, TOKENIZE_ERROR (неизвестный символ, переполнение числа, больше capacity
+// лексем) или TOKENIZE_UNDEFINED; при ошибке в error_pos (если не NULL) - ее позиция
+int tokenize_ex(const char* expr, Token* tokens, int capacity, const VarTable* vars, int allow_fraction,
+    int* error_pos) {
+    int count = 0;
+    int error = TOKENIZE_ERROR;
+    const char* p;
+
+    for (p = expr; *p; p++) {
+        if (isspace((unsigned char)*p)) continue;
+        if (count == capacity) goto fail;
+
+        Token* t = &tokens[count++];
+        t->op = OP_NUM;
+        t->pos = p - expr;
+        t->value = 0;
+
+        if (is_name_start(*p)) {
+            if (!vars) goto fail;
+            const char* name = p;
+            while (is_name_char(p[1])) p++;
+            int slot = vars_find(vars, name, p - name + 1);
+            if (slot < 0) {
+                error = TOKENIZE_UNDEFINED;
+                p = name;
+                goto fail;
             }
-            char* temp = pop(stack);
-            free(temp);
+            t->op = OP_VAR;
+            t->value = slot;
+            continue;
         }
-        // Оператор
-        else if (is_operator(infix[i])) {
-            char op_str[2] = { infix[i], '\0' };
 
-            // Обработка унарного минуса
-            if (infix[i] == '-' && (i == 0 || infix[i - 1] == '(' || is_operator(infix[i - 1]))) {
-                push(stack, "~");
+        if (allow_fraction && isdigit((unsigned char)*p)) {
+            const char* q = p;
+            while (isdigit((unsigned char)*q)) q++;
+            if (*q == '.' || *q == 'e' || *q == 'E' || q - p > 18) {
+                char* end;
+                double value = strtod(p, &end);
+                t->op = OP_FNUM;
+                memcpy(&t->value, &value, sizeof(double));
+                p = end - 1;
                 continue;
             }
+        }
 
-            while (!is_empty(stack) &&
-                get_priority(peek(stack)[0]) >= get_priority(infix[i]) &&
-                infix[i] != '^') {
-                char* op = pop(stack);
-                strcat(output, op);
-                strcat(output, " ");
-                free(op);
+        if (isdigit((unsigned char)*p)) {
+            t->op = OP_NUM;
+            while (isdigit((unsigned char)*p)) {
+                if (__builtin_mul_overflow(t->value, 10, &t->value) ||
+                    __builtin_add_overflow(t->value, *p - '0', &t->value)) {
+                    const char* digits = expr + t->pos;
+                    int len = 0;
+                    while (isdigit((unsigned char)digits[len])) len++;
+                    if (arith_mode != ARITH_BIG || !big_literal(digits, len, &t->value)) {
+                        p = digits;
+                        goto fail;
+                    }
+                    t->op = OP_BIGNUM;
+                    p = digits + len;
+                    break;
+                }
+                p++;
             }
-            push(stack, op_str);
+            p--;
+            continue;
         }
-    }
 
-    // Выталкиваем оставшиеся операторы
-    while (!is_empty(stack)) {
-        char* op = pop(stack);
-        if (strcmp(op, "(") == 0) {
-            free(op);
-            free_stack(stack);
-            return 0;
+        switch (*p) {
+        case '+': t->op = OP_ADD; break;
+        case '-': t->op = OP_SUB; break;
+        case '*': t->op = OP_MUL; break;
+        case '/': t->op = OP_DIV; break;
+        case '%': t->op = OP_MOD; break;
+        case '^': t->op = OP_POW; break;
+        case '~': t->op = OP_NEG; break;
+        case '(': t->op = OP_LPAREN; break;
+        case ')': t->op = OP_RPAREN; break;
+        default: goto fail;
         }
-        strcat(output, op);
-        strcat(output, " ");
-        free(op);
     }
 
-    strcpy(postfix, output);
-    free_stack(stack);
-    return 1;
-}
+    return count;
 
-// Вычисление выражения в RPN
-int evaluate_postfix(const char* postfix, long long* result) {
-    Stack* stack = create_stack();
-    char token[50];
-    const char* ptr = postfix;
+fail:
+    if (error_pos) *error_pos = p - expr;
+    free_code(tokens, count);
+    return error;
+}
 
-    while (*ptr != '\0') {
-        while (*ptr && isspace(*ptr)) ptr++;
-        if (!*ptr) break;
+int tokenize(const char* expr, Token* tokens, int capacity, const VarTable* vars) {
+    return tokenize_ex(expr, tokens, capacity, vars, 0, NULL);
+}
 
-        int i = 0;
-        while (*ptr && !isspace(*ptr)) {
-            token[i++] = *ptr++;
+// Сортировочная станция над массивом лексем с фиксированным стеком операций.
+// '-' в позиции операнда становится унарным; ^ и унарный минус правоассоциативны.
+// Возвращает длину postfix или -1 при несогласованных скобках
+int tokens_to_postfix(const Token* infix, int count, Token* postfix) {
+    Token ops[MAX_TOKENS]; // операции вместе с их позициями
+    int top = 0, out = 0;
+    int expect_operand = 1;
+
+    for (int i = 0; i < count; i++) {
+        OpCode op = infix[i].op;
+
+        // Число или переменная
+        if (is_operand(op)) {
+            postfix[out++] = infix[i];
+            expect_operand = 0;
         }
-        token[i] = '\0';
-
-        if (strlen(token) == 0) continue;
-
-        // Число
-        if (isdigit(token[0]) || (token[0] == '-' && isdigit(token[1]))) {
-            push(stack, token);
+        // Открывающая скобка
+        else if (op == OP_LPAREN) {
+            ops[top++] = infix[i];
+            expect_operand = 1;
         }
-        // Унарный минус
-        else if (strcmp(token, "~") == 0) {
-            if (is_empty(stack)) {
-                free_stack(stack);
-                return 0;
-            }
-            char* num_str = pop(stack);
-            long long num = atoll(num_str);
-            char result_str[50];
-            sprintf(result_str, "%lld", -num);
-            push(stack, result_str);
-            free(num_str);
+        // Закрывающая скобка
+        else if (op == OP_RPAREN) {
+            while (top > 0 && ops[top - 1].op != OP_LPAREN) postfix[out++] = ops[--top];
+            if (top == 0) return -1;
+            top--;
+            expect_operand = 0;
+        }
+        // Унарный минус: префиксный оператор ничего не выталкивает
+        else if (op == OP_NEG || (op == OP_SUB && expect_operand)) {
+            ops[top] = infix[i];
+            ops[top++].op = OP_NEG;
         }
         // Бинарный оператор
-        else if (is_operator(token[0])) {
-            if (is_empty(stack)) {
-                free_stack(stack);
-                return 0;
-            }
-            char* right_str = pop(stack);
-            if (is_empty(stack)) {
-                free(right_str);
-                free_stack(stack);
-                return 0;
+        else {
+            int priority = get_priority(op);
+            while (top > 0 && ops[top - 1].op != OP_LPAREN &&
+                (get_priority(ops[top - 1].op) > priority ||
+                    (get_priority(ops[top - 1].op) == priority && op != OP_POW))) {
+                postfix[out++] = ops[--top];
             }
-            char* left_str = pop(stack);
+            ops[top++] = infix[i];
+            expect_operand = 1;
+        }
+    }
 
-            long long left = atoll(left_str);
-            long long right = atoll(right_str);
-            long long res;
+    // Выталкиваем оставшиеся операторы
+    while (top > 0) {
+        if (ops[top - 1].op == OP_LPAREN) return -1;
+        postfix[out++] = ops[--top];
+    }
 
-            switch (token[0]) {
-            case '+': res = left + right; break;
-            case '-': res = left - right; break;
-            case '*': res = left * right; break;
-            case '/':
-                if (right == 0) {
-                    free(left_str);
-                    free(right_str);
-                    free_stack(stack);
-                    return 0;
-                }
-                res = left / right;
-                break;
-            case '%':
-                if (right == 0) {
-                    free(left_str);
-                    free(right_str);
-                    free_stack(stack);
-                    return 0;
-                }
-                res = left % right;
-                break;
-            case '^':
-                if (right < 0) {
-                    free(left_str);
-                    free(right_str);
-                    free_stack(stack);
-                    return 0;
-                }
-                res = 1;
-                for (int i = 0; i < right; i++) res *= left;
-                break;
-            default:
-                free(left_str);
-                free(right_str);
-                free_stack(stack);
-                return 0;
-            }
+    return out;
+}
 
-            char result_str[50];
-            sprintf(result_str, "%lld", res);
-            push(stack, result_str);
+typedef enum {
+    EVAL_OK,
+    EVAL_INVALID,       // некорректная RPN
+    EVAL_DIV_ZERO,
+    EVAL_NEG_POWER,
+    EVAL_OVERFLOW,      // выход за int64 в ARITH_CHECKED
+    EVAL_NOT_INVERTIBLE,// деление по модулю на необратимый элемент
+    EVAL_TOO_LARGE,     // длинный результат больше BIG_MAX_BITS
+    EVAL_UNBALANCED,    // непарная скобка (разбор Пратта)
+    EVAL_TOO_DEEP,      // вложенность больше PRATT_MAX_DEPTH
+    EVAL_NO_REMAINDER   // % над вычетами в ARITH_MOD
+} EvalStatus;
+
+const char* eval_error_message(EvalStatus status) {
+    switch (status) {
+    case EVAL_DIV_ZERO: return "Division by zero";
+    case EVAL_NEG_POWER: return "Negative exponent";
+    case EVAL_OVERFLOW: return "Integer overflow";
+    case EVAL_NOT_INVERTIBLE: return "Divisor is not invertible modulo N";
+    case EVAL_TOO_LARGE: return "Result too large";
+    case EVAL_UNBALANCED: return "Unbalanced parentheses";
+    case EVAL_TOO_DEEP: return "Expression nested too deeply";
+    case EVAL_NO_REMAINDER: return "Remainder is not defined modulo N";
+    default: return "Invalid expression";
+    }
+}
 
-            free(left_str);
-            free(right_str);
-        }
+// Код ошибки для машиночитаемого отчета
+const char* eval_error_code(EvalStatus status) {
+    switch (status) {
+    case EVAL_DIV_ZERO: return "division_by_zero";
+    case EVAL_NEG_POWER: return "negative_exponent";
+    case EVAL_OVERFLOW: return "overflow";
+    case EVAL_NOT_INVERTIBLE: return "not_invertible";
+    case EVAL_TOO_LARGE: return "too_large";
+    case EVAL_UNBALANCED: return "unbalanced_parentheses";
+    case EVAL_TOO_DEEP: return "too_deep";
+    case EVAL_NO_REMAINDER: return "remainder_undefined";
+    default: return "invalid_expression";
     }
+}
 
-    if (is_empty(stack)) {
-        free_stack(stack);
-        return 0;
+// Возведение в степень квадрированием с проверкой переполнения
+static EvalStatus power_checked(long long base, long long exp, long long* res) {
+    if (exp < 0) return EVAL_NEG_POWER;
+    // 0, 1 и -1 не переполняются при любой степени
+    if (base == 0 || base == 1) {
+        *res = exp == 0 ? 1 : base;
+        return EVAL_OK;
+    }
+    if (base == -1) {
+        *res = exp & 1 ? -1 : 1;
+        return EVAL_OK;
     }
 
-    char* result_str = pop(stack);
-    *result = atoll(result_str);
-    free(result_str);
+    long long result = 1;
+    while (exp > 0) {
+        if ((exp & 1) && __builtin_mul_overflow(result, base, &result)) return EVAL_OVERFLOW;
+        exp >>= 1;
+        if (exp && __builtin_mul_overflow(base, base, &base)) return EVAL_OVERFLOW;
+    }
+    *res = result;
+    return EVAL_OK;
+}
 
-    if (!is_empty(stack)) {
-        free_stack(stack);
-        return 0;
+static long long mul_mod(long long a, long long b) {
+    return (long long)((unsigned __int128)a * (unsigned long long)b % (unsigned long long)arith_modulus);
+}
+
+static long long pow_mod(long long base, long long exp) {
+    long long result = 1 % arith_modulus;
+    while (exp > 0) {
+        if (exp & 1) result = mul_mod(result, base);
+        exp >>= 1;
+        if (exp) base = mul_mod(base, base);
     }
+    return result;
+}
 
-    free_stack(stack);
+// Обратный по модулю расширенным алгоритмом Евклида; 0, если не существует
+static int inverse_mod(long long a, long long* inverse) {
+    __int128 old_r = a, r = arith_modulus, old_s = 1, s = 0;
+    while (r != 0) {
+        __int128 q = old_r / r, t;
+        t = old_r - q * r; old_r = r; r = t;
+        t = old_s - q * s; old_s = s; s = t;
+    }
+    if (old_r != 1) return 0;
+    if (old_s < 0) old_s += arith_modulus;
+    *inverse = (long long)old_s;
     return 1;
 }
 
-// Создание демонстрационного файла
-void create_demo_file() {
-    FILE* file = fopen("demo_expressions.txt", "w");
-    if (file) {
-        fprintf(file, "2 + 3 * 4\n");
-        fprintf(file, "(2 + 3) * 4\n");
-        fprintf(file, "10 / (5 - 5)\n");
-        fprintf(file, "2 ^ 3 + 1\n");
-        fprintf(file, "((2 + 3) * (4 - 1)\n");
-        fprintf(file, "15 %% 4\n");
-        fprintf(file, "2 ^ 3 ^ 2\n");
-        fprintf(file, "10 / 0\n");
-        fprintf(file, "-5 + 8\n");
-        fprintf(file, "2 * (3 + 4)) - 1\n");
-        fclose(file);
-        printf("Demo file 'demo_expressions.txt' created!\n");
+// Операнды ARITH_MOD - уже приведенные вычеты из [0, arith_modulus), кроме показателя
+// степени: он обычное целое (см. mark_exponents). Остаток от деления у вычетов не
+// определен: у 7 и 7 + N при делении на 3 он разный
+static EvalStatus apply_mod(OpCode op, long long left, long long right, long long* res) {
+    long long inverse;
+    switch (op) {
+    case OP_ADD:
+        *res = left >= arith_modulus - right ? left - (arith_modulus - right) : left + right;
+        return EVAL_OK;
+    case OP_SUB:
+        *res = left >= right ? left - right : left + (arith_modulus - right);
+        return EVAL_OK;
+    case OP_MUL: *res = mul_mod(left, right); return EVAL_OK;
+    case OP_DIV:
+        if (right == 0) return EVAL_DIV_ZERO;
+        if (!inverse_mod(right, &inverse)) return EVAL_NOT_INVERTIBLE;
+        *res = mul_mod(left, inverse);
+        return EVAL_OK;
+    case OP_MOD: return EVAL_NO_REMAINDER;
+    case OP_POW:
+        if (right < 0) return EVAL_NEG_POWER;
+        *res = pow_mod(left, right);
+        return EVAL_OK;
+    default: return EVAL_INVALID;
     }
 }
 
-// Простая демонстрация
-void demo_mode() {
-    printf("=== DEMO MODE ===\n");
-    printf("Creating demo file and processing...\n\n");
+// Бинарная операция в проверяемом int64
+static EvalStatus apply_checked(OpCode op, long long left, long long right, long long* res) {
+    switch (op) {
+    case OP_ADD: return __builtin_add_overflow(left, right, res) ? EVAL_OVERFLOW : EVAL_OK;
+    case OP_SUB: return __builtin_sub_overflow(left, right, res) ? EVAL_OVERFLOW : EVAL_OK;
+    case OP_MUL: return __builtin_mul_overflow(left, right, res) ? EVAL_OVERFLOW : EVAL_OK;
+    case OP_DIV:
+        if (right == 0) return EVAL_DIV_ZERO;
+        if (left == LLONG_MIN && right == -1) return EVAL_OVERFLOW;
+        *res = left / right;
+        return EVAL_OK;
+    case OP_MOD:
+        if (right == 0) return EVAL_DIV_ZERO;
+        *res = right == -1 ? 0 : left % right;
+        return EVAL_OK;
+    case OP_POW: return power_checked(left, right, res);
+    default: return EVAL_INVALID;
+    }
+}
 
-    create_demo_file();
+// Бинарная операция в текущем режиме. В ARITH_BIG - проверяемый int64: так свертка
+// констант оставляет переполняющиеся операции длинной арифметике
+static EvalStatus apply_binary(OpCode op, long long left, long long right, long long* res) {
+    if (arith_mode == ARITH_MOD) return apply_mod(op, left, right, res);
+    return apply_checked(op, left, right, res);
+}
 
-    FILE* file = fopen("demo_expressions.txt", "r");
-    if (!file) {
-        printf("Error: Cannot open demo file\n");
-        return;
+static EvalStatus negate_checked(long long value, long long* res) {
+    if (value == LLONG_MIN) return EVAL_OVERFLOW;
+    *res = -value;
+    return EVAL_OK;
+}
+
+static EvalStatus apply_negate(long long value, long long* res) {
+    if (arith_mode == ARITH_MOD) {
+        *res = value ? arith_modulus - value : 0;
+        return EVAL_OK;
     }
+    return negate_checked(value, res);
+}
 
-    char line[MAX_EXPR_LENGTH];
-    int line_num = 0;
+// Показатели степени в ARITH_MOD: показатель - обычное целое, а не вычет (2^10 mod 10
+// равно 4, а не 2^0), поэтому правый операнд каждой ^ вычисляется проверяемой
+// арифметикой без приведения чисел. exact[i] = 1 для лексем внутри такого операнда.
+// Возвращает 0, если ^ в коде нет
+static int mark_exponents(const Token* code, int count, unsigned char* exact) {
+    int start[MAX_TOKENS]; // начало поддерева каждого значения на стеке
+    int top = 0;
+    int found = 0;
+
+    memset(exact, 0, count);
+    for (int i = 0; i < count; i++) {
+        OpCode op = code[i].op;
+        if (is_operand(op)) {
+            if (top == MAX_TOKENS) break;
+            start[top++] = i;
+        }
+        else if (op == OP_NEG) {
+            if (top < 1) break;
+        }
+        else {
+            // Некорректная RPN - ошибку сообщит вычисление
+            if (top < 2) break;
+            int right = start[--top];
+            if (op == OP_POW) {
+                memset(exact + right, 1, i - right);
+                found = 1;
+            }
+        }
+    }
+    return found;
+}
 
-    printf("Processing expressions:\n");
-    printf("=======================\n\n");
+// Ошибка вычисления: в error_pos (если не NULL) - позиция лексемы, на которой она
+// возникла, или -1
+static EvalStatus fail_at(EvalStatus status, const Token* token, int* error_pos) {
+    if (error_pos) *error_pos = token ? token->pos : -1;
+    return status;
+}
 
-    while (fgets(line, sizeof(line), file)) {
-        line[strcspn(line, "\n")] = '\0';
-        line_num++;
+// Вычисление RPN на стеке значений фиксированного размера, без выделений памяти;
+// OP_VAR читает значение из slots по номеру слота. Длинный режим - evaluate_big
+EvalStatus evaluate_code(const Token* postfix, int count, const long long* slots, long long* result,
+    int* error_pos) {
+    long long stack[MAX_TOKENS];
+    int top = 0;
+    unsigned char marks[MAX_TOKENS];
+    const unsigned char* exact = arith_mode == ARITH_MOD && mark_exponents(postfix, count, marks) ? marks : NULL;
 
-        printf("Expression %d: %s\n", line_num, line);
+    for (int i = 0; i < count; i++) {
+        OpCode op = postfix[i].op;
+        int modular = arith_mode == ARITH_MOD && !(exact && exact[i]);
 
-        // Проверка баланса скобок
-        if (!check_balance(line)) {
-            printf("  ERROR: Unbalanced parentheses\n\n");
+        // Число
+        if (op == OP_NUM) {
+            if (top == MAX_TOKENS) return fail_at(EVAL_INVALID, &postfix[i], error_pos);
+            stack[top++] = modular ? postfix[i].value % arith_modulus : postfix[i].value;
             continue;
         }
-
-        // Преобразование в RPN
-        char postfix[MAX_EXPR_LENGTH * 2];
-        if (!infix_to_postfix(line, postfix)) {
-            printf("  ERROR: Cannot convert to postfix\n\n");
+        // Переменная
+        if (op == OP_VAR) {
+            if (top == MAX_TOKENS || !slots) return fail_at(EVAL_INVALID, &postfix[i], error_pos);
+            stack[top++] = slots[postfix[i].value];
+            continue;
+        }
+        // Унарный минус
+        if (op == OP_NEG) {
+            if (top < 1) return fail_at(EVAL_INVALID, &postfix[i], error_pos);
+            EvalStatus status = modular ? apply_negate(stack[top - 1], &stack[top - 1])
+                                        : negate_checked(stack[top - 1], &stack[top - 1]);
+            if (status != EVAL_OK) return fail_at(status, &postfix[i], error_pos);
             continue;
         }
 
-        printf("  RPN: %s\n", postfix);
+        // Бинарный оператор
+        if (top < 2) return fail_at(EVAL_INVALID, &postfix[i], error_pos);
+        long long right = stack[--top];
+        EvalStatus status = modular ? apply_mod(op, stack[top - 1], right, &stack[top - 1])
+                                    : apply_checked(op, stack[top - 1], right, &stack[top - 1]);
+        if (status != EVAL_OK) return fail_at(status, &postfix[i], error_pos);
+    }
 
-        // Вычисление
-        long long result;
-        if (evaluate_postfix(postfix, &result)) {
-            printf("  Result: %lld\n\n", result);
+    // Лишний операнд: ошибка на последнем
+    if (top != 1) return fail_at(EVAL_INVALID, count ? &postfix[count - 1] : NULL, error_pos);
+    *result = stack[0];
+    return EVAL_OK;
+}
+
+int evaluate_tokens(const Token* postfix, int count, long long* result) {
+    return evaluate_code(postfix, count, NULL, result, NULL) == EVAL_OK;
+}
+
+// Длинные целые: знак и модуль по основанию 2^32 (младшие разряды первыми)
+#define BIG_KARATSUBA_MIN 32 // меньше разрядов - школьное умножение
+#define BIG_MAX_BITS (1 << 20)
+
+typedef struct {
+    int sign; // -1, 0, 1
+    int len;
+    uint32_t* limbs;
+} BigNum;
+
+static BigNum big_alloc(int len) {
+    BigNum a;
+    a.sign = 0;
+    a.len = len;
+    a.limbs = counted_calloc(len ? len : 1, sizeof(uint32_t));
+    return a;
+}
+
+void big_free(BigNum* a) {
+    free(a->limbs);
+    a->limbs = NULL;
+    a->len = 0;
+    a->sign = 0;
+}
+
+static void big_trim(BigNum* a) {
+    while (a->len > 0 && a->limbs[a->len - 1] == 0) a->len--;
+    if (a->len == 0) a->sign = 0;
+}
+
+BigNum big_from_ll(long long v) {
+    BigNum a = big_alloc(2);
+    unsigned long long m = v < 0 ? 0ULL - (unsigned long long)v : (unsigned long long)v;
+    a.limbs[0] = (uint32_t)m;
+    a.limbs[1] = (uint32_t)(m >> 32);
+    a.sign = v < 0 ? -1 : 1;
+    big_trim(&a);
+    return a;
+}
+
+// Десятичная запись: по 9 цифр, накопленное умножается на 10^9
+static BigNum big_from_digits(const char* digits, int len) {
+    BigNum a = big_alloc(len / 9 + 2);
+    int used = 0;
+    for (int i = 0; i < len; ) {
+        int chunk = (len - i) % 9 ? (len - i) % 9 : 9;
+        uint64_t mul = 1, carry = 0;
+        for (int j = 0; j < chunk; j++, i++) {
+            mul *= 10;
+            carry = carry * 10 + (digits[i] - '0');
         }
-        else {
-            printf("  ERROR: Cannot evaluate expression\n\n");
+        for (int j = 0; j < used; j++) {
+            uint64_t cur = (uint64_t)a.limbs[j] * mul + carry;
+            a.limbs[j] = (uint32_t)cur;
+            carry = cur >> 32;
+        }
+        while (carry) {
+            a.limbs[used++] = (uint32_t)carry;
+            carry >>= 32;
         }
     }
+    a.len = used;
+    a.sign = 1;
+    big_trim(&a);
+    return a;
+}
 
-    fclose(file);
-    printf("Demo completed! Processed %d expressions.\n", line_num);
+// Константа OP_BIGNUM; 0 - больше BIG_MAX_BITS (log2(10) < 3.3220)
+static int big_literal(const char* digits, int len, long long* value) {
+    if ((long long)len * 33219 / 10000 > BIG_MAX_BITS) return 0;
+    BigNum* big = counted_malloc(sizeof(BigNum));
+    *big = big_from_digits(digits, len);
+    *value = (long long)(intptr_t)big;
+    return 1;
 }
 
-// Обработка файла
-void process_file_mode(const char* filename) {
-    printf("=== PROCESSING FILE: %s ===\n\n", filename);
+static const BigNum* big_constant(const Token* t) {
+    return (const BigNum*)(intptr_t)t->value;
+}
 
-    FILE* file = fopen(filename, "r");
-    if (!file) {
-        printf("Error: Cannot open file %s\n", filename);
-        return;
+// Освобождение констант OP_BIGNUM в коде (сам массив - у вызывающего)
+void free_code(Token* code, int count) {
+    for (int i = 0; i < count; i++) {
+        if (code[i].op != OP_BIGNUM) continue;
+        BigNum* big = (BigNum*)(intptr_t)code[i].value;
+        big_free(big);
+        free(big);
+        code[i].op = OP_NUM;
     }
+}
 
-    char line[MAX_EXPR_LENGTH];
-    int line_num = 0;
-    int success_count = 0;
-    int error_count = 0;
+BigNum big_copy(const BigNum* a) {
+    BigNum r = big_alloc(a->len);
+    memcpy(r.limbs, a->limbs, sizeof(uint32_t) * a->len);
+    r.sign = a->sign;
+    return r;
+}
 
-    // Файл для ошибок
-    FILE* error_file = fopen("errors.txt", "w");
-    fprintf(error_file, "Error report for: %s\n", filename);
-    fprintf(error_file, "=============================\n\n");
+static int mag_cmp(const uint32_t* a, int na, const uint32_t* b, int nb) {
+    if (na != nb) return na < nb ? -1 : 1;
+    for (int i = na - 1; i >= 0; i--) {
+        if (a[i] != b[i]) return a[i] < b[i] ? -1 : 1;
+    }
+    return 0;
+}
 
-    while (fgets(line, sizeof(line), file)) {
-        line[strcspn(line, "\n")] = '\0';
-        line_num++;
+// out[0..out_len) += src[0..n); перенос не выходит за out_len
+static void mag_add_at(uint32_t* out, int out_len, const uint32_t* src, int n) {
+    uint64_t carry = 0;
+    int i = 0;
+    for (; i < n && i < out_len; i++) {
+        carry += (uint64_t)out[i] + src[i];
+        out[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    for (; carry && i < out_len; i++) {
+        carry += out[i];
+        out[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+}
 
-        printf("Line %d: %s\n", line_num, line);
+// out[0..out_len) -= src[0..n); результат неотрицателен
+static void mag_sub_at(uint32_t* out, int out_len, const uint32_t* src, int n) {
+    int64_t borrow = 0;
+    int i = 0;
+    for (; i < n && i < out_len; i++) {
+        int64_t d = (int64_t)out[i] - src[i] - borrow;
+        borrow = d < 0;
+        out[i] = (uint32_t)d;
+    }
+    for (; borrow && i < out_len; i++) {
+        int64_t d = (int64_t)out[i] - borrow;
+        borrow = d < 0;
+        out[i] = (uint32_t)d;
+    }
+}
 
-        // Проверка баланса скобок
-        if (!check_balance(line)) {
-            printf("  ERROR: Unbalanced parentheses\n\n");
-            fprintf(error_file, "Line %d: %s\n", line_num, line);
-            fprintf(error_file, "Error: Unbalanced parentheses\n\n");
-            error_count++;
-            continue;
+// out[0..na+nb) = a * b; out должен быть обнулен. Карацуба от BIG_KARATSUBA_MIN разрядов
+static void mag_mul(const uint32_t* a, int na, const uint32_t* b, int nb, uint32_t* out) {
+    if (na < nb) {
+        const uint32_t* t = a; a = b; b = t;
+        int n = na; na = nb; nb = n;
+    }
+    if (nb == 0) return;
+
+    if (nb < BIG_KARATSUBA_MIN) {
+        for (int i = 0; i < nb; i++) {
+            uint64_t carry = 0;
+            for (int j = 0; j < na; j++) {
+                carry += (uint64_t)a[j] * b[i] + out[i + j];
+                out[i + j] = (uint32_t)carry;
+                carry >>= 32;
+            }
+            out[i + na] = (uint32_t)carry;
         }
+        return;
+    }
 
-        // Преобразование в RPN
-        char postfix[MAX_EXPR_LENGTH * 2];
-        if (!infix_to_postfix(line, postfix)) {
-            printf("  ERROR: Cannot convert to postfix\n\n");
-            fprintf(error_file, "Line %d: %s\n", line_num, line);
-            fprintf(error_file, "Error: Cannot convert to postfix\n\n");
-            error_count++;
-            continue;
+    // Сильно разные длины: a по кускам длины nb
+    if (2 * nb <= na) {
+        uint32_t* tmp = counted_malloc(sizeof(uint32_t) * 2 * nb);
+        for (int i = 0; i < na; i += nb) {
+            int len = na - i < nb ? na - i : nb;
+            memset(tmp, 0, sizeof(uint32_t) * (len + nb));
+            mag_mul(a + i, len, b, nb, tmp);
+            mag_add_at(out + i, na + nb - i, tmp, len + nb);
         }
+        free(tmp);
+        return;
+    }
+
+    // a = a1*B^m + a0, b = b1*B^m + b0; z0 = a0*b0 и z2 = a1*b1 ложатся в out без пересечения
+    int m = na / 2;
+    mag_mul(a, m, b, m, out);
+    mag_mul(a + m, na - m, b + m, nb - m, out + 2 * m);
+
+    int ns = na - m + 1, nt = (m > nb - m ? m : nb - m) + 1;
+    uint32_t* sa = counted_calloc(ns + nt + ns + nt, sizeof(uint32_t));
+    uint32_t* sb = sa + ns;
+    uint32_t* z1 = sb + nt;
+    memcpy(sa, a + m, sizeof(uint32_t) * (na - m));
+    mag_add_at(sa, ns, a, m);
+    memcpy(sb, b, sizeof(uint32_t) * m);
+    mag_add_at(sb, nt, b + m, nb - m);
+
+    // z1 = (a0 + a1)(b0 + b1) - z0 - z2
+    mag_mul(sa, ns, sb, nt, z1);
+    mag_sub_at(z1, ns + nt, out, 2 * m);
+    mag_sub_at(z1, ns + nt, out + 2 * m, na + nb - 2 * m);
+    mag_add_at(out + m, na + nb - m, z1, ns + nt);
+    free(sa);
+}
 
-        printf("  RPN: %s\n", postfix);
+BigNum big_mul(const BigNum* a, const BigNum* b) {
+    if (a->sign == 0 || b->sign == 0) return big_alloc(0);
+    BigNum r = big_alloc(a->len + b->len);
+    mag_mul(a->limbs, a->len, b->limbs, b->len, r.limbs);
+    r.sign = a->sign * b->sign;
+    big_trim(&r);
+    return r;
+}
 
-        // Вычисление
-        long long result;
-        if (evaluate_postfix(postfix, &result)) {
-            printf("  Result: %lld\n\n", result);
-            success_count++;
+BigNum big_add(const BigNum* a, const BigNum* b, int negate_b) {
+    int b_sign = negate_b ? -b->sign : b->sign;
+    if (b_sign == 0) return big_copy(a);
+    if (a->sign == 0) {
+        BigNum r = big_copy(b);
+        r.sign = b_sign;
+        return r;
+    }
+
+    // Одинаковые знаки - сумма модулей, разные - разность от большего
+    if (a->sign == b_sign) {
+        const BigNum* big = a->len >= b->len ? a : b;
+        const BigNum* small = a->len >= b->len ? b : a;
+        BigNum r = big_alloc(big->len + 1);
+        for (int i = 0; i < big->len; i++) r.limbs[i] = big->limbs[i];
+        mag_add_at(r.limbs, r.len, small->limbs, small->len);
+        r.sign = a->sign;
+        big_trim(&r);
+        return r;
+    }
+
+    int cmp = mag_cmp(a->limbs, a->len, b->limbs, b->len);
+    if (cmp == 0) return big_alloc(0);
+    const BigNum* big = cmp > 0 ? a : b;
+    const BigNum* small = cmp > 0 ? b : a;
+    BigNum r = big_copy(big);
+    mag_sub_at(r.limbs, r.len, small->limbs, small->len);
+    r.sign = cmp > 0 ? a->sign : b_sign;
+    big_trim(&r);
+    return r;
+}
+
+// Деление модулей (Кнут, алгоритм D): q[0..m-n], r[0..n); v[n-1] != 0
+static void mag_divmod(const uint32_t* u, int m, const uint32_t* v, int n, uint32_t* q, uint32_t* r) {
+    if (n == 1) {
+        uint64_t rem = 0;
+        for (int i = m - 1; i >= 0; i--) {
+            uint64_t cur = (rem << 32) | u[i];
+            q[i] = (uint32_t)(cur / v[0]);
+            rem = cur % v[0];
         }
-        else {
-            printf("  ERROR: Cannot evaluate expression\n\n");
-            fprintf(error_file, "Line %d: %s\n", line_num, line);
-            fprintf(error_file, "Error: Cannot evaluate expression\n\n");
-            error_count++;
+        r[0] = (uint32_t)rem;
+        return;
+    }
+
+    // Нормализация: старший разряд делителя с единичным старшим битом
+    int shift = __builtin_clz(v[n - 1]);
+    uint32_t* vn = counted_malloc(sizeof(uint32_t) * n);
+    uint32_t* un = counted_malloc(sizeof(uint32_t) * (m + 1));
+    for (int i = n - 1; i > 0; i--) vn[i] = (v[i] << shift) | (shift ? (uint32_t)((uint64_t)v[i - 1] >> (32 - shift)) : 0);
+    vn[0] = v[0] << shift;
+    un[m] = shift ? (uint32_t)((uint64_t)u[m - 1] >> (32 - shift)) : 0;
+    for (int i = m - 1; i > 0; i--) un[i] = (u[i] << shift) | (shift ? (uint32_t)((uint64_t)u[i - 1] >> (32 - shift)) : 0);
+    un[0] = u[0] << shift;
+
+    for (int j = m - n; j >= 0; j--) {
+        // Оценка цифры частного по двум старшим разрядам
+        uint64_t num = ((uint64_t)un[j + n] << 32) | un[j + n - 1];
+        uint64_t qhat = num / vn[n - 1];
+        uint64_t rhat = num % vn[n - 1];
+        while (qhat >= (1ULL << 32) || qhat * vn[n - 2] > ((rhat << 32) | un[j + n - 2])) {
+            qhat--;
+            rhat += vn[n - 1];
+            if (rhat >= (1ULL << 32)) break;
+        }
+
+        // un[j..j+n] -= qhat * vn
+        int64_t borrow = 0;
+        uint64_t carry = 0;
+        for (int i = 0; i < n; i++) {
+            uint64_t p = qhat * vn[i] + carry;
+            carry = p >> 32;
+            int64_t t = (int64_t)un[i + j] - borrow - (uint32_t)p;
+            un[i + j] = (uint32_t)t;
+            borrow = t < 0;
+        }
+        int64_t t = (int64_t)un[j + n] - borrow - (int64_t)carry;
+        un[j + n] = (uint32_t)t;
+
+        // Оценка оказалась на единицу больше - добавляем делитель обратно
+        if (t < 0) {
+            qhat--;
+            uint64_t c = 0;
+            for (int i = 0; i < n; i++) {
+                c += (uint64_t)un[i + j] + vn[i];
+                un[i + j] = (uint32_t)c;
+                c >>= 32;
+            }
+            un[j + n] += (uint32_t)c;
         }
+        q[j] = (uint32_t)qhat;
     }
 
-    fclose(file);
-    fclose(error_file);
+    for (int i = 0; i < n; i++) r[i] = (un[i] >> shift) | (shift ? (uint32_t)((uint64_t)un[i + 1] << (32 - shift)) : 0);
+    free(vn);
+    free(un);
+}
 
-    printf("=== SUMMARY ===\n");
-    printf("Total expressions: %d\n", line_num);
-    printf("Successfully evaluated: %d\n", success_count);
-    printf("Errors: %d\n", error_count);
+// Деление с отбрасыванием дробной части, как у int64: знак остатка - знак делимого
+static EvalStatus big_divmod(const BigNum* a, const BigNum* b, BigNum* quotient, BigNum* remainder) {
+    if (b->sign == 0) return EVAL_DIV_ZERO;
+    if (mag_cmp(a->limbs, a->len, b->limbs, b->len) < 0) {
+        *quotient = big_alloc(0);
+        *remainder = big_copy(a);
+        return EVAL_OK;
+    }
+
+    *quotient = big_alloc(a->len - b->len + 1);
+    *remainder = big_alloc(b->len);
+    mag_divmod(a->limbs, a->len, b->limbs, b->len, quotient->limbs, remainder->limbs);
+    quotient->sign = a->sign * b->sign;
+    remainder->sign = a->sign;
+    big_trim(quotient);
+    big_trim(remainder);
+    return EVAL_OK;
+}
+
+static int big_bits(const BigNum* a) {
+    return a->len ? 32 * (a->len - 1) + (32 - __builtin_clz(a->limbs[a->len - 1])) : 0;
+}
 
-    if (error_count > 0) {
-        printf("Error report saved to: errors.txt\n");
+// Показатель должен помещаться в int64; размер результата ограничен BIG_MAX_BITS
+static EvalStatus big_pow(const BigNum* base, const BigNum* exponent, BigNum* result) {
+    if (exponent->sign < 0) return EVAL_NEG_POWER;
+    if (exponent->len > 2 || (exponent->len == 2 && exponent->limbs[1] >> 31)) {
+        if (base->sign == 0 || (base->len == 1 && base->limbs[0] == 1)) {
+            // 0^n = 0, (+-1)^n = +-1 по четности
+            *result = big_copy(base);
+            if (base->sign < 0 && !(exponent->limbs[0] & 1)) result->sign = 1;
+            return EVAL_OK;
+        }
+        return EVAL_TOO_LARGE;
+    }
+
+    unsigned long long exp = exponent->len ? exponent->limbs[0] : 0;
+    if (exponent->len == 2) exp |= (unsigned long long)exponent->limbs[1] << 32;
+    if (exp == 0) {
+        *result = big_from_ll(1);
+        return EVAL_OK;
+    }
+    // Для 0 и +-1 оценка нулевая, цикл занимает не больше 64 шагов
+    if ((double)(big_bits(base) - 1) * exp > BIG_MAX_BITS) return EVAL_TOO_LARGE;
+
+    BigNum acc = big_from_ll(1);
+    BigNum square = big_copy(base);
+    while (exp > 0) {
+        if (exp & 1) {
+            BigNum t = big_mul(&acc, &square);
+            big_free(&acc);
+            acc = t;
+        }
+        exp >>= 1;
+        if (exp) {
+            BigNum t = big_mul(&square, &square);
+            big_free(&square);
+            square = t;
+        }
     }
+    big_free(&square);
+    *result = acc;
+    return EVAL_OK;
 }
 
-int main(int argc, char* argv[]) {
-    printf("=========================================\n");
-    printf("   ARITHMETIC EXPRESSION CALCULATOR\n");
-    printf("=========================================\n\n");
+static EvalStatus big_apply(OpCode op, const BigNum* left, const BigNum* right, BigNum* res) {
+    BigNum q, r;
+    EvalStatus status;
+    switch (op) {
+    case OP_ADD: *res = big_add(left, right, 0); return EVAL_OK;
+    case OP_SUB: *res = big_add(left, right, 1); return EVAL_OK;
+    case OP_MUL: *res = big_mul(left, right); return EVAL_OK;
+    case OP_DIV:
+    case OP_MOD:
+        status = big_divmod(left, right, &q, &r);
+        if (status != EVAL_OK) return status;
+        *res = op == OP_DIV ? q : r;
+        big_free(op == OP_DIV ? &r : &q);
+        return EVAL_OK;
+    case OP_POW: return big_pow(left, right, res);
+    default: return EVAL_INVALID;
+    }
+}
 
-    if (argc == 1) {
-        // Демо режим
-        demo_mode();
+// Вычисление RPN в длинной арифметике; slots - значения переменных. Числа до int64
+// и свернутые константы - OP_NUM, длинные числа из текста - OP_BIGNUM
+EvalStatus evaluate_big(const Token* postfix, int count, const BigNum* slots, BigNum* result, int* error_pos) {
+    BigNum stack[MAX_TOKENS];
+    int top = 0;
+    EvalStatus status = EVAL_OK;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        OpCode op = postfix[i].op;
+
+        if (op == OP_NUM || op == OP_VAR || op == OP_BIGNUM) {
+            if (top == MAX_TOKENS || (op == OP_VAR && !slots)) status = EVAL_INVALID;
+            else if (op == OP_NUM) stack[top++] = big_from_ll(postfix[i].value);
+            else if (op == OP_BIGNUM) stack[top++] = big_copy(big_constant(&postfix[i]));
+            else stack[top++] = big_copy(&slots[postfix[i].value]);
+        }
+        else if (op == OP_NEG) {
+            if (top < 1) status = EVAL_INVALID;
+            else stack[top - 1].sign = -stack[top - 1].sign;
+        }
+        else if (top < 2) status = EVAL_INVALID;
+        else {
+            BigNum res;
+            status = big_apply(op, &stack[top - 2], &stack[top - 1], &res);
+            big_free(&stack[--top]);
+            if (status == EVAL_OK) {
+                big_free(&stack[top - 1]);
+                stack[top - 1] = res;
+            }
+        }
+        if (status != EVAL_OK) break;
+    }
+
+    if (status == EVAL_OK && top != 1) {
+        status = EVAL_INVALID;
+        i = count - 1;
+    }
+    if (status != EVAL_OK) fail_at(status, i >= 0 ? &postfix[i] : NULL, error_pos);
+    else *result = stack[--top];
+    while (top > 0) big_free(&stack[--top]);
+    return status;
+}
+
+// Десятичная запись длинного числа делением на 10^9 по кускам (строка в куче)
+char* big_to_string(const BigNum* a) {
+    if (a->sign == 0) return counted_strdup("0");
+
+    uint32_t* mag = counted_malloc(sizeof(uint32_t) * a->len);
+    memcpy(mag, a->limbs, sizeof(uint32_t) * a->len);
+    int len = a->len;
+    int chunk_count = 0;
+    uint32_t* chunks = counted_malloc(sizeof(uint32_t) * (a->len * 10 / 9 + 2));
+
+    do {
+        uint64_t rem = 0;
+        for (int i = len - 1; i >= 0; i--) {
+            uint64_t cur = (rem << 32) | mag[i];
+            mag[i] = (uint32_t)(cur / 1000000000u);
+            rem = cur % 1000000000u;
+        }
+        chunks[chunk_count++] = (uint32_t)rem;
+        while (len > 0 && mag[len - 1] == 0) len--;
+    } while (len > 0);
+
+    char* text = counted_malloc((size_t)chunk_count * 9 + 12);
+    int pos = sprintf(text, "%s%u", a->sign < 0 ? "-" : "", chunks[chunk_count - 1]);
+    for (int i = chunk_count - 2; i >= 0; i--) pos += sprintf(text + pos, "%09u", chunks[i]);
+    free(mag);
+    free(chunks);
+    return text;
+}
+
+// Запись RPN текстом через пробел (с завершающим пробелом)
+void format_postfix(const Token* postfix, int count, char* out, size_t size) {
+    size_t len = 0;
+    out[0] = '\0';
+
+    for (int i = 0; i < count && len < size; i++) {
+        int written;
+        if (postfix[i].op == OP_NUM || postfix[i].op == OP_VAR) {
+            written = snprintf(out + len, size - len, "%s%lld ", postfix[i].op == OP_VAR ? "$" : "", postfix[i].value);
+        }
+        else if (postfix[i].op == OP_BIGNUM) {
+            char* text = big_to_string(big_constant(&postfix[i]));
+            written = snprintf(out + len, size - len, "%s ", text);
+            free(text);
+        }
+        else written = snprintf(out + len, size - len, "%c ", op_symbols[postfix[i].op]);
+        if (written < 0) break;
+        len += written;
+    }
+}
+
+// Инфиксная строка -> массив лексем в RPN; длина или -1. Константы OP_BIGNUM
+// освобождает вызывающий (free_code)
+int compile_expression(const char* infix, Token* postfix) {
+    Token tokens[MAX_TOKENS];
+    int count = tokenize(infix, tokens, MAX_TOKENS, NULL);
+    if (count < 0) return -1;
+    int n = tokens_to_postfix(tokens, count, postfix);
+    if (n < 0) free_code(tokens, count);
+    return n;
+}
+
+// Преобразование в обратную польскую запись
+int infix_to_postfix(const char* infix, char* postfix) {
+    if (!check_balance(infix)) {
+        return 0;
+    }
+
+    Token rpn[MAX_TOKENS];
+    int count = compile_expression(infix, rpn);
+    if (count < 0) return 0;
+
+    format_postfix(rpn, count, postfix, MAX_EXPR_LENGTH * 2);
+    free_code(rpn, count);
+    return 1;
+}
+
+// Вычисление выражения в RPN
+int evaluate_postfix(const char* postfix, long long* result) {
+    Token tokens[MAX_TOKENS];
+    int count = tokenize(postfix, tokens, MAX_TOKENS, NULL);
+    if (count < 0) return 0;
+
+    int ok = evaluate_tokens(tokens, count, result);
+    free_code(tokens, count);
+    return ok;
+}
+
+// Свертка констант в RPN: операция над двумя (одним) числами, записанными прямо
+// перед ней, заменяется результатом. Ошибочные операции остаются до вычисления,
+// чтобы об ошибке сообщалось как обычно. Возвращает новую длину
+int fold_constants(Token* code, int count) {
+    int out = 0;
+    unsigned char marks[MAX_TOKENS];
+    const unsigned char* exact = arith_mode == ARITH_MOD && mark_exponents(code, count, marks) ? marks : NULL;
+
+    for (int i = 0; i < count; i++) {
+        Token t = code[i];
+        // Показатели степени в ARITH_MOD сворачиваются как обычные целые
+        int modular = arith_mode == ARITH_MOD && !(exact && exact[i]);
+        if (t.op == OP_NUM && modular) t.value %= arith_modulus;
+
+        if (t.op == OP_NEG && out >= 1 && code[out - 1].op == OP_NUM &&
+            (modular ? apply_negate(code[out - 1].value, &code[out - 1].value)
+                     : negate_checked(code[out - 1].value, &code[out - 1].value)) == EVAL_OK) {
+            continue;
+        }
+        if (!is_operand(t.op) && t.op != OP_NEG && out >= 2 &&
+            code[out - 1].op == OP_NUM && code[out - 2].op == OP_NUM) {
+            long long res;
+            EvalStatus status = modular ? apply_mod(t.op, code[out - 2].value, code[out - 1].value, &res)
+                                        : apply_checked(t.op, code[out - 2].value, code[out - 1].value, &res);
+            if (status == EVAL_OK) {
+                code[out - 2].value = res;
+                out--;
+                continue;
+            }
+        }
+        code[out++] = t;
+    }
+
+    return out;
+}
+
+// Кеш скомпилированных выражений по нормализованному тексту
+#define EXPR_CACHE_MAX 65536 // дальше новые выражения компилируются без сохранения
+
+typedef struct {
+    char* key;        // текст без пробелов (кроме одного между числами)
+    uint64_t hash;
+    EvalStatus status;// ошибка разбора: непарная скобка, лишний символ, большое число
+    int error_pos;    // ее позиция в key
+    char* rpn;        // RPN исходного выражения для вывода
+    Token* code;      // байткод после свертки констант
+    int code_count;
+} CompiledExpr;
+
+typedef struct {
+    CompiledExpr* entries;
+    int capacity;     // степень двойки, заполнение не выше половины
+    int count;
+    long lookups;
+    long hits;
+    CompiledExpr scratch; // результат для выражений, не попавших в заполненный кеш
+} ExprCache;
+
+void cache_init(ExprCache* cache) {
+    memset(cache, 0, sizeof(ExprCache));
+    cache->capacity = 1024;
+    cache->entries = calloc(cache->capacity, sizeof(CompiledExpr));
+}
+
+static void free_compiled(CompiledExpr* expr) {
+    free(expr->key);
+    free(expr->rpn);
+    if (expr->code) free_code(expr->code, expr->code_count);
+    free(expr->code);
+    memset(expr, 0, sizeof(CompiledExpr));
+}
+
+void cache_free(ExprCache* cache) {
+    for (int i = 0; i < cache->capacity; i++) {
+        if (cache->entries[i].key) free_compiled(&cache->entries[i]);
+    }
+    free_compiled(&cache->scratch);
+    free(cache->entries);
+}
+
+// Пробелы убираются; между двумя цифрами остается один, чтобы "1 2" не стало "12"
+static int normalize_expression(const char* expr, char* out) {
+    int len = 0;
+    int pending_space = 0;
+
+    for (const char* p = expr; *p; p++) {
+        if (isspace((unsigned char)*p)) {
+            pending_space = 1;
+            continue;
+        }
+        if (pending_space && len > 0 && isdigit((unsigned char)out[len - 1]) && isdigit((unsigned char)*p)) {
+            out[len++] = ' ';
+        }
+        pending_space = 0;
+        out[len++] = *p;
+    }
+
+    out[len] = '\0';
+    return len;
+}
+
+// Позиция в нормализованном тексте -> позиция в исходной строке; -1 - нет такой
+static int source_position(const char* line, int key_pos) {
+    if (key_pos < 0) return -1;
+    int len = 0;
+    int pending_space = 0;
+    char last = 0;
+
+    for (const char* p = line; *p; p++) {
+        if (isspace((unsigned char)*p)) {
+            pending_space = 1;
+            continue;
+        }
+        if (pending_space && len > 0 && isdigit((unsigned char)last) && isdigit((unsigned char)*p)) len++;
+        pending_space = 0;
+        if (len == key_pos) return p - line;
+        last = *p;
+        len++;
+    }
+    return -1;
+}
+
+static uint64_t hash_text(const char* text, int len) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (int i = 0; i < len; i++) {
+        hash ^= (unsigned char)text[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static void compile_into(CompiledExpr* expr, const char* text) {
+    expr->error_pos = unbalanced_position(text);
+    if (expr->error_pos >= 0) {
+        expr->status = EVAL_UNBALANCED;
+        return;
+    }
+
+    // Скобки парные, поэтому tokens_to_postfix не ошибается
+    Token tokens[MAX_TOKENS], rpn[MAX_TOKENS];
+    int count = tokenize_ex(text, tokens, MAX_TOKENS, NULL, 0, &expr->error_pos);
+    if (count < 0) {
+        expr->status = isdigit((unsigned char)text[expr->error_pos]) ? EVAL_OVERFLOW : EVAL_INVALID;
+        return;
+    }
+    count = tokens_to_postfix(tokens, count, rpn);
+
+    char postfix[MAX_EXPR_LENGTH * 2];
+    format_postfix(rpn, count, postfix, sizeof(postfix));
+    expr->rpn = strdup(postfix);
+
+    expr->code_count = fold_constants(rpn, count);
+    expr->code = malloc(sizeof(Token) * (expr->code_count ? expr->code_count : 1));
+    memcpy(expr->code, rpn, sizeof(Token) * expr->code_count);
+    expr->status = EVAL_OK;
+}
+
+static void cache_grow(ExprCache* cache) {
+    int old_capacity = cache->capacity;
+    CompiledExpr* old = cache->entries;
+
+    cache->capacity *= 2;
+    cache->entries = calloc(cache->capacity, sizeof(CompiledExpr));
+    for (int i = 0; i < old_capacity; i++) {
+        if (!old[i].key) continue;
+        int slot = old[i].hash & (cache->capacity - 1);
+        while (cache->entries[slot].key) slot = (slot + 1) & (cache->capacity - 1);
+        cache->entries[slot] = old[i];
+    }
+    free(old);
+}
+
+// Скомпилированное выражение из кеша или новое; указатель действителен до следующего вызова
+const CompiledExpr* cache_get(ExprCache* cache, const char* line) {
+    char key[MAX_EXPR_LENGTH];
+    int len = normalize_expression(line, key);
+    uint64_t hash = hash_text(key, len);
+
+    cache->lookups++;
+    int slot = hash & (cache->capacity - 1);
+    while (cache->entries[slot].key) {
+        CompiledExpr* expr = &cache->entries[slot];
+        if (expr->hash == hash && strcmp(expr->key, key) == 0) {
+            cache->hits++;
+            return expr;
+        }
+        slot = (slot + 1) & (cache->capacity - 1);
+    }
+
+    CompiledExpr* expr;
+    if (cache->count < EXPR_CACHE_MAX) {
+        if (2 * (cache->count + 1) > cache->capacity) {
+            cache_grow(cache);
+            slot = hash & (cache->capacity - 1);
+            while (cache->entries[slot].key) slot = (slot + 1) & (cache->capacity - 1);
+        }
+        expr = &cache->entries[slot];
+        cache->count++;
+    }
+    else {
+        free_compiled(&cache->scratch);
+        expr = &cache->scratch;
+    }
+
+    expr->key = strdup(key);
+    expr->hash = hash;
+    compile_into(expr, key);
+    return expr;
+}
+
+void print_cache_stats(const ExprCache* cache) {
+    printf("Compiled expressions: %d, cache hits: %ld of %ld (%.1f%%)\n", cache->count, cache->hits,
+        cache->lookups, cache->lookups ? 100.0 * cache->hits / cache->lookups : 0.0);
+}
+
+// Создание демонстрационного файла
+void create_demo_file() {
+    FILE* file = fopen("demo_expressions.txt", "w");
+    if (file) {
+        fprintf(file, "2 + 3 * 4\n");
+        fprintf(file, "(2 + 3) * 4\n");
+        fprintf(file, "10 / (5 - 5)\n");
+        fprintf(file, "2 ^ 3 + 1\n");
+        fprintf(file, "((2 + 3) * (4 - 1)\n");
+        fprintf(file, "15 %% 4\n");
+        fprintf(file, "2 ^ 3 ^ 2\n");
+        fprintf(file, "10 / 0\n");
+        fprintf(file, "-5 + 8\n");
+        fprintf(file, "2 * (3 + 4)) - 1\n");
+        fclose(file);
+        printf("Demo file 'demo_expressions.txt' created!\n");
+    }
+}
+
+// Простая демонстрация
+void demo_mode() {
+    printf("=== DEMO MODE ===\n");
+    printf("Creating demo file and processing...\n\n");
+
+    create_demo_file();
+
+    FILE* file = fopen("demo_expressions.txt", "r");
+    if (!file) {
+        printf("Error: Cannot open demo file\n");
+        return;
+    }
+
+    char line[MAX_EXPR_LENGTH];
+    int line_num = 0;
+    ExprCache cache;
+    cache_init(&cache);
+
+    printf("Processing expressions:\n");
+    printf("=======================\n\n");
+
+    while (fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "\n")] = '\0';
+        line_num++;
+
+        printf("Expression %d: %s\n", line_num, line);
+
+        const CompiledExpr* expr = cache_get(&cache, line);
+
+        // Ошибки разбора: непарная скобка, недопустимый символ, слишком большое число
+        EvalStatus status = expr->status;
+        int error_pos = expr->error_pos;
+
+        if (status == EVAL_OK) {
+            printf("  RPN: %s\n", expr->rpn);
+
+            // Вычисление
+            if (arith_mode == ARITH_BIG) {
+                BigNum result;
+                status = evaluate_big(expr->code, expr->code_count, NULL, &result, &error_pos);
+                if (status == EVAL_OK) {
+                    char* text = big_to_string(&result);
+                    printf("  Result: %s\n\n", text);
+                    free(text);
+                    big_free(&result);
+                }
+            }
+            else {
+                long long result;
+                status = evaluate_code(expr->code, expr->code_count, NULL, &result, &error_pos);
+                if (status == EVAL_OK) printf("  Result: %lld\n\n", result);
+            }
+        }
+        if (status != EVAL_OK) {
+            int column = source_position(line, error_pos);
+            if (column >= 0) printf("  ERROR: %s at column %d\n\n", eval_error_message(status), column + 1);
+            else printf("  ERROR: %s\n\n", eval_error_message(status));
+        }
+    }
+
+    fclose(file);
+    cache_free(&cache);
+    printf("Demo completed! Processed %d expressions.\n", line_num);
+}
+
+// Буфер вывода: строки отчета копятся в памяти и пишутся одним fwrite
+#define OUT_FLUSH_SIZE (1 << 16)
+
+typedef struct {
+    char* data;
+    size_t len;
+    size_t cap;
+} OutBuf;
+
+static void buf_reserve(OutBuf* buf, size_t extra) {
+    if (buf->len + extra <= buf->cap) return;
+    size_t cap = buf->cap ? buf->cap : 4096;
+    while (cap < buf->len + extra) cap *= 2;
+    buf->data = realloc(buf->data, cap);
+    buf->cap = cap;
+}
+
+static void buf_append(OutBuf* buf, const char* text, size_t len) {
+    buf_reserve(buf, len);
+    memcpy(buf->data + buf->len, text, len);
+    buf->len += len;
+}
+
+static void buf_append_str(OutBuf* buf, const char* text) {
+    buf_append(buf, text, strlen(text));
+}
+
+static void buf_append_ll(OutBuf* buf, long long value) {
+    char digits[24];
+    int pos = sizeof(digits);
+    unsigned long long v = value < 0 ? 0ULL - (unsigned long long)value : (unsigned long long)value;
+    do {
+        digits[--pos] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    if (value < 0) digits[--pos] = '-';
+    buf_append(buf, digits + pos, sizeof(digits) - pos);
+}
+
+static void buf_flush(OutBuf* buf, FILE* file) {
+    if (file && buf->len) fwrite(buf->data, 1, buf->len, file);
+    buf->len = 0;
+}
+
+static void buf_free(OutBuf* buf) {
+    free(buf->data);
+    memset(buf, 0, sizeof(OutBuf));
+}
+
+// Разбор Пратта: выражение вычисляется за один проход по строке, без лексем и RPN.
+// Приоритеты и ассоциативность те же, что у tokens_to_postfix: унарный минус связывает
+// сильнее * / %, но слабее правоассоциативного ^. RPN, если нужна, пишется в rpn по ходу
+// разбора: операнд - когда прочитан, операция - после своих операндов
+int pratt_mode = 0; // --pratt: файлы вычисляются разбором Пратта (кроме длинного режима)
+int pratt_rpn = 0;  // --rpn: при этом печатать RPN
+
+static int pratt_active() {
+    return pratt_mode && arith_mode != ARITH_BIG;
+}
+
+#define PRATT_MAX_DEPTH 10000 // строки потокового режима не ограничены по длине, а стек - да
+
+typedef struct {
+    const char* p;
+    OutBuf* rpn;
+    EvalStatus status;
+    const char* error_at; // где возникла ошибка
+    int depth;
+    int exponent;         // внутри показателя степени: в ARITH_MOD это обычное целое
+} PrattParser;
+
+// Приводить ли по модулю: показатели степени вычисляются без приведения, как в mark_exponents
+static int pratt_modular(const PrattParser* ps) {
+    return arith_mode == ARITH_MOD && !ps->exponent;
+}
+
+static void pratt_fail(PrattParser* ps, EvalStatus status, const char* at) {
+    ps->status = status;
+    ps->error_at = at;
+}
+
+static void pratt_emit_op(PrattParser* ps, OpCode op) {
+    if (!ps->rpn) return;
+    char text[2] = { op_symbols[op], ' ' };
+    buf_append(ps->rpn, text, 2);
+}
+
+static OpCode pratt_binary(char c) {
+    switch (c) {
+    case '+': return OP_ADD;
+    case '-': return OP_SUB;
+    case '*': return OP_MUL;
+    case '/': return OP_DIV;
+    case '%': return OP_MOD;
+    case '^': return OP_POW;
+    default: return OP_NUM;
+    }
+}
+
+static long long pratt_expression(PrattParser* ps, int min_priority);
+
+// Операнд: число, скобки или унарный минус
+static long long pratt_operand(PrattParser* ps) {
+    while (isspace((unsigned char)*ps->p)) ps->p++;
+    char c = *ps->p;
+    long long value = 0;
+
+    const char* start = ps->p;
+
+    if (c == '-' || c == '~') {
+        ps->p++;
+        value = pratt_expression(ps, get_priority(OP_NEG));
+        if (ps->status != EVAL_OK) return 0;
+        EvalStatus status = pratt_modular(ps) ? apply_negate(value, &value) : negate_checked(value, &value);
+        if (status != EVAL_OK) pratt_fail(ps, status, start);
+        else pratt_emit_op(ps, OP_NEG);
+        return value;
+    }
+
+    if (c == '(') {
+        ps->p++;
+        value = pratt_expression(ps, 0);
+        if (ps->status != EVAL_OK) return 0;
+        while (isspace((unsigned char)*ps->p)) ps->p++;
+        if (*ps->p != ')') {
+            if (*ps->p) pratt_fail(ps, EVAL_INVALID, ps->p);
+            else pratt_fail(ps, EVAL_UNBALANCED, start);
+            return 0;
+        }
+        ps->p++;
+        return value;
+    }
+
+    if (!isdigit((unsigned char)c)) {
+        pratt_fail(ps, c == ')' ? EVAL_UNBALANCED : EVAL_INVALID, start);
+        return 0;
+    }
+    while (isdigit((unsigned char)*ps->p)) {
+        if (__builtin_mul_overflow(value, 10, &value) || __builtin_add_overflow(value, *ps->p - '0', &value)) {
+            pratt_fail(ps, EVAL_OVERFLOW, start);
+            return 0;
+        }
+        ps->p++;
+    }
+    if (ps->rpn) {
+        buf_append_ll(ps->rpn, value);
+        buf_append(ps->rpn, " ", 1);
+    }
+    return pratt_modular(ps) ? value % arith_modulus : value;
+}
+
+// Операции с приоритетом не ниже min_priority; ^ правоассоциативна
+static long long pratt_expression(PrattParser* ps, int min_priority) {
+    if (++ps->depth > PRATT_MAX_DEPTH) {
+        pratt_fail(ps, EVAL_TOO_DEEP, ps->p);
+        return 0;
+    }
+    long long left = pratt_operand(ps);
+
+    while (ps->status == EVAL_OK) {
+        while (isspace((unsigned char)*ps->p)) ps->p++;
+        OpCode op = pratt_binary(*ps->p);
+        if (op == OP_NUM) break;
+        int priority = get_priority(op);
+        if (priority < min_priority) break;
+
+        const char* op_at = ps->p++;
+        if (op == OP_POW) ps->exponent++;
+        long long right = pratt_expression(ps, op == OP_POW ? priority : priority + 1);
+        if (op == OP_POW) ps->exponent--;
+        if (ps->status != EVAL_OK) break;
+        EvalStatus status = pratt_modular(ps) ? apply_mod(op, left, right, &left)
+                                              : apply_checked(op, left, right, &left);
+        if (status != EVAL_OK) pratt_fail(ps, status, op_at);
+        else pratt_emit_op(ps, op);
+    }
+
+    ps->depth--;
+    return left;
+}
+
+// Вычисление строки за один проход; rpn - NULL или буфер для RPN. При ошибке в
+// error_pos (если не NULL) - ее позиция в строке
+EvalStatus pratt_evaluate(const char* expr, OutBuf* rpn, long long* result, int* error_pos) {
+    PrattParser ps = { expr, rpn, EVAL_OK, NULL, 0, 0 };
+    long long value = pratt_expression(&ps, 0);
+
+    if (ps.status == EVAL_OK) {
+        while (isspace((unsigned char)*ps.p)) ps.p++;
+        if (*ps.p) pratt_fail(&ps, *ps.p == ')' ? EVAL_UNBALANCED : EVAL_INVALID, ps.p);
+    }
+    if (ps.status != EVAL_OK) {
+        if (error_pos) *error_pos = ps.error_at - expr;
+        return ps.status;
+    }
+    *result = value;
+    return EVAL_OK;
+}
+
+// Отчет об ошибках: текст в errors.txt или, с --errors-json, по объекту JSON на строку
+// в errors.jsonl. Записи копятся в буфере и пишутся в файл большими блоками
+int error_json = 0;
+
+static const char* error_report_name() {
+    return error_json ? "errors.jsonl" : "errors.txt";
+}
+
+// Строка JSON в кавычках
+static void buf_append_json(OutBuf* buf, const char* text) {
+    static const char hex[] = "0123456789abcdef";
+    buf_append(buf, "\"", 1);
+    for (const char* p = text; *p; p++) {
+        unsigned char c = *p;
+        if (c == '"' || c == '\\') {
+            char escaped[2] = { '\\', (char)c };
+            buf_append(buf, escaped, 2);
+        }
+        else if (c < 0x20) {
+            char escaped[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 15] };
+            buf_append(buf, escaped, 6);
+        }
+        else buf_append(buf, (const char*)p, 1);
+    }
+    buf_append(buf, "\"", 1);
+}
+
+// Отчет об ошибке в вывод и в буфер отчета; column - позиция в line или -1
+static void report_line_error(OutBuf* out, OutBuf* errors, int line_num, const char* line, EvalStatus status,
+    int column) {
+    const char* message = eval_error_message(status);
+    buf_append_str(out, "  ERROR: ");
+    buf_append_str(out, message);
+    if (column >= 0) {
+        buf_append_str(out, " at column ");
+        buf_append_ll(out, column + 1);
+    }
+    buf_append(out, "\n\n", 2);
+
+    if (error_json) {
+        buf_append_str(errors, "{\"line\":");
+        buf_append_ll(errors, line_num);
+        buf_append_str(errors, ",\"column\":");
+        if (column >= 0) buf_append_ll(errors, column + 1);
+        else buf_append_str(errors, "null");
+        buf_append_str(errors, ",\"code\":\"");
+        buf_append_str(errors, eval_error_code(status));
+        buf_append_str(errors, "\",\"message\":");
+        buf_append_json(errors, message);
+        buf_append_str(errors, ",\"expression\":");
+        buf_append_json(errors, line);
+        buf_append(errors, "}\n", 2);
+        return;
+    }
+
+    buf_append(errors, "Line ", 5);
+    buf_append_ll(errors, line_num);
+    if (column >= 0) {
+        buf_append_str(errors, ", column ");
+        buf_append_ll(errors, column + 1);
+    }
+    buf_append(errors, ": ", 2);
+    buf_append_str(errors, line);
+    buf_append(errors, "\nError: ", 8);
+    buf_append_str(errors, message);
+    buf_append(errors, "\n\n", 2);
+}
+
+// Вычисление одной строки файла с отчетом в буферы; 1 - успешно, 0 - ошибка
+int evaluate_line(ExprCache* cache, const char* line, int line_num, OutBuf* out, OutBuf* errors) {
+    buf_append(out, "Line ", 5);
+    buf_append_ll(out, line_num);
+    buf_append(out, ": ", 2);
+    buf_append_str(out, line);
+    buf_append(out, "\n", 1);
+
+    // Разбор Пратта: частичная RPN при ошибке отбрасывается
+    if (pratt_active()) {
+        size_t mark = out->len;
+        long long result;
+        int error_pos;
+        if (pratt_rpn) buf_append(out, "  RPN: ", 7);
+        EvalStatus status = pratt_evaluate(line, pratt_rpn ? out : NULL, &result, &error_pos);
+        if (status != EVAL_OK) {
+            out->len = mark;
+            report_line_error(out, errors, line_num, line, status, error_pos);
+            return 0;
+        }
+        if (pratt_rpn) buf_append(out, "\n", 1);
+        buf_append(out, "  Result: ", 10);
+        buf_append_ll(out, result);
+        buf_append(out, "\n\n", 2);
+        return 1;
+    }
+
+    // Ошибки разбора: непарная скобка, недопустимый символ, слишком большое число.
+    // Позиции в кеше относятся к нормализованному тексту
+    const CompiledExpr* expr = cache_get(cache, line);
+    if (expr->status != EVAL_OK) {
+        report_line_error(out, errors, line_num, line, expr->status, source_position(line, expr->error_pos));
+        return 0;
+    }
+
+    buf_append(out, "  RPN: ", 7);
+    buf_append_str(out, expr->rpn);
+    buf_append(out, "\n", 1);
+
+    // Вычисление
+    EvalStatus status;
+    long long result;
+    BigNum big_result;
+    int error_pos;
+    if (arith_mode == ARITH_BIG) status = evaluate_big(expr->code, expr->code_count, NULL, &big_result, &error_pos);
+    else status = evaluate_code(expr->code, expr->code_count, NULL, &result, &error_pos);
+    if (status != EVAL_OK) {
+        report_line_error(out, errors, line_num, line, status, source_position(line, error_pos));
+        return 0;
+    }
+
+    buf_append(out, "  Result: ", 10);
+    if (arith_mode == ARITH_BIG) {
+        char* text = big_to_string(&big_result);
+        buf_append_str(out, text);
+        free(text);
+        big_free(&big_result);
+    }
+    else buf_append_ll(out, result);
+    buf_append(out, "\n\n", 2);
+    return 1;
+}
+
+static FILE* open_error_report(const char* filename) {
+    FILE* error_file = fopen(error_report_name(), "w");
+    if (!error_file) {
+        printf("Warning: Cannot create %s, error report disabled\n", error_report_name());
+        return NULL;
+    }
+    if (!error_json) {
+        fprintf(error_file, "Error report for: %s\n", filename);
+        fprintf(error_file, "=============================\n\n");
+    }
+    return error_file;
+}
+
+static void print_summary(int line_num, int success_count, int error_count, int error_report) {
+    printf("=== SUMMARY ===\n");
+    printf("Total expressions: %d\n", line_num);
+    printf("Successfully evaluated: %d\n", success_count);
+    printf("Errors: %d\n", error_count);
+    if (error_count > 0 && error_report) {
+        printf("Error report saved to: %s\n", error_report_name());
+    }
+}
+
+// Обработка файла
+void process_file_mode(const char* filename) {
+    printf("=== PROCESSING FILE: %s ===\n\n", filename);
+
+    FILE* file = fopen(filename, "r");
+    if (!file) {
+        printf("Error: Cannot open file %s\n", filename);
+        return;
+    }
+
+    char line[MAX_EXPR_LENGTH];
+    int line_num = 0;
+    int success_count = 0;
+    int error_count = 0;
+    ExprCache cache;
+    cache_init(&cache);
+    OutBuf out = { 0 }, errors = { 0 };
+
+    // Файл для ошибок
+    FILE* error_file = open_error_report(filename);
+
+    while (fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "\n")] = '\0';
+        line_num++;
+
+        if (evaluate_line(&cache, line, line_num, &out, &errors)) success_count++;
+        else error_count++;
+
+        if (out.len >= OUT_FLUSH_SIZE) buf_flush(&out, stdout);
+        if (errors.len >= OUT_FLUSH_SIZE) buf_flush(&errors, error_file);
+    }
+    buf_flush(&out, stdout);
+    buf_flush(&errors, error_file);
+
+    fclose(file);
+    if (error_file) fclose(error_file);
+    buf_free(&out);
+    buf_free(&errors);
+
+    print_summary(line_num, success_count, error_count, error_file != NULL);
+    if (!pratt_active()) print_cache_stats(&cache);
+    cache_free(&cache);
+}
+
+// Параллельная обработка: файл отображается в память и делится на куски по границам
+// строк; куски вычисляются пулом потоков, каждый со своим кешем и буферами, а главный
+// поток выводит буферы в исходном порядке строк
+#define CHUNK_MIN_SIZE (1 << 20)
+#define CHUNKS_PER_THREAD 8
+
+typedef struct {
+    const char* begin;
+    const char* end;
+    int first_line;
+    int lines;
+    int success_count;
+    OutBuf out;
+    OutBuf errors;
+    int ready;
+} FileChunk;
+
+typedef struct {
+    FileChunk* chunks;
+    int count;
+    int next_chunk;
+    pthread_mutex_t lock;
+    pthread_cond_t ready_cond;
+} ChunkQueue;
+
+typedef struct {
+    ChunkQueue* queue;
+    long lookups;
+    long hits;
+    int compiled;
+} ChunkWorker;
+
+static void evaluate_chunk(ExprCache* cache, FileChunk* chunk) {
+    char line[MAX_EXPR_LENGTH];
+    int line_num = chunk->first_line;
+
+    for (const char* p = chunk->begin; p < chunk->end; ) {
+        const char* nl = memchr(p, '\n', chunk->end - p);
+        size_t len = (nl ? nl : chunk->end) - p;
+
+        const char* next = nl ? nl + 1 : chunk->end;
+
+        // Как fgets с буфером MAX_EXPR_LENGTH: длинная строка делится на части
+        if (len > MAX_EXPR_LENGTH - 1 - (nl ? 1 : 0)) {
+            len = MAX_EXPR_LENGTH - 1;
+            next = p + len;
+        }
+        memcpy(line, p, len);
+        line[len] = '\0';
+        p = next;
+
+        if (evaluate_line(cache, line, ++line_num, &chunk->out, &chunk->errors)) chunk->success_count++;
+    }
+}
+
+static void* chunk_worker(void* arg) {
+    ChunkWorker* worker = arg;
+    ChunkQueue* queue = worker->queue;
+    ExprCache cache;
+    cache_init(&cache);
+
+    for (;;) {
+        pthread_mutex_lock(&queue->lock);
+        int idx = queue->next_chunk++;
+        pthread_mutex_unlock(&queue->lock);
+        if (idx >= queue->count) break;
+
+        FileChunk* chunk = &queue->chunks[idx];
+        evaluate_chunk(&cache, chunk);
+
+        pthread_mutex_lock(&queue->lock);
+        chunk->ready = 1;
+        pthread_cond_broadcast(&queue->ready_cond);
+        pthread_mutex_unlock(&queue->lock);
+    }
+
+    worker->lookups = cache.lookups;
+    worker->hits = cache.hits;
+    worker->compiled = cache.count;
+    cache_free(&cache);
+    return NULL;
+}
+
+// Число строк в [p, end) так, как их прочитал бы fgets с буфером MAX_EXPR_LENGTH
+static int count_lines(const char* p, const char* end) {
+    int lines = 0;
+    while (p < end) {
+        const char* nl = memchr(p, '\n', end - p);
+        size_t len = (nl ? nl + 1 : end) - p;
+        lines += (int)((len + MAX_EXPR_LENGTH - 2) / (MAX_EXPR_LENGTH - 1));
+        p += len;
+    }
+    return lines;
+}
+
+void parallel_file_mode(const char* filename, int threads) {
+    printf("=== PROCESSING FILE: %s ===\n\n", filename);
+
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        printf("Error: Cannot open file %s\n", filename);
+        if (fd >= 0) close(fd);
+        return;
+    }
+
+    size_t size = st.st_size;
+    const char* data = NULL;
+    if (size > 0) {
+        data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            printf("Error: Cannot map file %s\n", filename);
+            close(fd);
+            return;
+        }
+        madvise((void*)data, size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // Куски по границам строк
+    if (threads < 1) threads = 1;
+    size_t chunk_size = size / ((size_t)threads * CHUNKS_PER_THREAD) + 1;
+    if (chunk_size < CHUNK_MIN_SIZE) chunk_size = CHUNK_MIN_SIZE;
+
+    ChunkQueue queue;
+    memset(&queue, 0, sizeof(ChunkQueue));
+    queue.chunks = calloc(size / chunk_size + 1, sizeof(FileChunk));
+    int line_num = 0;
+    for (const char* p = data; p < data + size; ) {
+        const char* end = size - (p - data) > chunk_size ? p + chunk_size : data + size;
+        if (end < data + size) {
+            const char* nl = memchr(end, '\n', data + size - end);
+            end = nl ? nl + 1 : data + size;
+        }
+        FileChunk* chunk = &queue.chunks[queue.count++];
+        chunk->begin = p;
+        chunk->end = end;
+        chunk->first_line = line_num;
+        chunk->lines = count_lines(p, end);
+        line_num += chunk->lines;
+        p = end;
+    }
+
+    if (threads > queue.count) threads = queue.count ? queue.count : 1;
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_cond_init(&queue.ready_cond, NULL);
+
+    pthread_t* thread_ids = malloc(sizeof(pthread_t) * threads);
+    ChunkWorker* workers = calloc(threads, sizeof(ChunkWorker));
+    for (int i = 0; i < threads; i++) {
+        workers[i].queue = &queue;
+        pthread_create(&thread_ids[i], NULL, chunk_worker, &workers[i]);
+    }
+
+    FILE* error_file = open_error_report(filename);
+    int success_count = 0;
+
+    // Вывод кусков по порядку по мере готовности
+    for (int i = 0; i < queue.count; i++) {
+        FileChunk* chunk = &queue.chunks[i];
+
+        pthread_mutex_lock(&queue.lock);
+        while (!chunk->ready) pthread_cond_wait(&queue.ready_cond, &queue.lock);
+        pthread_mutex_unlock(&queue.lock);
+
+        buf_flush(&chunk->out, stdout);
+        buf_flush(&chunk->errors, error_file);
+        buf_free(&chunk->out);
+        buf_free(&chunk->errors);
+        success_count += chunk->success_count;
+    }
+    fflush(stdout);
+
+    long lookups = 0, hits = 0;
+    int compiled = 0;
+    for (int i = 0; i < threads; i++) {
+        pthread_join(thread_ids[i], NULL);
+        lookups += workers[i].lookups;
+        hits += workers[i].hits;
+        compiled += workers[i].compiled;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) * 1e-9;
+
+    if (error_file) fclose(error_file);
+    if (data) munmap((void*)data, size);
+
+    print_summary(line_num, success_count, line_num - success_count, error_file != NULL);
+    if (!pratt_active()) {
+        printf("Compiled expressions: %d, cache hits: %ld of %ld (%.1f%%)\n", compiled, hits,
+            lookups, lookups ? 100.0 * hits / lookups : 0.0);
+    }
+    printf("Threads: %d, chunks: %d, time: %.3f s, %.0f expressions/s\n", threads, queue.count, elapsed,
+        elapsed > 0 ? line_num / elapsed : 0.0);
+
+    pthread_cond_destroy(&queue.ready_cond);
+    pthread_mutex_destroy(&queue.lock);
+    free(thread_ids);
+    free(workers);
+    free(queue.chunks);
+}
+
+// Интерпретатор скриптов: операторы через ';' - "имя = выражение", "print выражение"
+// и "print" (все переменные). Скрипт компилируется целиком: имена заменяются номерами
+// слотов, использование до присваивания - ошибка компиляции; при выполнении имен нет
+typedef enum { STMT_ASSIGN, STMT_PRINT, STMT_DUMP } StatementKind;
+
+typedef struct {
+    StatementKind kind;
+    int slot;        // ASSIGN - слот цели, DUMP - число переменных, заданных к этому месту
+    int line;
+    char* text;      // PRINT - текст выражения для вывода
+    Token* code;
+    int code_count;
+} Statement;
+
+typedef struct {
+    Statement* statements;
+    int count;
+    VarTable vars;
+} Script;
+
+// Корректность RPN по глубине стека
+static int check_postfix(const Token* code, int count) {
+    int depth = 0;
+    for (int i = 0; i < count; i++) {
+        if (is_operand(code[i].op)) depth++;
+        else if (code[i].op == OP_NEG) {
+            if (depth < 1) return 0;
+        }
+        else {
+            if (depth < 2) return 0;
+            depth--;
+        }
+    }
+    return depth == 1;
+}
+
+// Выражение с переменными -> байткод; NULL и сообщение при ошибке
+static Token* compile_script_expression(const char* text, const VarTable* vars, int* count, const char** error) {
+    if (!check_balance(text)) {
+        *error = "Unbalanced parentheses";
+        return NULL;
+    }
+
+    Token tokens[MAX_TOKENS], rpn[MAX_TOKENS];
+    int token_count = tokenize(text, tokens, MAX_TOKENS, vars);
+    if (token_count == TOKENIZE_UNDEFINED) {
+        *error = "Undefined variable";
+        return NULL;
+    }
+    int n = -1;
+    if (token_count < 0 || (n = tokens_to_postfix(tokens, token_count, rpn)) < 0 || !check_postfix(rpn, n)) {
+        if (token_count > 0) free_code(tokens, token_count);
+        *error = "Invalid expression";
+        return NULL;
+    }
+
+    n = fold_constants(rpn, n);
+    Token* code = malloc(sizeof(Token) * n);
+    memcpy(code, rpn, sizeof(Token) * n);
+    *count = n;
+    return code;
+}
+
+static char* trim(char* text) {
+    while (isspace((unsigned char)*text)) text++;
+    char* end = text + strlen(text);
+    while (end > text && isspace((unsigned char)end[-1])) end--;
+    *end = '\0';
+    return text;
+}
+
+// Компиляция одного оператора; 0 и сообщение в error при ошибке
+static int compile_statement(Script* script, char* text, int line, const char** error) {
+    Statement st;
+    memset(&st, 0, sizeof(Statement));
+    st.line = line;
+
+    const char* name = text;
+    const char* p = text;
+    while (is_name_char(*p)) p++;
+    int name_len = p - name;
+
+    if (name_len == 5 && strncmp(name, "print", 5) == 0 && (*p == '\0' || !is_name_char(*p))) {
+        char* expr = trim((char*)p);
+        if (*expr == '\0') {
+            st.kind = STMT_DUMP;
+            st.slot = script->vars.count;
+        }
+        else {
+            st.kind = STMT_PRINT;
+            st.code = compile_script_expression(expr, &script->vars, &st.code_count, error);
+            if (!st.code) return 0;
+            st.text = strdup(expr);
+        }
+    }
+    else {
+        while (isspace((unsigned char)*p)) p++;
+        if (name_len == 0 || !is_name_start(*name) || *p != '=') {
+            *error = "Expected 'name = expression' or 'print'";
+            return 0;
+        }
+
+        // Правая часть компилируется до появления имени слева: "a = a + 1" без a - ошибка
+        st.kind = STMT_ASSIGN;
+        st.code = compile_script_expression(p + 1, &script->vars, &st.code_count, error);
+        if (!st.code) return 0;
+        st.slot = vars_intern(&script->vars, name, name_len);
+    }
+
+    script->statements = realloc(script->statements, sizeof(Statement) * (script->count + 1));
+    script->statements[script->count++] = st;
+    return 1;
+}
+
+static void free_script(Script* script) {
+    for (int i = 0; i < script->count; i++) {
+        free(script->statements[i].text);
+        if (script->statements[i].code) free_code(script->statements[i].code, script->statements[i].code_count);
+        free(script->statements[i].code);
+    }
+    free(script->statements);
+    vars_free(&script->vars);
+}
+
+void script_mode(const char* filename) {
+    printf("=== SCRIPT: %s ===\n\n", filename);
+
+    FILE* file = fopen(filename, "rb");
+    if (!file) {
+        printf("Error: Cannot open file %s\n", filename);
+        return;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* source = malloc(size + 1);
+    size = fread(source, 1, size, file);
+    source[size] = '\0';
+    fclose(file);
+
+    // Компиляция: операторы разделяются ';', последний может быть без него
+    Script script;
+    memset(&script, 0, sizeof(Script));
+    vars_init(&script.vars);
+    int errors = 0;
+    int line = 1;
+
+    for (char* p = source; *p; ) {
+        char* end = strchr(p, ';');
+        if (!end) end = p + strlen(p);
+        int has_next = *end == ';';
+        *end = '\0';
+
+        while (isspace((unsigned char)*p)) {
+            if (*p == '\n') line++;
+            p++;
+        }
+        int statement_line = line;
+        for (const char* c = p; *c; c++) {
+            if (*c == '\n') line++;
+        }
+
+        char* text = trim(p);
+        const char* error;
+        if (*text && !compile_statement(&script, text, statement_line, &error)) {
+            printf("Error (line %d): %s: %s\n", statement_line, error, text);
+            errors++;
+        }
+        p = has_next ? end + 1 : end;
+    }
+    free(source);
+
+    if (errors) {
+        printf("\nScript not executed: %d error(s)\n", errors);
+        free_script(&script);
+        return;
+    }
+
+    // Выполнение по слотам; в длинном режиме слоты - BigNum
+    int slot_count = script.vars.count ? script.vars.count : 1;
+    int big = arith_mode == ARITH_BIG;
+    long long* slots = calloc(slot_count, sizeof(long long));
+    BigNum* big_slots = big ? calloc(slot_count, sizeof(BigNum)) : NULL;
+    OutBuf out = { 0 };
+    int executed = 0;
+
+    for (int i = 0; i < script.count; i++) {
+        Statement* st = &script.statements[i];
+
+        if (st->kind == STMT_DUMP) {
+            if (st->slot == 0) buf_append_str(&out, "(no variables)\n");
+            for (int slot = 0; slot < st->slot; slot++) {
+                buf_append_str(&out, script.vars.names[slot]);
+                buf_append(&out, " = ", 3);
+                if (big) {
+                    char* text = big_to_string(&big_slots[slot]);
+                    buf_append_str(&out, text);
+                    free(text);
+                }
+                else buf_append_ll(&out, slots[slot]);
+                buf_append(&out, "\n", 1);
+            }
+            executed++;
+            continue;
+        }
+
+        long long value;
+        BigNum big_value;
+        EvalStatus status = big ? evaluate_big(st->code, st->code_count, big_slots, &big_value, NULL)
+                                : evaluate_code(st->code, st->code_count, slots, &value, NULL);
+        if (status != EVAL_OK) {
+            buf_flush(&out, stdout);
+            printf("Error (line %d): %s, script stopped\n", st->line, eval_error_message(status));
+            break;
+        }
+
+        if (st->kind == STMT_ASSIGN) {
+            if (big) {
+                big_free(&big_slots[st->slot]);
+                big_slots[st->slot] = big_value;
+            }
+            else slots[st->slot] = value;
+        }
+        else {
+            buf_append_str(&out, st->text);
+            buf_append(&out, " = ", 3);
+            if (big) {
+                char* text = big_to_string(&big_value);
+                buf_append_str(&out, text);
+                free(text);
+                big_free(&big_value);
+            }
+            else buf_append_ll(&out, value);
+            buf_append(&out, "\n", 1);
+        }
+        executed++;
+
+        if (out.len >= OUT_FLUSH_SIZE) buf_flush(&out, stdout);
+    }
+    buf_flush(&out, stdout);
+    buf_free(&out);
+
+    printf("\n=== SUMMARY ===\n");
+    printf("Statements: %d executed of %d, variables: %d\n", executed, script.count, script.vars.count);
+
+    if (big) {
+        for (int i = 0; i < slot_count; i++) big_free(&big_slots[i]);
+        free(big_slots);
+    }
+    free(slots);
+    free_script(&script);
+}
+
+// Потоковый режим для конвейеров и сопроцессов: выражения построчно из stdin, на каждую
+// входную строку ровно одна строка ответа - значение или "ERROR: сообщение". Вход читается
+// большими блоками, ответы копятся в буфере и пишутся перед каждым чтением (то есть
+// когда готовые строки кончились), при заполнении буфера и в конце ввода
+#define STREAM_READ_SIZE (1 << 20)
+
+static int write_all(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, data, len);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        data += written;
+        len -= written;
+    }
+    return 1;
+}
+
+static int stream_flush(OutBuf* out) {
+    int ok = write_all(STDOUT_FILENO, out->data, out->len);
+    out->len = 0;
+    return ok;
+}
+
+// Ответ на одну строку (строка завершена нулем, без '\n')
+static void stream_line(ExprCache* cache, const char* line, size_t len, OutBuf* out) {
+    EvalStatus status;
+    int error_pos;
+
+    if (arith_mode == ARITH_BIG) {
+        // Длинный режим идет через кеш скомпилированных выражений
+        if (len >= MAX_EXPR_LENGTH) {
+            buf_append_str(out, "ERROR: Expression too long\n");
+            return;
+        }
+        const CompiledExpr* expr = cache_get(cache, line);
+        status = expr->status;
+        error_pos = source_position(line, expr->error_pos);
+        if (status == EVAL_OK) {
+            BigNum result;
+            status = evaluate_big(expr->code, expr->code_count, NULL, &result, &error_pos);
+            error_pos = source_position(line, error_pos);
+            if (status == EVAL_OK) {
+                char* text = big_to_string(&result);
+                buf_append_str(out, text);
+                buf_append(out, "\n", 1);
+                free(text);
+                big_free(&result);
+                return;
+            }
+        }
+    }
+    else {
+        long long result;
+        status = pratt_evaluate(line, NULL, &result, &error_pos);
+        if (status == EVAL_OK) {
+            buf_append_ll(out, result);
+            buf_append(out, "\n", 1);
+            return;
+        }
+    }
+
+    buf_append(out, "ERROR: ", 7);
+    buf_append_str(out, eval_error_message(status));
+    if (error_pos >= 0) {
+        buf_append_str(out, " at column ");
+        buf_append_ll(out, error_pos + 1);
+    }
+    buf_append(out, "\n", 1);
+}
+
+int stream_mode() {
+    size_t capacity = STREAM_READ_SIZE;
+    char* buffer = malloc(capacity + 1);
+    size_t filled = 0;
+    OutBuf out = { 0 };
+    ExprCache cache;
+    cache_init(&cache);
+    int ok = 1;
+
+    for (;;) {
+        // Ответы на все полные строки уходят до того, как read может заблокироваться
+        if (out.len && !stream_flush(&out)) {
+            ok = 0;
+            break;
+        }
+
+        // Строка длиннее буфера - буфер растет
+        if (filled == capacity) {
+            capacity *= 2;
+            buffer = realloc(buffer, capacity + 1);
+        }
+        ssize_t got = read(STDIN_FILENO, buffer + filled, capacity - filled);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) break;
+
+        // Перенесенная часть уже просмотрена, '\n' ищется только в новых данных
+        char* line = buffer;
+        char* search = buffer + filled;
+        filled += got;
+        char* nl;
+        while ((nl = memchr(search, '\n', buffer + filled - search)) != NULL) {
+            size_t len = nl - line;
+            if (len > 0 && line[len - 1] == '\r') len--;
+            line[len] = '\0';
+            stream_line(&cache, line, len, &out);
+            if (out.len >= OUT_FLUSH_SIZE && !stream_flush(&out)) {
+                ok = 0;
+                break;
+            }
+            line = search = nl + 1;
+        }
+        if (!ok) break;
+
+        // Незавершенная строка переносится в начало буфера
+        filled = buffer + filled - line;
+        memmove(buffer, line, filled);
+    }
+
+    // Последняя строка без '\n'
+    if (ok && filled > 0) {
+        if (buffer[filled - 1] == '\r') filled--;
+        buffer[filled] = '\0';
+        stream_line(&cache, buffer, filled, &out);
+    }
+    if (ok && out.len) ok = stream_flush(&out);
+
+    buf_free(&out);
+    cache_free(&cache);
+    free(buffer);
+    return ok ? 0 : 1;
+}
+
+// Столбцовый режим CSV: одна формула над столбцами файла (имена из заголовка).
+// Формула компилируется один раз; вычисление идет блоками по CSV_BLOCK строк: каждая
+// операция RPN - один плотный цикл над блоком (AVX2 при __AVX2__, иначе циклы,
+// которые векторизует компилятор), без разбора и интерпретации на каждой строке
+#define CSV_BLOCK 512
+
+typedef struct {
+    int int_mode;        // int64 с проверкой переполнения вместо double
+    VarTable columns;    // имя столбца -> номер
+    int* used;           // используется ли столбец формулой
+    double** f_data;     // значения используемых столбцов
+    long long** i_data;
+    long rows;
+    long capacity;
+} CsvTable;
+
+static void csv_free(CsvTable* table) {
+    for (int c = 0; c < table->columns.count; c++) {
+        free(table->f_data[c]);
+        free(table->i_data[c]);
+    }
+    free(table->f_data);
+    free(table->i_data);
+    free(table->used);
+    vars_free(&table->columns);
+}
+
+// Заголовок: имена столбцов через запятую
+static int csv_parse_header(CsvTable* table, char* line) {
+    for (char* field = line; field; ) {
+        char* comma = strchr(field, ',');
+        if (comma) *comma = '\0';
+        char* name = trim(field);
+        if (!is_name_start(*name)) return 0;
+        for (const char* c = name; *c; c++) {
+            if (!is_name_char(*c)) return 0;
+        }
+        if (vars_find(&table->columns, name, strlen(name)) >= 0) return 0;
+        vars_intern(&table->columns, name, strlen(name));
+        field = comma ? comma + 1 : NULL;
+    }
+    return 1;
+}
+
+// Строка данных; 0 - неверное число полей или значение
+static int csv_parse_row(CsvTable* table, char* line) {
+    if (table->rows == table->capacity) {
+        table->capacity = table->capacity ? table->capacity * 2 : 4096;
+        for (int c = 0; c < table->columns.count; c++) {
+            if (!table->used[c]) continue;
+            if (table->int_mode) table->i_data[c] = realloc(table->i_data[c], sizeof(long long) * table->capacity);
+            else table->f_data[c] = realloc(table->f_data[c], sizeof(double) * table->capacity);
+        }
+    }
+
+    char* p = line;
+    for (int c = 0; c < table->columns.count; c++) {
+        char* end;
+        if (!table->used[c]) {
+            end = strchr(p, ',');
+            if (!end) end = p + strlen(p);
+        }
+        else if (table->int_mode) {
+            errno = 0;
+            table->i_data[c][table->rows] = strtoll(p, &end, 10);
+            if (end == p || errno == ERANGE) return 0;
+        }
+        else {
+            table->f_data[c][table->rows] = strtod(p, &end);
+            if (end == p) return 0;
+        }
+
+        while (*end == ' ' || *end == '\t') end++;
+        if (c + 1 < table->columns.count) {
+            if (*end != ',') return 0;
+            p = end + 1;
+        }
+        else if (*end != '\0') return 0;
+    }
+
+    table->rows++;
+    return 1;
+}
+
+// Операция над блоком double
+static void block_op_double(OpCode op, const double* a, const double* b, double* out, int n) {
+    int i = 0;
+    switch (op) {
+    case OP_ADD:
+#ifdef __AVX2__
+        for (; i + 4 <= n; i += 4) _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+#endif
+        for (; i < n; i++) out[i] = a[i] + b[i];
+        break;
+    case OP_SUB:
+#ifdef __AVX2__
+        for (; i + 4 <= n; i += 4) _mm256_storeu_pd(out + i, _mm256_sub_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+#endif
+        for (; i < n; i++) out[i] = a[i] - b[i];
+        break;
+    case OP_MUL:
+#ifdef __AVX2__
+        for (; i + 4 <= n; i += 4) _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+#endif
+        for (; i < n; i++) out[i] = a[i] * b[i];
+        break;
+    case OP_DIV:
+#ifdef __AVX2__
+        for (; i + 4 <= n; i += 4) _mm256_storeu_pd(out + i, _mm256_div_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+#endif
+        for (; i < n; i++) out[i] = a[i] / b[i];
+        break;
+    case OP_MOD:
+        for (; i < n; i++) out[i] = fmod(a[i], b[i]);
+        break;
+    case OP_POW:
+        for (; i < n; i++) out[i] = pow(a[i], b[i]);
+        break;
+    default:
+        break;
+    }
+}
+
+// Операция над блоком int64; ошибка строки - первый ненулевой статус в err. out может
+// совпадать с a (рабочий блок левого операнда), поэтому результат пишется через r
+static void block_op_int(OpCode op, const long long* a, const long long* b, long long* out, int n, unsigned char* err) {
+    switch (op) {
+    case OP_ADD:
+        for (int i = 0; i < n; i++) {
+            long long r;
+            if (__builtin_add_overflow(a[i], b[i], &r) && !err[i]) err[i] = EVAL_OVERFLOW;
+            out[i] = r;
+        }
+        break;
+    case OP_SUB:
+        for (int i = 0; i < n; i++) {
+            long long r;
+            if (__builtin_sub_overflow(a[i], b[i], &r) && !err[i]) err[i] = EVAL_OVERFLOW;
+            out[i] = r;
+        }
+        break;
+    case OP_MUL:
+        for (int i = 0; i < n; i++) {
+            long long r;
+            if (__builtin_mul_overflow(a[i], b[i], &r) && !err[i]) err[i] = EVAL_OVERFLOW;
+            out[i] = r;
+        }
+        break;
+    default:
+        // Деление, остаток и степень - через общую проверяемую операцию
+        for (int i = 0; i < n; i++) {
+            long long r;
+            EvalStatus status = apply_binary(op, a[i], b[i], &r);
+            if (status != EVAL_OK) {
+                r = 0;
+                if (!err[i]) err[i] = status;
+            }
+            out[i] = r;
+        }
+        break;
+    }
+}
+
+// Скомпилированная формула: RPN и заполненные константой блоки для чисел
+typedef struct {
+    Token* code;
+    int count;
+    int depth;           // наибольшая глубина стека
+    void** constants;    // для OP_NUM/OP_FNUM - блок из CSV_BLOCK копий, иначе NULL
+} CsvProgram;
+
+static int csv_compile(CsvTable* table, const char* expr, CsvProgram* program) {
+    Token tokens[MAX_TOKENS], rpn[MAX_TOKENS];
+    int n = tokenize_ex(expr, tokens, MAX_TOKENS, &table->columns, !table->int_mode, NULL);
+    if (n == TOKENIZE_UNDEFINED) {
+        fprintf(stderr, "Error: Unknown column in formula\n");
+        return 0;
+    }
+    if (!check_balance(expr) || n < 0 || (n = tokens_to_postfix(tokens, n, rpn)) < 0 || !check_postfix(rpn, n)) {
+        fprintf(stderr, "Error: Invalid formula\n");
+        return 0;
+    }
+    if (table->int_mode) n = fold_constants(rpn, n);
+
+    program->code = malloc(sizeof(Token) * n);
+    memcpy(program->code, rpn, sizeof(Token) * n);
+    program->count = n;
+    program->constants = calloc(n, sizeof(void*));
+    program->depth = 0;
+
+    int depth = 0;
+    for (int i = 0; i < n; i++) {
+        OpCode op = rpn[i].op;
+        if (op == OP_VAR) table->used[rpn[i].value] = 1;
+        if (op == OP_NUM || op == OP_FNUM) {
+            if (table->int_mode) {
+                long long* block = malloc(sizeof(long long) * CSV_BLOCK);
+                for (int j = 0; j < CSV_BLOCK; j++) block[j] = rpn[i].value;
+                program->constants[i] = block;
+            }
+            else {
+                double value;
+                if (op == OP_FNUM) memcpy(&value, &rpn[i].value, sizeof(double));
+                else value = (double)rpn[i].value;
+                double* block = malloc(sizeof(double) * CSV_BLOCK);
+                for (int j = 0; j < CSV_BLOCK; j++) block[j] = value;
+                program->constants[i] = block;
+            }
+        }
+        if (op == OP_NUM || op == OP_FNUM || op == OP_VAR) depth++;
+        else if (op != OP_NEG) depth--;
+        if (depth > program->depth) program->depth = depth;
+    }
+    return 1;
+}
+
+static void csv_program_free(CsvProgram* program) {
+    for (int i = 0; i < program->count; i++) free(program->constants[i]);
+    free(program->constants);
+    free(program->code);
+}
+
+// Вычисление по блокам: элемент стека - указатель на блок (столбец, константа или
+// рабочий буфер уровня стека), так что переменные и константы не копируются
+static void csv_run_double(const CsvTable* table, const CsvProgram* program, double* results) {
+    double* scratch = malloc(sizeof(double) * CSV_BLOCK * (program->depth + 1));
+    const double** stack = malloc(sizeof(double*) * (program->depth + 1));
+
+    for (long row = 0; row < table->rows; row += CSV_BLOCK) {
+        int n = table->rows - row < CSV_BLOCK ? (int)(table->rows - row) : CSV_BLOCK;
+        int top = 0;
+        for (int i = 0; i < program->count; i++) {
+            const Token* t = &program->code[i];
+            double* dst = scratch + (size_t)CSV_BLOCK * (top - (t->op == OP_NEG ? 1 : 2));
+
+            if (t->op == OP_VAR) stack[top++] = table->f_data[t->value] + row;
+            else if (t->op == OP_NUM || t->op == OP_FNUM) stack[top++] = program->constants[i];
+            else if (t->op == OP_NEG) {
+                const double* src = stack[top - 1];
+                for (int j = 0; j < n; j++) dst[j] = -src[j];
+                stack[top - 1] = dst;
+            }
+            else {
+                block_op_double(t->op, stack[top - 2], stack[top - 1], dst, n);
+                stack[top - 2] = dst;
+                top--;
+            }
+        }
+        memcpy(results + row, stack[0], sizeof(double) * n);
+    }
+
+    free(scratch);
+    free(stack);
+}
+
+static void csv_run_int(const CsvTable* table, const CsvProgram* program, long long* results, unsigned char* errors) {
+    long long* scratch = malloc(sizeof(long long) * CSV_BLOCK * (program->depth + 1));
+    const long long** stack = malloc(sizeof(long long*) * (program->depth + 1));
+
+    for (long row = 0; row < table->rows; row += CSV_BLOCK) {
+        int n = table->rows - row < CSV_BLOCK ? (int)(table->rows - row) : CSV_BLOCK;
+        unsigned char* err = errors + row;
+        int top = 0;
+        for (int i = 0; i < program->count; i++) {
+            const Token* t = &program->code[i];
+            long long* dst = scratch + (size_t)CSV_BLOCK * (top - (t->op == OP_NEG ? 1 : 2));
+
+            if (t->op == OP_VAR) stack[top++] = table->i_data[t->value] + row;
+            else if (t->op == OP_NUM) stack[top++] = program->constants[i];
+            else if (t->op == OP_NEG) {
+                const long long* src = stack[top - 1];
+                for (int j = 0; j < n; j++) {
+                    if (src[j] == LLONG_MIN && !err[j]) err[j] = EVAL_OVERFLOW;
+                    dst[j] = src[j] == LLONG_MIN ? 0 : -src[j];
+                }
+                stack[top - 1] = dst;
+            }
+            else {
+                block_op_int(t->op, stack[top - 2], stack[top - 1], dst, n, err);
+                stack[top - 2] = dst;
+                top--;
+            }
+        }
+        memcpy(results + row, stack[0], sizeof(long long) * n);
+    }
+
+    free(scratch);
+    free(stack);
+}
+
+static double seconds_since(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+// --csv [--int] "<формула>" <файл>: результат по строке на строку данных в stdout,
+// статистика в stderr. Столбцы считаются в double или в int64 с проверкой переполнения;
+// --mod и --big к CSV не применяются и отклоняются, а не игнорируются
+int csv_mode(const char* expr, const char* filename, int int_mode) {
+    if (arith_mode != ARITH_CHECKED) {
+        fprintf(stderr, "Error: CSV mode supports only %s arithmetic, not --mod or --big\n",
+            int_mode ? "checked int64" : "double");
+        return 1;
+    }
+
+    FILE* file = fopen(filename, "rb");
+    if (!file) {
+        fprintf(stderr, "Error: Cannot open file %s\n", filename);
+        return 1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* source = malloc(size + 1);
+    size = fread(source, 1, size, file);
+    source[size] = '\0';
+    fclose(file);
+
+    CsvTable table;
+    memset(&table, 0, sizeof(CsvTable));
+    table.int_mode = int_mode;
+    vars_init(&table.columns);
+    CsvProgram program;
+    memset(&program, 0, sizeof(CsvProgram));
+    int ok = 1;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // Заголовок, затем формула (нужно знать используемые столбцы до чтения данных)
+    char* line = source;
+    char* next = strchr(line, '\n');
+    if (next) *next++ = '\0';
+    line[strcspn(line, "\r")] = '\0';
+    if (!csv_parse_header(&table, line)) {
+        fprintf(stderr, "Error: Invalid CSV header, expected column names\n");
+        ok = 0;
+    }
+    if (ok) {
+        int columns = table.columns.count;
+        table.used = calloc(columns, sizeof(int));
+        table.f_data = calloc(columns, sizeof(double*));
+        table.i_data = calloc(columns, sizeof(long long*));
+        ok = csv_compile(&table, expr, &program);
+    }
+
+    long line_num = 1;
+    for (line = next; ok && line && *line; line = next) {
+        next = strchr(line, '\n');
+        if (next) *next++ = '\0';
+        line_num++;
+        line[strcspn(line, "\r")] = '\0';
+        if (*trim(line) == '\0') continue;
+        if (!csv_parse_row(&table, line)) {
+            fprintf(stderr, "Error: line %ld: expected %d %s values\n", line_num, table.columns.count,
+                int_mode ? "integer" : "numeric");
+            ok = 0;
+        }
+    }
+    free(source);
+    double parse_time = seconds_since(&start);
+
+    if (ok) {
+        OutBuf out = { 0 };
+        long failed = 0;
+        double eval_time;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        if (int_mode) {
+            long long* results = malloc(sizeof(long long) * (table.rows ? table.rows : 1));
+            unsigned char* errors = calloc(table.rows ? table.rows : 1, 1);
+            csv_run_int(&table, &program, results, errors);
+            eval_time = seconds_since(&start);
+
+            for (long i = 0; i < table.rows; i++) {
+                if (errors[i]) {
+                    buf_append(&out, "ERROR: ", 7);
+                    buf_append_str(&out, eval_error_message((EvalStatus)errors[i]));
+                    failed++;
+                }
+                else buf_append_ll(&out, results[i]);
+                buf_append(&out, "\n", 1);
+                if (out.len >= OUT_FLUSH_SIZE) buf_flush(&out, stdout);
+            }
+            free(results);
+            free(errors);
+        }
+        else {
+            double* results = malloc(sizeof(double) * (table.rows ? table.rows : 1));
+            csv_run_double(&table, &program, results);
+            eval_time = seconds_since(&start);
+
+            char text[32];
+            for (long i = 0; i < table.rows; i++) {
+                if (isnan(results[i])) failed++;
+                int len = snprintf(text, sizeof(text), "%.15g\n", results[i]);
+                buf_append(&out, text, len);
+                if (out.len >= OUT_FLUSH_SIZE) buf_flush(&out, stdout);
+            }
+            free(results);
+        }
+        buf_flush(&out, stdout);
+        buf_free(&out);
+        fflush(stdout);
+
+        fprintf(stderr, "Rows: %ld, %s: %ld, parse: %.3f s, evaluation: %.3f s (%.1f M rows/s)\n",
+            table.rows, int_mode ? "errors" : "NaN", failed, parse_time, eval_time,
+            eval_time > 0 ? table.rows / eval_time / 1e6 : 0.0);
+    }
+
+    if (program.code) csv_program_free(&program);
+    csv_free(&table);
+    return ok ? 0 : 1;
+}
+
+// Нагрузочный тест и генератор корпуса для фаззинга: случайные корректные и испорченные
+// выражения с заданной глубиной скобок, числом операндов и набором операций. Для каждой
+// стадии - выражений в секунду и выделений памяти на выражение
+#define BENCH_MIN_TIME 0.2 // стадия повторяется по всему набору не меньше этого
+#define BENCH_TEXT_LIMIT (MAX_EXPR_LENGTH - 32) // запас под закрывающие скобки
+#define BENCH_MAX_DEPTH 10
+
+typedef struct {
+    int depth;          // наибольшая вложенность скобок
+    int operands;       // наибольшее число операндов
+    const char* ops;    // операции; повтор символа увеличивает его долю
+    double malformed;   // доля испорченных выражений
+} BenchGen;
+
+static uint64_t bench_state = 88172645463325252ULL;
+
+static uint64_t bench_rand() {
+    bench_state ^= bench_state << 13;
+    bench_state ^= bench_state >> 7;
+    bench_state ^= bench_state << 17;
+    return bench_state;
+}
+
+static void bench_expression(const BenchGen* gen, char* text, int* len, int depth, int* budget);
+
+// Операнд: число от 0 до 99 или выражение в скобках, иногда с унарным минусом
+static void bench_operand(const BenchGen* gen, char* text, int* len, int depth, int* budget) {
+    if (bench_rand() % 8 == 0) text[(*len)++] = '-';
+    if (depth < gen->depth && *budget > 1 && *len < BENCH_TEXT_LIMIT - 16 && bench_rand() % 3 == 0) {
+        text[(*len)++] = '(';
+        bench_expression(gen, text, len, depth + 1, budget);
+        text[(*len)++] = ')';
+        return;
+    }
+    (*budget)--;
+    *len += sprintf(text + *len, "%d", (int)(bench_rand() % 100));
+}
+
+// Операнды через операции, пока не кончится budget или место; показатель ^ - от 0 до 5
+static void bench_expression(const BenchGen* gen, char* text, int* len, int depth, int* budget) {
+    int op_count = strlen(gen->ops);
+    bench_operand(gen, text, len, depth, budget);
+
+    while (*budget > 0 && *len < BENCH_TEXT_LIMIT && bench_rand() % 4 != 0) {
+        char op = gen->ops[bench_rand() % op_count];
+        text[(*len)++] = ' ';
+        text[(*len)++] = op;
+        text[(*len)++] = ' ';
+        if (op == '^') {
+            (*budget)--;
+            *len += sprintf(text + *len, "%d", (int)(bench_rand() % 6));
+        }
+        else bench_operand(gen, text, len, depth, budget);
+    }
+}
+
+// Порча выражения: лишняя скобка, удаленный символ, лишняя операция или недопустимый символ
+static void bench_corrupt(char* text, int* len) {
+    static const char extra[] = "()+*$";
+    int kind = bench_rand() % 3;
+    int drop = kind == 1 && *len > 1;
+    // Удаляется существующий символ [0, len), вставка возможна и в конец строки
+    int pos = bench_rand() % (drop ? *len : *len + 1);
+
+    if (drop) {
+        memmove(text + pos, text + pos + 1, *len - pos);
+        (*len)--;
+    }
+    else {
+        memmove(text + pos + 1, text + pos, *len - pos + 1);
+        text[pos] = kind == 0 ? extra[bench_rand() % 2] : extra[2 + bench_rand() % 3];
+        (*len)++;
+    }
+}
+
+static char* bench_generate(const BenchGen* gen) {
+    char text[MAX_EXPR_LENGTH + 8];
+    int len = 0;
+    int budget = 1 + bench_rand() % gen->operands;
+    bench_expression(gen, text, &len, 0, &budget);
+    text[len] = '\0';
+    if ((bench_rand() >> 11) * 0x1.0p-53 < gen->malformed) bench_corrupt(text, &len);
+    return strdup(text);
+}
+
+// Стадии: на вход строка, результат 1 - успешно
+typedef int (*BenchStage)(const char* text);
+
+static int bench_balance(const char* text) {
+    return check_balance(text);
+}
+
+static int bench_convert(const char* text) {
+    char postfix[MAX_EXPR_LENGTH * 2];
+    return infix_to_postfix(text, postfix);
+}
+
+static int bench_evaluate(const char* text) {
+    long long result;
+    return evaluate_postfix(text, &result);
+}
+
+static int bench_pratt(const char* text) {
+    long long result;
+    return pratt_evaluate(text, NULL, &result, NULL) == EVAL_OK;
+}
+
+// Проход по всем строкам, пока не наберется BENCH_MIN_TIME; выделения и успехи -
+// по первому проходу
+static void bench_stage(const char* name, BenchStage stage, char** texts, int count) {
+    struct timespec start;
+    long passes = 0;
+    long allocs = 0;
+    int ok = 0;
+    double elapsed;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do {
+        long before = alloc_count;
+        int pass_ok = 0;
+        for (int i = 0; i < count; i++) pass_ok += stage(texts[i]);
+        if (passes == 0) {
+            allocs = alloc_count - before;
+            ok = pass_ok;
+        }
+        passes++;
+        elapsed = seconds_since(&start);
+    } while (elapsed < BENCH_MIN_TIME);
+
+    double per_expr = count ? elapsed / ((double)passes * count) : 0;
+    printf("%-18s %10d %13.0f %10.1f", name, count, per_expr > 0 ? 1 / per_expr : 0.0, per_expr * 1e9);
+    printf(" %12.3f %8.1f%%\n", count ? (double)allocs / count : 0.0, count ? 100.0 * ok / count : 0.0);
+}
+
+// --bench [--count N] [--depth D] [--length L] [--ops OPS] [--malformed P] [--seed S]
+//         [--corpus FILE]
+int bench_mode(int argc, char* argv[]) {
+    BenchGen gen = { 4, 16, "+-*/%^", 0.1 };
+    int count = 100000;
+    const char* corpus = NULL;
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--count") == 0 && i + 1 < argc) count = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--depth") == 0 && i + 1 < argc) gen.depth = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--length") == 0 && i + 1 < argc) gen.operands = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--ops") == 0 && i + 1 < argc) gen.ops = argv[++i];
+        else if (strcmp(argv[i], "--malformed") == 0 && i + 1 < argc) gen.malformed = atof(argv[++i]);
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) bench_state = strtoull(argv[++i], NULL, 10) | 1;
+        else if (strcmp(argv[i], "--corpus") == 0 && i + 1 < argc) corpus = argv[++i];
+        else {
+            fprintf(stderr, "Error: expected --bench [--count N] [--depth D] [--length L] [--ops OPS] "
+                "[--malformed P] [--seed S] [--corpus FILE]\n");
+            return 1;
+        }
+    }
+    if (count < 1 || gen.depth < 0 || gen.depth > BENCH_MAX_DEPTH || gen.operands < 1 ||
+        gen.malformed < 0 || gen.malformed > 1 || !*gen.ops || strspn(gen.ops, "+-*/%^") != strlen(gen.ops)) {
+        fprintf(stderr, "Error: count and length must be positive, depth from 0 to %d, malformed share in "
+            "[0, 1], operators from +-*/%%^\n", BENCH_MAX_DEPTH);
+        return 1;
+    }
+    if (arith_mode == ARITH_BIG) {
+        fprintf(stderr, "Error: benchmark supports --checked and --mod arithmetic\n");
+        return 1;
+    }
+
+    char** exprs = malloc(sizeof(char*) * count);
+    long total_len = 0;
+    for (int i = 0; i < count; i++) {
+        exprs[i] = bench_generate(&gen);
+        total_len += strlen(exprs[i]);
+    }
+
+    // Корпус: по выражению на строку, годится как входной файл
+    if (corpus) {
+        FILE* file = fopen(corpus, "w");
+        if (!file) {
+            fprintf(stderr, "Error: Cannot create corpus file %s\n", corpus);
+        }
+        else {
+            OutBuf out = { 0 };
+            for (int i = 0; i < count; i++) {
+                buf_append_str(&out, exprs[i]);
+                buf_append(&out, "\n", 1);
+                if (out.len >= OUT_FLUSH_SIZE) buf_flush(&out, file);
+            }
+            buf_flush(&out, file);
+            buf_free(&out);
+            fclose(file);
+        }
+    }
+
+    // RPN для стадии вычисления - только у преобразованных выражений
+    char** postfix = malloc(sizeof(char*) * count);
+    int converted = 0;
+    for (int i = 0; i < count; i++) {
+        char text[MAX_EXPR_LENGTH * 2];
+        if (infix_to_postfix(exprs[i], text)) postfix[converted++] = strdup(text);
+    }
+
+    printf("Expression benchmark: %d expressions, %.1f%% malformed, depth %d, up to %d operands, "
+        "operators %s, %s arithmetic\n", count, gen.malformed * 100, gen.depth, gen.operands, gen.ops,
+        arith_mode == ARITH_MOD ? "modular" : "checked");
+    printf("Average length: %.1f characters%s%s\n\n", (double)total_len / count,
+        corpus ? ", corpus written to " : "", corpus ? corpus : "");
+    printf("%-18s %10s %13s %10s %12s %9s\n", "Stage", "Inputs", "Expr/s", "ns/expr", "Allocs/expr", "OK");
+
+    bench_stage("check_balance", bench_balance, exprs, count);
+    bench_stage("infix_to_postfix", bench_convert, exprs, count);
+    bench_stage("evaluate_postfix", bench_evaluate, postfix, converted);
+    bench_stage("pratt_evaluate", bench_pratt, exprs, count);
+
+    for (int i = 0; i < count; i++) free(exprs[i]);
+    for (int i = 0; i < converted; i++) free(postfix[i]);
+    free(exprs);
+    free(postfix);
+    return 0;
+}
+
+// Самопроверка (--self-test): вычисления с известными ответами, результат - число
+// несовпадений. Столбцовый режим CSV сверяется с построчным evaluate_code, в том числе
+// на формулах, где рабочий блок стека - левый операнд и приемник одновременно
+#define SELF_TEST_ROWS 3000
+
+static int self_test_csv_formula(const char* formula, long long (*rows)[3], int count) {
+    CsvTable table;
+    memset(&table, 0, sizeof(CsvTable));
+    table.int_mode = 1;
+    vars_init(&table.columns);
+    char header[] = "a,b,c";
+    csv_parse_header(&table, header);
+    table.used = calloc(3, sizeof(int));
+    table.f_data = calloc(3, sizeof(double*));
+    table.i_data = calloc(3, sizeof(long long*));
+
+    CsvProgram program;
+    memset(&program, 0, sizeof(CsvProgram));
+    int failed = 0;
+    if (!csv_compile(&table, formula, &program)) failed = 1;
+
+    for (int i = 0; i < count && !failed; i++) {
+        char line[80];
+        snprintf(line, sizeof(line), "%lld,%lld,%lld", rows[i][0], rows[i][1], rows[i][2]);
+        if (!csv_parse_row(&table, line)) failed = 1;
+    }
+
+    if (!failed) {
+        long long* results = malloc(sizeof(long long) * count);
+        unsigned char* errors = calloc(count, 1);
+        csv_run_int(&table, &program, results, errors);
+
+        for (int i = 0; i < count; i++) {
+            long long expected;
+            EvalStatus status = evaluate_code(program.code, program.count, rows[i], &expected, NULL);
+            if ((EvalStatus)errors[i] == status && (status != EVAL_OK || results[i] == expected)) continue;
+            if (failed++ < 3) {
+                printf("FAIL: --csv --int \"%s\" on %lld,%lld,%lld: got %s %lld, expected %s %lld\n", formula,
+                    rows[i][0], rows[i][1], rows[i][2], errors[i] ? eval_error_message((EvalStatus)errors[i]) : "OK",
+                    results[i], status ? eval_error_message(status) : "OK", expected);
+            }
+        }
+        free(results);
+        free(errors);
+    }
+    else printf("FAIL: --csv --int \"%s\" cannot be compiled\n", formula);
+
+    csv_program_free(&program);
+    csv_free(&table);
+    return failed;
+}
+
+static int self_test_csv() {
+    static const char* formulas[] = {
+        "(a+b)*1152921504606846976",
+        "(a+b)-9223372036854775000",
+        "(a + b) * c ^ 20 / (a % 7)",
+        "(a*b - c) * (b - a) + (c + a) * b",
+        "-(a*b) + c % (b - a) - ~c",
+    };
+    long long (*rows)[3] = malloc(sizeof(long long[3]) * SELF_TEST_ROWS);
+    rows[0][0] = -733; rows[0][1] = -243; rows[0][2] = 1;
+    rows[1][0] = 1; rows[1][1] = 2; rows[1][2] = 3;
+    rows[2][0] = LLONG_MAX; rows[2][1] = -1; rows[2][2] = LLONG_MIN;
+    for (int i = 3; i < SELF_TEST_ROWS; i++) {
+        // Малые, средние и близкие к границе int64 значения
+        for (int j = 0; j < 3; j++) {
+            long long value = (long long)(bench_rand() >> (1 + bench_rand() % 63));
+            rows[i][j] = bench_rand() & 1 ? value : -value;
+        }
+    }
+
+    int failed = 0;
+    for (size_t f = 0; f < sizeof(formulas) / sizeof(formulas[0]); f++) {
+        failed += self_test_csv_formula(formulas[f], rows, SELF_TEST_ROWS) != 0;
+    }
+    free(rows);
+    return failed;
+}
+
+typedef struct {
+    ArithMode mode;
+    long long modulus;
+    const char* expr;
+    EvalStatus status;
+    const char* result;  // при EVAL_OK
+} SelfTestCase;
+
+static const SelfTestCase self_test_cases[] = {
+    { ARITH_CHECKED, 0, "-5 + 8", EVAL_OK, "3" },
+    { ARITH_CHECKED, 0, "2 ^ 62 + (2 ^ 62 - 1)", EVAL_OK, "9223372036854775807" },
+    { ARITH_CHECKED, 0, "2 ^ 63", EVAL_OVERFLOW, NULL },
+    { ARITH_CHECKED, 0, "10 / (5 - 5)", EVAL_DIV_ZERO, NULL },
+    { ARITH_CHECKED, 0, "7 % -1", EVAL_OK, "0" },
+    // Показатель степени в ARITH_MOD - обычное целое, не вычет
+    { ARITH_MOD, 10, "2 ^ 10", EVAL_OK, "4" },
+    { ARITH_MOD, 7, "3 ^ 7", EVAL_OK, "3" },
+    { ARITH_MOD, 7, "2 ^ 2 ^ 3", EVAL_OK, "4" },
+    { ARITH_MOD, 5, "2 ^ (3 + 4)", EVAL_OK, "3" },
+    { ARITH_MOD, 11, "(10 - 3) ^ 12", EVAL_OK, "5" },
+    { ARITH_MOD, 10, "-3 ^ 2", EVAL_OK, "1" },
+    { ARITH_MOD, 13, "2 ^ 99999999999", EVAL_OK, "8" },
+    { ARITH_MOD, 1000000007, "2 ^ 100", EVAL_OK, "976371285" },
+    { ARITH_MOD, 1000000007, "2 ^ -1", EVAL_NEG_POWER, NULL },
+    { ARITH_MOD, 1000000007, "2 ^ (10 ^ 19)", EVAL_OVERFLOW, NULL },
+    { ARITH_MOD, 1000000007, "7 % -1", EVAL_NO_REMAINDER, NULL },
+    { ARITH_MOD, 1000000007, "1 / 2", EVAL_OK, "500000004" },
+    { ARITH_MOD, 10, "1 / 2", EVAL_NOT_INVERTIBLE, NULL },
+    // Числа больше int64 в длинном режиме
+    { ARITH_BIG, 0, "100000000000000000000", EVAL_OK, "100000000000000000000" },
+    { ARITH_BIG, 0, "-(99999999999999999999999999999) + 1", EVAL_OK, "-99999999999999999999999999998" },
+    { ARITH_BIG, 0, "123456789012345678901234567890 * 10 ^ 5 / 1000000000000000000000",
+        EVAL_OK, "12345678901234" },
+    { ARITH_BIG, 0, "18446744073709551616 % 4294967297", EVAL_OK, "1" },
+    { ARITH_BIG, 0, "9223372036854775808 - 1", EVAL_OK, "9223372036854775807" },
+    { ARITH_BIG, 0, "1 / (10000000000000000000 - 10000000000000000000)", EVAL_DIV_ZERO, NULL },
+    { ARITH_CHECKED, 0, "100000000000000000000", EVAL_OVERFLOW, NULL },
+};
+
+static int self_test_report(const SelfTestCase* c, const char* path, EvalStatus status, const char* result) {
+    if (status == c->status && (status != EVAL_OK || strcmp(result, c->result) == 0)) return 0;
+    printf("FAIL: %s", c->mode == ARITH_MOD ? "--mod " : c->mode == ARITH_BIG ? "--big " : "");
+    if (c->mode == ARITH_MOD) printf("%lld ", c->modulus);
+    printf("\"%s\" (%s): got %s, expected %s\n", c->expr, path, status == EVAL_OK ? result : eval_error_message(status),
+        c->status == EVAL_OK ? c->result : eval_error_message(c->status));
+    return 1;
+}
+
+// Выражение через кеш (со сверткой констант), через compile_expression (без нее) и
+// разбором Пратта
+// Вычисление кода в режиме случая; результат - текст в text
+static EvalStatus self_test_run(const Token* code, int count, char* text, size_t size) {
+    if (arith_mode == ARITH_BIG) {
+        BigNum result;
+        EvalStatus status = evaluate_big(code, count, NULL, &result, NULL);
+        if (status != EVAL_OK) return status;
+        char* digits = big_to_string(&result);
+        snprintf(text, size, "%s", digits);
+        free(digits);
+        big_free(&result);
+        return EVAL_OK;
+    }
+
+    long long value;
+    EvalStatus status = evaluate_code(code, count, NULL, &value, NULL);
+    if (status == EVAL_OK) snprintf(text, size, "%lld", value);
+    return status;
+}
+
+static int self_test_case(const SelfTestCase* c) {
+    arith_mode = c->mode;
+    arith_modulus = c->modulus;
+    char text[MAX_EXPR_LENGTH * 2] = "";
+    int failed = 0;
+
+    ExprCache cache;
+    cache_init(&cache);
+    const CompiledExpr* expr = cache_get(&cache, c->expr);
+    EvalStatus parse_status = expr->status;
+    EvalStatus status = parse_status;
+    if (status == EVAL_OK) status = self_test_run(expr->code, expr->code_count, text, sizeof(text));
+    failed |= self_test_report(c, "folded", status, text);
+    cache_free(&cache);
+
+    // compile_expression не различает ошибки разбора - их проверяет путь через кеш
+    Token code[MAX_TOKENS];
+    int count = compile_expression(c->expr, code);
+    status = count < 0 ? parse_status : self_test_run(code, count, text, sizeof(text));
+    failed |= self_test_report(c, "unfolded", status, text);
+    if (count > 0) free_code(code, count);
+
+    // Разбор Пратта (--pratt, --stream); длинный режим он не поддерживает
+    if (c->mode != ARITH_BIG) {
+        long long value;
+        status = pratt_evaluate(c->expr, NULL, &value, NULL);
+        if (status == EVAL_OK) snprintf(text, sizeof(text), "%lld", value);
+        failed |= self_test_report(c, "pratt", status, text);
+    }
+    return failed;
+}
+
+int self_test_mode() {
+    int checks = 0, failed = 0;
+    ArithMode saved_mode = arith_mode;
+    long long saved_modulus = arith_modulus;
+
+    for (size_t i = 0; i < sizeof(self_test_cases) / sizeof(self_test_cases[0]); i++) {
+        checks++;
+        failed += self_test_case(&self_test_cases[i]);
+    }
+
+    arith_mode = ARITH_CHECKED;
+    checks++;
+    failed += self_test_csv();
+    arith_mode = saved_mode;
+    arith_modulus = saved_modulus;
+
+    printf("Self-test: %d checks, %d failed\n", checks, failed);
+    return failed ? 1 : 0;
+}
+
+// Режим арифметики: --checked (по умолчанию), --mod N, --big; способ вычисления
+// файлов: --pratt [--rpn]; отчет об ошибках: --errors-json. Возвращает число
+// разобранных аргументов или -1 при ошибке
+static int parse_arith_options(int argc, char* argv[]) {
+    int arg = 1;
+    while (arg < argc) {
+        if (strcmp(argv[arg], "--checked") == 0) arith_mode = ARITH_CHECKED;
+        else if (strcmp(argv[arg], "--big") == 0) arith_mode = ARITH_BIG;
+        else if (strcmp(argv[arg], "--pratt") == 0) pratt_mode = 1;
+        else if (strcmp(argv[arg], "--rpn") == 0) pratt_rpn = 1;
+        else if (strcmp(argv[arg], "--errors-json") == 0) error_json = 1;
+        else if (strcmp(argv[arg], "--mod") == 0 && arg + 1 < argc) {
+            char* end;
+            arith_modulus = strtoll(argv[++arg], &end, 10);
+            if (*end != '\0' || arith_modulus < 2) {
+                printf("Error: modulus must be an integer from 2 to %lld\n", LLONG_MAX);
+                return -1;
+            }
+            arith_mode = ARITH_MOD;
+        }
+        else break;
+        arg++;
+    }
+    return arg - 1;
+}
+
+int main(int argc, char* argv[]) {
+    // Опции режима арифметики идут перед режимом работы
+    int options = parse_arith_options(argc, argv);
+    if (options < 0) return 1;
+    argv[options] = argv[0];
+    argv += options;
+    argc -= options;
+
+    // Потоковый режим: в stdout только ответы, без заставки и ожидания Enter
+    if (argc == 2 && strcmp(argv[1], "--stream") == 0) {
+        return stream_mode();
+    }
+    // Самопроверка
+    if (argc == 2 && strcmp(argv[1], "--self-test") == 0) {
+        return self_test_mode();
+    }
+    // Нагрузочный тест стадий разбора и вычисления
+    if (argc >= 2 && strcmp(argv[1], "--bench") == 0) {
+        return bench_mode(argc, argv);
+    }
+    // Столбцовый режим CSV: в stdout только результаты
+    if (argc >= 4 && strcmp(argv[1], "--csv") == 0) {
+        int int_mode = strcmp(argv[2], "--int") == 0;
+        if (argc == 4 + int_mode) return csv_mode(argv[2 + int_mode], argv[3 + int_mode], int_mode);
+    }
+
+    printf("=========================================\n");
+    printf("   ARITHMETIC EXPRESSION CALCULATOR\n");
+    printf("=========================================\n\n");
+
+    if (argc == 1) {
+        // Демо режим
+        demo_mode();
+    }
+    else if (strcmp(argv[1], "--script") == 0 && argc == 3) {
+        // Скрипт с переменными
+        script_mode(argv[2]);
+    }
+    else if (strcmp(argv[1], "--parallel") == 0 && argc >= 3) {
+        // Параллельная обработка большого файла
+        int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        int arg = 2;
+        if (strcmp(argv[arg], "--threads") == 0 && argc >= 5) {
+            threads = atoi(argv[arg + 1]);
+            arg += 2;
+        }
+        parallel_file_mode(argv[arg], threads);
     }
     else if (argc == 2) {
         // Обработка одного файла
@@ -453,6 +3332,17 @@ int main(int argc, char* argv[]) {
         printf("Usage:\n");
         printf("  %s                    - run demo mode\n", argv[0]);
         printf("  %s <filename>         - process specific file\n", argv[0]);
+        printf("  %s --parallel [--threads N] <filename> - process large file on a thread pool\n", argv[0]);
+        printf("  %s --script <filename> - run script with variables and print\n", argv[0]);
+        printf("  %s --stream            - read expressions from stdin, one answer line per input line\n", argv[0]);
+        printf("  %s --csv [--int] \"<formula>\" <file.csv> - evaluate formula over CSV columns\n", argv[0]);
+        printf("  %s --bench [--count N] [--depth D] [--length L] [--ops OPS] [--malformed P] [--seed S]\n", argv[0]);
+        printf("      [--corpus FILE] - benchmark parsing stages on random expressions\n");
+        printf("  %s --self-test         - check evaluation modes against known answers\n", argv[0]);
+        printf("Arithmetic options (before the mode): --checked (default, int64 with overflow check),\n");
+        printf("  --mod N (modulo N), --big (arbitrary precision); --csv accepts only --checked\n");
+        printf("  --pratt (evaluate files in one pass without RPN), --rpn (print RPN in that mode)\n");
+        printf("  --errors-json (write the error report as JSON Lines to errors.jsonl)\n");
         printf("\nExample:\n");
         printf("  %s\n", argv[0]);
         printf("  %s my_expressions.txt\n", argv[0]);